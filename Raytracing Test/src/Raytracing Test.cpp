@@ -1,46 +1,45 @@
-#include <iostream>
 #include <algorithm>
-#include <execution>
-#include <ranges>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "shared.h"
+#include "adaptive.h"
 #include "aarect.h"
+#include "bench.h"
 #include "box.h"
+#include "bvh.h"
 #include "camera.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "denoiser.h"
+#include "feature_buffer.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
+#include "image_compare.h"
+#include "image_writer.h"
+#include "instance.h"
+#include "integrator.h"
+#include "lights.h"
 #include "material.h"
+#include "mesh_loader.h"
+#include "scene_file.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "snapshot.h"
 #include "sphere.h"
+#include "stats.h"
+#include "triangle_mesh.h"
+#include "wavefront.h"
+#include "wide_bvh.h"
 
-color ray_color(const ray& r, const color& background, const hittable& world, shared_ptr<hittable> lights, int depth)
-{
-	hit_record rec;
-	if (depth <= 0)
-		return color(0, 0, 0);
-	if (!world.hit(r, 0.001, infinity, rec))
-		return background;
-
-	scatter_record srec;
-	color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
-
-	if (!rec.mat_ptr->scatter(r, rec, srec))
-		return emitted;
-
-	if (srec.is_specular)
-	{
-		return srec.attenuation * ray_color(srec.specular_ray, background, world, lights, depth - 1);
-	}
-
-	auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-	mixture_pdf p(light_ptr, srec.pdf_ptr);
-	ray scattered = ray(rec.p, p.generate(), r.time());
-	auto pdf_val = p.value(scattered.direction());
-
-	return emitted + srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered)
-		* ray_color(scattered, background, world, lights, depth - 1) / pdf_val;
-}
-
-hittable_list cornell_box()
+// The glass sphere is replaced by mesh when one is given, scaled and moved to fill the sphere's bounds.
+hittable_list cornell_box(shared_ptr<mesh_data> mesh)
 {
 	hittable_list objects;
 
@@ -57,78 +56,389 @@ hittable_list cornell_box()
 	objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
 
 	shared_ptr<material> aluminum = make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
-	shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), aluminum);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-	objects.add(box1);
+	auto box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), aluminum);
+	objects.add(make_shared<instance>(box1,
+		affine_transform::translation(vec3(265, 0, 295)) * affine_transform::rotation(vec3(0, 1, 0), 15)));
 
 	auto glass = make_shared<dielectric>(1.5);
-	objects.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+	if (!mesh)
+	{
+		objects.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+		return objects;
+	}
+
+	auto bounds = mesh->bounds();
+	auto extent = bounds.max() - bounds.min();
+	auto scale = 180 / std::max(extent.x(), std::max(extent.y(), extent.z()));
+	mesh->transform(scale, point3(190, 90, 190) - scale * 0.5 * (bounds.min() + bounds.max()));
+	objects.add(make_shared<triangle_mesh>(mesh, glass));
 
 	return objects;
 }
 
-int main()
+int main(int argc, char** argv)
 {
-	const auto aspect_ratio = 1.0;
-	const int image_width = 500;
+	render_settings settings;
+	if (!parse_arguments(argc, argv, settings))
+		return 1;
+
+	// Images are converted as the scene loads, so the texture options come from the command line
+	// alone; scene files reject them.
+	shared_texture_cache().configure(settings.texture_cache_mb << 20, settings.texture_dir);
+
+	if (!settings.bench.empty())
+		return validate_settings(settings, argv[0]) && run_benchmarks(settings) ? 0 : 1;
+
+	// A scene file's render options come first, so the command line overrides them. A snapshot
+	// carries them too, along with the scene already compiled into its BVH. Options are checked
+	// once they are merged, as one may depend on another given in the other place.
+	scene_description scene;
+	shared_ptr<linear_bvh> bvh;
+	if (!settings.scene.empty())
+	{
+		auto load_start = std::chrono::steady_clock::now();
+		if (is_snapshot(settings.scene))
+		{
+			if (!load_snapshot(settings.scene, scene, bvh))
+				return 1;
+			std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+			std::cerr << "Snapshot: " << bvh->scene->prims.size() << " primitives, mapped in " << load_time.count() << " s\n";
+		}
+		else
+		{
+			if (!load_scene(settings.scene, scene, settings.threads))
+				return 1;
+			std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+			std::cerr << "Scene: " << scene.statements << " statements, loaded in " << load_time.count() << " s\n";
+		}
+
+		std::vector<char*> arguments{ argv[0] };
+		for (auto& argument : scene.render_arguments) arguments.push_back(argument.data());
+		arguments.insert(arguments.end(), argv + 1, argv + argc);
+		settings = render_settings();
+		if (!parse_arguments(static_cast<int>(arguments.size()), arguments.data(), settings))
+			return 1;
+	}
+	if (!validate_settings(settings, argv[0]))
+		return 1;
+
+	image_format output_format = image_format::ppm;
+	if (!settings.output.empty() && !image_format_from_path(settings.output, output_format))
+	{
+		std::cerr << "Unknown image format for '" << settings.output << "'; use .ppm, .pfm, .png or .exr.\n";
+		return 1;
+	}
+
+	const auto aspect_ratio = scene.aspect_ratio;
+	const int image_width = settings.image_width;
 	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int samples_per_pixel = 1000;
-	const int max_depth = 50;
-
-	auto lights = make_shared<hittable_list>();
-	lights->add(make_shared<xz_rect>(213, 343, 227, 332, 554, shared_ptr<material>()));
-	lights->add(make_shared<sphere>(point3(190, 90, 190), 90, shared_ptr<material>()));
-	auto world = cornell_box();
-	color background(0, 0, 0);
-
-	point3 lookfrom(278, 278, -800);
-	point3 lookat(278, 278, 0);
-	vec3 vup(0, 1, 0);
-	auto dist_to_focus = 10.0;
-	auto aperture = 0.0;
-	auto vfov = 40.0;
-	auto time0 = 0.0;
-	auto time1 = 1.0;
-
-	camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, time0, time1);
-
-	std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-#define MULTITHREADING 1
-#if MULTITHREADING
-
-	for (int j = image_height - 1; j >= 0; --j) {
-		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-		for (int i = 0; i < image_width; ++i) {
-			color pixel_color(0, 0, 0);
-			auto sample_indices = std::vector<int>(samples_per_pixel);
-			std::iota(sample_indices.begin(), sample_indices.end(), 0);
-			std::for_each(std::execution::par, sample_indices.begin(), sample_indices.end(), [&](int) {
-				auto u = (i + random_double()) / (image_width - 1);
-				auto v = (j + random_double()) / (image_height - 1);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, background, world, lights, max_depth);
-				});
-			write_color(std::cout, pixel_color, samples_per_pixel);
+	const int samples_per_pixel = settings.samples_per_pixel;
+	const int max_depth = settings.max_depth;
+	const int rr_depth = settings.rr_depth;
+	const int frame = 0;
+
+	reference_image reference;
+	if (!settings.reference.empty())
+	{
+		if (!reference.load(settings.reference))
+			return 1;
+		if (reference.width != image_width || reference.height != image_height)
+		{
+			std::cerr << "The reference is " << reference.width << 'x' << reference.height << " but the render is "
+				<< image_width << 'x' << image_height << ".\n";
+			return 1;
 		}
 	}
 
-#else
-	for (int j = image_height - 1; j >= 0; --j) {
-		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-		for (int i = 0; i < image_width; ++i) {
-			color pixel_color(0, 0, 0);
-			for (int s = 0; s < samples_per_pixel; ++s) {
-				auto u = (i + random_double()) / (image_width - 1);
-				auto v = (j + random_double()) / (image_height - 1);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, background, world, lights, max_depth);
+	color background = scene.background;
+	auto time0 = scene.time0;
+	auto time1 = scene.time1;
+
+	shared_ptr<mesh_data> mesh;
+	if (!settings.mesh.empty() && settings.scene.empty())
+	{
+		auto load_start = std::chrono::steady_clock::now();
+		mesh = make_shared<mesh_data>();
+		if (!load_mesh(settings.mesh, *mesh, settings.threads))
+			return 1;
+		std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+		std::cerr << "Mesh: " << mesh->positions.size() << " vertices, " << mesh->triangle_count() << " triangles, loaded in "
+			<< load_time.count() << " s\n";
+	}
+
+	const bool from_snapshot = bvh != nullptr;
+	if (!from_snapshot)
+	{
+		bvh_build_options bvh_options;
+		bvh_options.spatial_splits = true;
+		bvh = make_shared<linear_bvh>(settings.scene.empty() ? cornell_box(mesh) : scene.objects, time0, time1, bvh_options);
+	}
+	std::cerr << "BVH: " << bvh->stats << (from_snapshot ? ", saved in the snapshot" : "") << '\n';
+
+	if (!settings.save_snapshot.empty())
+		return save_snapshot(settings.save_snapshot, *bvh, scene) ? 0 : 1;
+
+	// Every diffuse_light in the scene is found while compiling it, so lights are not declared twice.
+	light_set lights(bvh->scene->emitters, time0, time1);
+	std::cerr << "Lights: " << lights.size() << '\n';
+
+	shared_ptr<hittable> world = bvh;
+	if (settings.bvh == "wide4") world = make_shared<wide_bvh<4>>(*bvh);
+	else if (settings.bvh == "wide8") world = make_shared<wide_bvh<8>>(*bvh);
+
+	camera cam(scene.lookfrom, scene.lookat, scene.vup, scene.vfov, aspect_ratio, scene.aperture, scene.focus_dist, time0, time1);
+	const double pixel_spread = cam.pixel_spread(image_height);
+
+	tile_scheduler scheduler(image_width, image_height);
+	wavefront_integrator wavefront(*world, lights, background, max_depth);
+	wavefront.threads = settings.threads;
+	wavefront.packet_size = settings.packet_size;
+	wavefront.rr_depth = rr_depth;
+	wavefront.wave_size = settings.wave_size;
+
+	// What each pixel's samples cost, in nanoseconds or BVH nodes visited, for --cost-map.
+	framebuffer cost_film(image_width, image_height);
+	const bool measure_cost = !settings.cost_map.empty();
+	const bool cost_in_nodes = settings.cost_metric == "nodes";
+
+	// Adds samples first_sample .. first_sample + sample_count - 1 of every pixel in work to target,
+	// and their first hit features to features when that is given.
+	auto render_pass = [&](framebuffer& target, const std::vector<tile>& work, int first_sample, int sample_count,
+		feature_buffer* features) {
+		if (settings.integrator == "wavefront")
+		{
+			wavefront.render(cam, work, first_sample, sample_count, frame, target, features);
+			return;
+		}
+
+		scheduler.run(settings.threads, work, [&](const tile& t, int) {
+			std::vector<color> accum(static_cast<size_t>(t.width()) * t.height());
+			std::vector<double> squares(accum.size());
+
+			auto pixel_index = [&](int i, int j) { return (j - t.y0) * t.width() + (i - t.x0); };
+
+			if (settings.packet_size == 0)
+			{
+				scheduler.for_each_pixel(t, [&](int i, int j) {
+					auto cost_start = measure_cost ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+					auto nodes_start = thread_nodes_visited();
+					color pixel_color(0, 0, 0);
+					double pixel_squares = 0;
+					for (int s = first_sample; s < first_sample + sample_count; ++s) {
+						thread_sampler().start_sample(j * image_width + i, s, frame);
+						auto u = (i + random_double()) / (image_width - 1);
+						auto v = (j + random_double()) / (image_height - 1);
+						ray r = cam.get_ray(u, v);
+						path_features first_hit;
+						color sample = ray_color(r, background, *world, lights, max_depth, rr_depth, pixel_spread, &first_hit);
+						if (features) features->add(target.index(i, j), first_hit);
+						pixel_color += sample;
+						pixel_squares += luminance(sample) * luminance(sample);
+					}
+					accum[pixel_index(i, j)] = pixel_color;
+					squares[pixel_index(i, j)] = pixel_squares;
+
+					if (measure_cost)
+					{
+						std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - cost_start;
+						auto cost = cost_in_nodes ? static_cast<double>(thread_nodes_visited() - nodes_start) : elapsed.count();
+						cost_film.add(cost_film.index(i, j), color(cost, cost, cost), 0, sample_count);
+					}
+					});
+			}
+			else
+			{
+				// Consecutive pixels in Morton order form compact blocks, so their camera rays are coherent.
+				std::vector<std::pair<int, int>> pixels;
+				scheduler.for_each_pixel(t, [&](int i, int j) { pixels.emplace_back(i, j); });
+
+				ray_packet rays;
+				packet_hits hits;
+				sampler lane_samplers[max_packet_size];
+
+				for (size_t first = 0; first < pixels.size(); first += settings.packet_size)
+				{
+					rays.resize(static_cast<int>(std::min(pixels.size() - first, static_cast<size_t>(settings.packet_size))));
+
+					for (int s = first_sample; s < first_sample + sample_count; ++s) {
+						for (int lane = 0; lane < rays.size; lane++) {
+							auto [i, j] = pixels[first + lane];
+							thread_sampler().start_sample(j * image_width + i, s, frame);
+							auto u = (i + random_double()) / (image_width - 1);
+							auto v = (j + random_double()) / (image_height - 1);
+							rays.set(lane, cam.get_ray(u, v));
+							lane_samplers[lane] = thread_sampler();
+						}
+
+						hits.mask = 0;
+						count_ray(ray_kind::camera, rays.size);
+						world->hit_packet(rays, rays.all_lanes(), 0, hits);
+
+						for (int lane = 0; lane < rays.size; lane++) {
+							auto [i, j] = pixels[first + lane];
+							thread_sampler() = lane_samplers[lane];
+							path_features first_hit;
+							first_hit.albedo = background;
+							if (!(hits.mask & (1u << lane)))
+								count_path_end(path_end::escaped, 0);
+							color sample = hits.mask & (1u << lane)
+								? shade(rays.get(lane), hits.rec[lane], background, *world, lights, max_depth, rr_depth, pixel_spread, &first_hit)
+								: background;
+							if (features) features->add(target.index(i, j), first_hit);
+							accum[pixel_index(i, j)] += sample;
+							squares[pixel_index(i, j)] += luminance(sample) * luminance(sample);
+						}
+					}
+				}
 			}
-			write_color(std::cout, pixel_color, samples_per_pixel);
+
+			for (int j = t.y0; j < t.y1; ++j)
+				for (int i = t.x0; i < t.x1; ++i)
+					target.add(target.index(i, j), accum[pixel_index(i, j)], squares[pixel_index(i, j)], sample_count);
+			});
+	};
+
+	auto write_output = [&](const framebuffer& film) {
+		if (settings.output.empty())
+		{
+#if defined(_WIN32)
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			return write_image(std::cout, film, output_format);
 		}
+		return write_image(settings.output, film);
+	};
+
+	// Progressive rendering: every pass adds pass_samples samples per pixel. With a checkpoint the
+	// accumulation lives in a mapped file, and each pass also refreshes --output as a preview.
+	// Adaptive sampling makes every pass a round of min_samples that only goes to the tiles still
+	// above the error threshold; a converged tile is never sampled again, so every tile in a round
+	// shares the same sample count.
+	const bool adaptive = settings.adaptive_threshold > 0;
+	const int pass_samples = adaptive ? settings.min_samples
+		: settings.pass_samples > 0 ? settings.pass_samples : samples_per_pixel;
+	const int pass_count = (samples_per_pixel + pass_samples - 1) / pass_samples;
+
+	render_checkpoint checkpoint;
+	framebuffer memory_film(image_width, image_height);
+	framebuffer pass_film(image_width, image_height);
+	feature_buffer features(image_width, image_height);
+
+	int first_pass = 0;
+	if (!settings.checkpoint.empty())
+	{
+		bool ready = settings.resume
+			? checkpoint.open(settings.checkpoint, image_width, image_height, samples_per_pixel, pass_samples,
+				static_cast<float>(settings.adaptive_threshold), frame, render_identity(settings))
+			: checkpoint.create(settings.checkpoint, image_width, image_height, samples_per_pixel, pass_samples,
+				static_cast<float>(settings.adaptive_threshold), frame, render_identity(settings));
+		if (!ready)
+			return 1;
+		first_pass = checkpoint.passes_done();
+		if (first_pass > 0)
+			std::cerr << "Resuming after pass " << first_pass << " of " << pass_count << ".\n";
 	}
+	// The checkpoint alternates between two slots, so its current film changes with every pass.
+	auto film = [&]() -> const framebuffer& { return settings.checkpoint.empty() ? memory_film : checkpoint.film(); };
+
+	auto render_start = std::chrono::steady_clock::now();
+	for (int pass = first_pass; pass < pass_count; pass++)
+	{
+		auto first_sample = pass * pass_samples;
+		auto sample_count = std::min(pass_samples, samples_per_pixel - first_sample);
+
+		auto work = scheduler.tiles();
+		if (adaptive && pass > 0)
+		{
+			work = unconverged_tiles(film(), scheduler.tiles(), settings.adaptive_threshold);
+			std::cerr << "\rRound " << pass + 1 << ": " << work.size() << " of " << scheduler.tiles().size()
+				<< " tiles above the error threshold.\n";
+			if (work.empty())
+				break;
+		}
+
+		// Features come from the first pass this run renders; later passes would only add the same again.
+		pass_film.clear();
+		render_pass(pass_film, work, first_sample, sample_count, settings.denoise && pass == first_pass ? &features : nullptr);
+		if (settings.checkpoint.empty())
+			memory_film.assign_sum(memory_film, pass_film);
+		else
+			checkpoint.commit_pass(pass_film);
+
+		std::cerr << "\rPass " << pass + 1 << " of " << pass_count << " done. " << std::flush;
+		if (!settings.output.empty() && pass + 1 < pass_count && !write_output(film()))
+			return 1;
+	}
+
+	std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_start;
+
+	if (!settings.denoise)
+	{
+		if (!write_output(film()))
+			return 1;
+	}
+	else
+	{
+		auto denoise_start = std::chrono::steady_clock::now();
+
+		// A resumed render may not have sampled every pixel this run, so trace just the first bounce
+		// for the features it is missing.
+		const int feature_samples = 4;
+		scheduler.run(settings.threads, [&](const tile& t, int) {
+			scheduler.for_each_pixel(t, [&](int i, int j) {
+				if (features.samples(features.index(i, j)) > 0)
+					return;
+				for (int s = 0; s < feature_samples; s++) {
+					thread_sampler().start_sample(j * image_width + i, s, frame);
+					auto u = (i + random_double()) / (image_width - 1);
+					auto v = (j + random_double()) / (image_height - 1);
+					path_features first_hit;
+					ray_color(cam.get_ray(u, v), background, *world, lights, 1, 1, pixel_spread, &first_hit);
+					features.add(features.index(i, j), first_hit);
+				}
+				});
+			});
+
+		framebuffer denoised(image_width, image_height);
+		atrous_denoiser(film(), features).run(denoised, settings.threads);
+		std::chrono::duration<double> denoise_time = std::chrono::steady_clock::now() - denoise_start;
+		std::cerr << "\nDenoised in " << denoise_time.count() << " s.";
+
+		if (!write_output(denoised))
+			return 1;
+		if (!settings.reference.empty())
+			std::cerr << "\nDenoised relative MSE: " << reference.relative_mse(denoised);
+	}
+
+	if (!settings.reference.empty())
+		std::cerr << "\nRendered in " << render_time.count() << " s, relative MSE: " << reference.relative_mse(film());
+
+	if (adaptive)
+	{
+		uint64_t total_samples = 0;
+		for (size_t p = 0; p < film().pixel_count(); p++)
+			total_samples += film().samples(p);
+		std::cerr << "\nAverage samples per pixel: " << static_cast<double>(total_samples) / film().pixel_count() << '\n';
+	}
+
+	if (measure_cost && !write_heatmap(settings.cost_map, cost_film))
+		return 1;
+
+	if (!settings.stats.empty())
+	{
+		std::vector<std::string> prim_names, material_names;
+		for (int i = 0; i < prim_type_count; i++)
+			prim_names.push_back(prim_type_name(static_cast<prim_type>(i)));
+		for (int i = 0; i < material_kind_count; i++)
+			material_names.push_back(material_kind_name(static_cast<material_kind>(i)));
+		if (!write_stats(settings.stats, shared_stats().merged(), prim_names, material_names, max_depth))
+			return 1;
+	}
+
+	auto& textures = shared_texture_cache();
+	if (textures.hits() + textures.misses() > 0)
+		std::cerr << "\nTexture tiles: " << textures.misses() << " loaded, "
+			<< 100.0 * textures.hits() / (textures.hits() + textures.misses()) << "% of reads cached\n";
 
-#endif
 	std::cerr << "\nDone.\n";
 }
\ No newline at end of file
@@ -12,18 +12,24 @@ public:
 	point3 max() const { return maximum; }
 
 	bool hit(const ray& r, double t_min, double t_max) const;
+	bool hit(const point3& origin, const vec3& inv_dir, double t_min, double t_max) const;
 
 	point3 minimum;
 	point3 maximum;
 };
 
 inline bool aabb::hit(const ray& r, double t_min, double t_max) const
+{
+	const vec3 inv_dir(1.0 / r.dir.e[0], 1.0 / r.dir.e[1], 1.0 / r.dir.e[2]);
+	return hit(r.orig, inv_dir, t_min, t_max);
+}
+
+inline bool aabb::hit(const point3& origin, const vec3& inv_dir, double t_min, double t_max) const
 {
 	for (int a = 0; a < 3; a++) {
-		auto invD = 1.0f / r.direction()[a];
-		auto t0 = (min()[a] - r.origin()[a]) * invD;
-		auto t1 = (max()[a] - r.origin()[a]) * invD;
-		if (invD < 0.0f) std::swap(t0, t1);
+		auto t0 = (minimum.e[a] - origin.e[a]) * inv_dir.e[a];
+		auto t1 = (maximum.e[a] - origin.e[a]) * inv_dir.e[a];
+		if (inv_dir.e[a] < 0.0) std::swap(t0, t1);
 		t_min = t0 > t_min ? t0 : t_min;
 		t_max = t1 < t_max ? t1 : t_max;
 		if (t_max <= t_min) return false;
@@ -2,6 +2,32 @@
 #include "shared.h"
 #include "hittable.h"
 
+// Packet test shared by the three axis-aligned rectangles: plane k on axis k_axis, bounded by [a0, a1] x [b0, b1].
+template <typename rect>
+void aarect_hit_packet(const rect& r, int k_axis, int a_axis, int b_axis, double a0, double a1, double b0, double b1,
+	double k, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits)
+{
+	double t[max_packet_size], a[max_packet_size], b[max_packet_size];
+	bool found[max_packet_size];
+
+	for (int lane = 0; lane < max_packet_size; lane++)
+	{
+		t[lane] = (k - rays.org[k_axis][lane]) / rays.dir[k_axis][lane];
+		a[lane] = rays.org[a_axis][lane] + t[lane] * rays.dir[a_axis][lane];
+		b[lane] = rays.org[b_axis][lane] + t[lane] * rays.dir[b_axis][lane];
+		found[lane] = t[lane] >= t_min && t[lane] <= rays.t_max[lane]
+			&& a[lane] >= a0 && a[lane] <= a1 && b[lane] >= b0 && b[lane] <= b1;
+	}
+
+	for (auto lanes = active & lanes_from_flags(found, max_packet_size); lanes; lanes &= lanes - 1)
+	{
+		auto lane = lowest_lane(lanes);
+		r.set_hit_record(rays.get(lane), t[lane], a[lane], b[lane], hits.rec[lane]);
+		rays.t_max[lane] = t[lane];
+		hits.mask |= 1u << lane;
+	}
+}
+
 class xy_rect : public hittable
 {
 public:
@@ -11,6 +37,8 @@ public:
 		: x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
+	void set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
 	{
@@ -18,6 +46,25 @@ public:
 		return true;
 	}
 
+	virtual double pdf_value(const point3& origin, const vec3& v) const override
+	{
+		hit_record rec;
+		if (!this->hit(ray(origin, v), 0, infinity, rec))
+			return 0;
+
+		auto area = (x1 - x0) * (y1 - y0);
+		auto distance_squared = rec.t * rec.t * v.length_squared();
+		auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+		return distance_squared / (cosine * area);
+	}
+
+	virtual vec3 random(const point3& origin) const override
+	{
+		auto random_point = point3(random_double(x0, x1), random_double(y0, y1), k);
+		return random_point - origin;
+	}
+
 	shared_ptr<material> mp;
 	double x0, x1, y0, y1, k;
 };
@@ -31,6 +78,8 @@ public:
 		: x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
+	void set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
 	{
@@ -41,7 +90,7 @@ public:
 	virtual double pdf_value(const point3& origin, const vec3& v) const override
 	{
 		hit_record rec;
-		if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+		if (!this->hit(ray(origin, v), 0, infinity, rec))
 			return 0;
 
 		auto area = (x1 - x0) * (z1 - z0);
@@ -70,6 +119,8 @@ public:
 		: y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
+	void set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
 	{
@@ -77,6 +128,25 @@ public:
 		return true;
 	}
 
+	virtual double pdf_value(const point3& origin, const vec3& v) const override
+	{
+		hit_record rec;
+		if (!this->hit(ray(origin, v), 0, infinity, rec))
+			return 0;
+
+		auto area = (y1 - y0) * (z1 - z0);
+		auto distance_squared = rec.t * rec.t * v.length_squared();
+		auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+		return distance_squared / (cosine * area);
+	}
+
+	virtual vec3 random(const point3& origin) const override
+	{
+		auto random_point = point3(k, random_double(y0, y1), random_double(z0, z1));
+		return random_point - origin;
+	}
+
 	shared_ptr<material> mp;
 	double y0, y1, z0, z1, k;
 };
@@ -90,15 +160,26 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
 	auto y = r.origin().y() + t * r.direction().y();
 	if (x < x0 || x > x1 || y < y0 || y > y1) return false;
 
-	rec.u = (x - x0) / (x1 - x0);
-	rec.v = (y - y0) / (y1 - y0);
+	set_hit_record(r, t, x, y, rec);
+	return true;
+}
+
+void xy_rect::set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const
+{
+	rec.u = (a - x0) / (x1 - x0);
+	rec.v = (b - y0) / (y1 - y0);
+	rec.uv_scale = sqrt((x1 - x0) * (y1 - y0));
 	rec.t = t;
 	auto outward_normal = vec3(0, 0, 1);
 	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mp;
+	rec.mat_ptr = mp.get();
 	rec.p = r.at(t);
+	rec.p[2] = k;
+}
 
-	return true;
+void xy_rect::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	aarect_hit_packet(*this, 2, 0, 1, x0, x1, y0, y1, k, rays, active, t_min, hits);
 }
 
 bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
@@ -112,15 +193,26 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
 	if (x < x0 || x > x1 || z < z0 || z > z1)
 		return false;
 
-	rec.u = (x - x0) / (x1 - x0);
-	rec.v = (z - z0) / (z1 - z0);
+	set_hit_record(r, t, x, z, rec);
+	return true;
+}
+
+void xz_rect::set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const
+{
+	rec.u = (a - x0) / (x1 - x0);
+	rec.v = (b - z0) / (z1 - z0);
+	rec.uv_scale = sqrt((x1 - x0) * (z1 - z0));
 	rec.t = t;
 	auto outward_normal = vec3(0, 1, 0);
 	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mp;
+	rec.mat_ptr = mp.get();
 	rec.p = r.at(t);
+	rec.p[1] = k;
+}
 
-	return true;
+void xz_rect::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	aarect_hit_packet(*this, 1, 0, 2, x0, x1, z0, z1, k, rays, active, t_min, hits);
 }
 
 bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
@@ -134,13 +226,24 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
 	if (y < y0 || y > y1 || z < z0 || z > z1)
 		return false;
 
-	rec.u = (y - y0) / (y1 - y0);
-	rec.v = (z - z0) / (z1 - z0);
+	set_hit_record(r, t, y, z, rec);
+	return true;
+}
+
+void yz_rect::set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const
+{
+	rec.u = (a - y0) / (y1 - y0);
+	rec.v = (b - z0) / (z1 - z0);
+	rec.uv_scale = sqrt((y1 - y0) * (z1 - z0));
 	rec.t = t;
 	auto outward_normal = vec3(1, 0, 0);
 	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mp;
+	rec.mat_ptr = mp.get();
 	rec.p = r.at(t);
+	rec.p[0] = k;
+}
 
-	return true;
+void yz_rect::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	aarect_hit_packet(*this, 0, 1, 2, y0, y1, z0, z1, k, rays, active, t_min, hits);
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include <cmath>
+#include <vector>
+
+#include "framebuffer.h"
+#include "scheduler.h"
+
+// Root mean square of the relative error of every pixel in the tile. Averaging over the tile
+// keeps a single firefly from holding a whole converged region at the maximum sample count.
+inline double tile_error(const framebuffer& film, const tile& t)
+{
+	double sum = 0;
+	for (int j = t.y0; j < t.y1; j++)
+		for (int i = t.x0; i < t.x1; i++)
+		{
+			auto e = film.relative_error(film.index(i, j));
+			sum += e * e;
+		}
+	return std::sqrt(sum / (t.width() * t.height()));
+}
+
+// The tiles whose estimated error is still above threshold and so need another round of samples.
+inline std::vector<tile> unconverged_tiles(const framebuffer& film, const std::vector<tile>& tiles, double threshold)
+{
+	std::vector<tile> work;
+	for (const auto& t : tiles)
+		if (tile_error(film, t) > threshold)
+			work.push_back(t);
+	return work;
+}
@@ -0,0 +1,497 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "shared.h"
+#include "aarect.h"
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "pdf.h"
+#include "perlin.h"
+#include "settings.h"
+#include "sphere.h"
+#include "wide_bvh.h"
+
+// Builds with RT_COUNT_ALLOCATIONS defined replace the global operator new with one that counts
+// the heap allocations of each thread, and --bench then checks that shading paths makes none.
+// Other builds allocate as usual and skip that check.
+#if defined(RT_COUNT_ALLOCATIONS)
+inline thread_local uint64_t thread_allocations = 0;
+
+// This header is included by the one translation unit, so it is defined once. It allocates with
+// malloc, as the library's own operator new does, so the library's operator delete still frees
+// it. GCC and Clang keep it out of line so they do not pair the inlined malloc with that delete.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void* operator new(size_t size)
+{
+	thread_allocations++;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+#endif
+
+// Microbenchmarks of the kernels a render spends its time in. Inputs are drawn from fixed seeds
+// and every kernel's results are folded into a checksum, so two builds time the same work and a
+// changed checksum shows a build that computes something different.
+
+const uint64_t bench_seed = 0x5eed5eed5eed5eedull;
+
+// Operations in one call of most benchmark bodies: enough to hide the call, few enough that
+// their inputs stay in cache.
+const size_t bench_batch = 4096;
+
+struct bench_result
+{
+	std::string name;
+	// What one operation is: a ray, a sample, a point or a scatter.
+	const char* unit;
+	double ns_per_op;
+	double min_ns_per_op;
+	double checksum;
+};
+
+// Times body, which performs ops operations a call and returns a checksum of their results. It is
+// repeated until a run lasts about bench_run_seconds, and the median of bench_runs such runs is
+// reported. The thread's sampler restarts from the same seed before every call.
+class bench_runner
+{
+public:
+	static constexpr double bench_run_seconds = 0.02;
+	static constexpr int bench_runs = 7;
+
+	template <class Body>
+	void run(const std::string& name, const char* unit, size_t ops, Body body);
+
+	// Records a measurement taken once rather than by run, such as a BVH build.
+	void add(const std::string& name, const char* unit, double ns_per_op, double min_ns_per_op, double checksum);
+
+	std::vector<bench_result> results;
+
+	// Written to, so the compiler cannot drop the work a checksum depends on.
+	volatile double sink = 0;
+};
+
+template <class Body>
+void bench_runner::run(const std::string& name, const char* unit, size_t ops, Body body)
+{
+	using clock = std::chrono::steady_clock;
+
+	thread_sampler().seed(bench_seed, bench_seed);
+	double checksum = body();
+
+	size_t calls = 1;
+	for (;;)
+	{
+		auto start = clock::now();
+		for (size_t i = 0; i < calls; i++)
+		{
+			thread_sampler().seed(bench_seed, bench_seed);
+			sink = sink + body();
+		}
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		if (elapsed.count() >= bench_run_seconds || calls >= (size_t(1) << 30))
+			break;
+		calls = elapsed.count() > 0 ? std::max(calls * 2, static_cast<size_t>(calls * bench_run_seconds / elapsed.count() * 1.2)) : calls * 16;
+	}
+
+	std::vector<double> times;
+	for (int run = 0; run < bench_runs; run++)
+	{
+		auto start = clock::now();
+		for (size_t i = 0; i < calls; i++)
+		{
+			thread_sampler().seed(bench_seed, bench_seed);
+			sink = sink + body();
+		}
+		std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+		times.push_back(elapsed.count() / (static_cast<double>(calls) * ops));
+	}
+	std::sort(times.begin(), times.end());
+
+	add(name, unit, times[times.size() / 2], times.front(), checksum);
+}
+
+inline void bench_runner::add(const std::string& name, const char* unit, double ns_per_op, double min_ns_per_op, double checksum)
+{
+	results.push_back({ name, unit, ns_per_op, min_ns_per_op, checksum });
+	std::cerr << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(12) << ns_per_op << " ns/op" << std::setw(12) << 1000 / ns_per_op << " M" << unit << "s/s\n"
+		<< std::defaultfloat;
+}
+
+// Rays from a shell of the given radius around center towards random points of a box twice the
+// size of extent around it, so some hit what is at center and some miss.
+inline std::vector<ray> bench_rays(sampler& rng, const point3& center, double radius, double extent, size_t count)
+{
+	auto uniform = [&](double min, double max) { return min + (max - min) * rng.next_double(); };
+
+	std::vector<ray> rays;
+	for (size_t i = 0; i < count; i++)
+	{
+		vec3 offset;
+		do offset = vec3(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+		while (offset.length_squared() > 1 || offset.length_squared() < 1e-6);
+		auto origin = center + radius * unit_vector(offset);
+		auto target = center + vec3(uniform(-extent, extent), uniform(-extent, extent), uniform(-extent, extent));
+		rays.push_back(ray(origin, target - origin, 0));
+	}
+	return rays;
+}
+
+// Intersects every ray with object, counting hits and summing their distances.
+inline double bench_hits(const hittable& object, const std::vector<ray>& rays)
+{
+	double checksum = 0;
+	hit_record rec;
+	for (const auto& r : rays)
+	{
+		if (object.hit(r, 0.001, infinity, rec))
+			checksum += 1 + rec.t;
+	}
+	return checksum;
+}
+
+inline void bench_primitives(bench_runner& bench)
+{
+	sampler rng;
+	rng.seed(bench_seed, 1);
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	auto rays = bench_rays(rng, point3(0, 0, 0), 4, 1, bench_batch);
+
+	sphere ball(point3(0, 0, 0), 1, mat);
+	xy_rect xy(-1, 1, -1, 1, 0, mat);
+	xz_rect xz(-1, 1, -1, 1, 0, mat);
+	yz_rect yz(-1, 1, -1, 1, 0, mat);
+	aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+
+	bench.run("sphere_hit", "ray", rays.size(), [&] { return bench_hits(ball, rays); });
+	bench.run("xy_rect_hit", "ray", rays.size(), [&] { return bench_hits(xy, rays); });
+	bench.run("xz_rect_hit", "ray", rays.size(), [&] { return bench_hits(xz, rays); });
+	bench.run("yz_rect_hit", "ray", rays.size(), [&] { return bench_hits(yz, rays); });
+	bench.run("aabb_hit", "ray", rays.size(), [&] {
+		double checksum = 0;
+		for (const auto& r : rays)
+			checksum += box.hit(r, 0.001, infinity);
+		return checksum;
+		});
+}
+
+inline std::string bench_count_name(size_t count)
+{
+	if (count % 1000000 == 0) return std::to_string(count / 1000000) + "M";
+	if (count % 1000 == 0) return std::to_string(count / 1000) + "K";
+	return std::to_string(count);
+}
+
+// Builds BVHs over clouds of 1K, 10K, ... up to settings.bench_spheres random spheres filling the unit cube,
+// and traces coherent rays from a camera outside the cloud and incoherent rays from inside it.
+inline void bench_traversal(bench_runner& bench, const render_settings& settings)
+{
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	const size_t ray_count = 1 << 16;
+
+	for (size_t count = 1000; count <= settings.bench_spheres; count *= 10)
+	{
+		sampler rng;
+		rng.seed(bench_seed, count);
+		auto uniform = [&](double min, double max) { return min + (max - min) * rng.next_double(); };
+
+		// Spheres fill about a tenth of the cube at any count.
+		auto radius = 0.3 / cbrt(static_cast<double>(count));
+		hittable_list cloud;
+		for (size_t i = 0; i < count; i++)
+			cloud.add(make_shared<sphere>(point3(uniform(0, 1), uniform(0, 1), uniform(0, 1)), radius, mat));
+
+		auto suffix = "/" + bench_count_name(count);
+		auto build_start = std::chrono::steady_clock::now();
+		linear_bvh bvh(cloud, 0, 1);
+		std::chrono::duration<double, std::nano> build_time = std::chrono::steady_clock::now() - build_start;
+		cloud.clear();
+		auto build_ns = build_time.count() / count;
+		bench.add("bvh_build" + suffix, "sphere", build_ns, build_ns, static_cast<double>(bvh.nodes.size()));
+
+		shared_ptr<hittable> world;
+		if (settings.bvh == "wide4") world = make_shared<wide_bvh<4>>(bvh);
+		else if (settings.bvh == "wide8") world = make_shared<wide_bvh<8>>(bvh);
+		const hittable& tree = world ? *world : bvh;
+
+		std::vector<ray> coherent, incoherent;
+		camera cam(point3(0.5, 0.5, -1.5), point3(0.5, 0.5, 0.5), vec3(0, 1, 0), 40, 1, 0, 1);
+		const int side = 256;
+		for (int j = 0; j < side; j++)
+			for (int i = 0; i < side; i++)
+				coherent.push_back(cam.get_ray((i + 0.5) / side, (j + 0.5) / side));
+		for (size_t i = 0; i < ray_count; i++)
+		{
+			vec3 d;
+			do d = vec3(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+			while (d.length_squared() > 1 || d.length_squared() < 1e-6);
+			incoherent.push_back(ray(point3(uniform(0, 1), uniform(0, 1), uniform(0, 1)), d, 0));
+		}
+
+		auto name = "bvh_" + settings.bvh;
+		bench.run(name + "_coherent" + suffix, "ray", coherent.size(), [&] { return bench_hits(tree, coherent); });
+		bench.run(name + "_incoherent" + suffix, "ray", incoherent.size(), [&] { return bench_hits(tree, incoherent); });
+	}
+}
+
+inline void bench_sampling(bench_runner& bench)
+{
+	bench.run("random_cosine_direction", "sample", bench_batch, [] {
+		double checksum = 0;
+		for (size_t i = 0; i < bench_batch; i++)
+			checksum += random_cosine_direction().z();
+		return checksum;
+		});
+	bench.run("random_to_sphere", "sample", bench_batch, [] {
+		double checksum = 0;
+		for (size_t i = 0; i < bench_batch; i++)
+			checksum += random_to_sphere(1, 4).z();
+		return checksum;
+		});
+}
+
+inline void bench_noise(bench_runner& bench)
+{
+	thread_sampler().seed(bench_seed, bench_seed);
+	perlin noise;
+
+	sampler rng;
+	rng.seed(bench_seed, 2);
+	std::vector<point3> points;
+	for (size_t i = 0; i < bench_batch; i++)
+		points.push_back(point3(rng.next_double() * 16, rng.next_double() * 16, rng.next_double() * 16));
+	std::vector<double> turbs(points.size());
+
+	bench.run("perlin_reference_turb", "point", points.size(), [&] {
+		double checksum = 0;
+		for (const auto& p : points)
+			checksum += noise.reference_turb(p);
+		return checksum;
+		});
+	bench.run("perlin_turb", "point", points.size(), [&] {
+		double checksum = 0;
+		for (const auto& p : points)
+			checksum += noise.turb(p);
+		return checksum;
+		});
+	bench.run("perlin_turb_batch", "point", points.size(), [&] {
+		noise.turb(points.data(), points.size(), turbs.data());
+		double checksum = 0;
+		for (auto t : turbs)
+			checksum += t;
+		return checksum;
+		});
+}
+
+// Largest difference allowed between the float noise kernel and the double precision reference.
+const double noise_tolerance = 1e-6;
+
+// Checks turb, one point at a time and in a batch, against reference_turb at points on both sides
+// of the origin and far from it, in a count that leaves the batch a short last group. Returns false
+// when any point is further than noise_tolerance from the reference.
+inline bool check_noise_accuracy()
+{
+	thread_sampler().seed(bench_seed, bench_seed);
+	perlin noise;
+
+	sampler rng;
+	rng.seed(bench_seed, 4);
+	std::vector<point3> points;
+	for (double range : { 1.0, 16.0, 256.0, 4096.0 })
+		for (size_t i = 0; i < bench_batch / 4; i++)
+			points.push_back(range * point3(2 * rng.next_double() - 1, 2 * rng.next_double() - 1, 2 * rng.next_double() - 1));
+	points.push_back(point3(0, 0, 0));
+
+	std::vector<double> turbs(points.size());
+	noise.turb(points.data(), points.size(), turbs.data());
+
+	double single_error = 0, batch_error = 0;
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		auto reference = noise.reference_turb(points[i]);
+		single_error = std::max(single_error, fabs(noise.turb(points[i]) - reference));
+		batch_error = std::max(batch_error, fabs(turbs[i] - reference));
+	}
+
+	std::cerr << std::left << std::setw(36) << "perlin_turb_error" << std::right << std::setw(12) << single_error
+		<< " single, " << batch_error << " batch (tolerance " << noise_tolerance << ")\n";
+	if (single_error > noise_tolerance || batch_error > noise_tolerance)
+	{
+		std::cerr << "Perlin turbulence differs from the reference by more than " << noise_tolerance << ".\n";
+		return false;
+	}
+	return true;
+}
+
+// Scatters rays arriving from random directions at a unit sphere's surface, for every material
+// that scatters; lights and isotropic media keep the base class's scatter, which only returns false.
+inline void bench_materials(bench_runner& bench)
+{
+	sampler rng;
+	rng.seed(bench_seed, 3);
+	auto rays = bench_rays(rng, point3(0, 0, 0), 4, 0.5, bench_batch);
+
+	sphere ball(point3(0, 0, 0), 1, nullptr);
+	std::vector<std::pair<ray, hit_record>> hits;
+	for (const auto& r : rays)
+	{
+		hit_record rec;
+		if (ball.hit(r, 0.001, infinity, rec))
+			hits.push_back({ r, rec });
+	}
+
+	auto noise = make_shared<noise_texture>(4);
+	std::pair<const char*, shared_ptr<material>> materials[] = {
+		{ "lambertian_scatter", make_shared<lambertian>(color(0.5, 0.5, 0.5)) },
+		{ "lambertian_noise_scatter", make_shared<lambertian>(noise) },
+		{ "metal_scatter", make_shared<metal>(color(0.8, 0.8, 0.8), 0.3) },
+		{ "dielectric_scatter", make_shared<dielectric>(1.5) },
+	};
+
+	for (const auto& [name, mat] : materials)
+	{
+		for (auto& hit : hits)
+			hit.second.mat_ptr = mat.get();
+
+		bench.run(name, "scatter", hits.size(), [&] {
+			double checksum = 0;
+			scatter_record srec;
+			for (const auto& [r, rec] : hits)
+			{
+				if (!rec.mat_ptr->scatter(r, rec, srec))
+					continue;
+				checksum += srec.attenuation.x();
+				if (srec.is_specular)
+					checksum += srec.specular_ray.direction().z();
+			}
+			return checksum;
+			});
+	}
+}
+
+#if defined(RT_COUNT_ALLOCATIONS)
+// Traces paths through a small box lit from above, with diffuse, metal, glass and textured
+// surfaces, and checks that shading them allocates nothing: pdfs, scatter records and hit records
+// all live on the stack. Returns false when a path allocated.
+inline bool check_path_allocations()
+{
+	auto white = make_shared<lambertian>(color(.73, .73, .73));
+	auto marble = make_shared<lambertian>(make_shared<noise_texture>(4));
+	auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+	hittable_list objects;
+	objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, white));
+	objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, marble));
+	objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+	objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+	objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+	objects.add(make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light)));
+	objects.add(make_shared<sphere>(point3(190, 90, 190), 90, make_shared<dielectric>(1.5)));
+	objects.add(make_shared<sphere>(point3(370, 90, 370), 90, make_shared<metal>(color(0.8, 0.85, 0.88), 0.2)));
+
+	linear_bvh world(objects, 0, 1);
+	light_set lights(world.scene->emitters, 0, 1);
+	camera cam(point3(278, 278, -800), point3(278, 278, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1);
+
+	const int paths = 512;
+	auto trace = [&](int first) {
+		double checksum = 0;
+		for (int k = first; k < first + paths; k++)
+		{
+			thread_sampler().start_sample(static_cast<uint32_t>(k), 0, 0);
+			auto r = cam.get_ray(random_double(), random_double());
+			checksum += luminance(ray_color(r, color(0, 0, 0), world, lights, 50, 5, 0.001));
+		}
+		return checksum;
+	};
+
+	// The first paths set up thread locals such as the sampler, which may allocate once.
+	trace(0);
+	auto before = thread_allocations;
+	auto checksum = trace(paths);
+	auto allocations = thread_allocations - before;
+
+	std::cerr << std::left << std::setw(36) << "path_allocations" << std::right << std::setw(12) << allocations
+		<< " in " << paths << " paths (checksum " << checksum << ")\n";
+	if (allocations > 0)
+	{
+		std::cerr << "Shading " << paths << " paths made " << allocations << " heap allocations; the bounce loop must not allocate.\n";
+		return false;
+	}
+	return true;
+}
+#endif
+
+inline bool write_bench_results(const std::string& path, const render_settings& settings, const std::vector<bench_result>& results)
+{
+	std::ofstream file;
+	if (path != "-")
+	{
+		file.open(path);
+		if (!file)
+		{
+			std::cerr << "Could not write '" << path << "'.\n";
+			return false;
+		}
+	}
+	std::ostream& out = path == "-" ? std::cout : file;
+
+	// One benchmark to a line, so results of two builds diff line by line.
+	out << std::setprecision(9) << "{\n  \"build\": { \"real\": \"" << (sizeof(real) == 4 ? "float" : "double") << "\", \"sse\": "
+#if RT_SSE
+		<< "true"
+#else
+		<< "false"
+#endif
+		<< ", \"avx\": "
+#if RT_AVX
+		<< "true"
+#else
+		<< "false"
+#endif
+		<< ", \"bvh\": \"" << settings.bvh << "\", \"seed\": \"" << std::hex << bench_seed << std::dec << "\" },\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const auto& r = results[i];
+		out << "    { \"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"ns_per_op\": " << r.ns_per_op
+			<< ", \"min_ns_per_op\": " << r.min_ns_per_op << ", \"mops_per_s\": " << 1000 / r.ns_per_op
+			<< ", \"checksum\": " << r.checksum << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+	}
+	out << "  ]\n}\n";
+	return static_cast<bool>(out);
+}
+
+// Runs every benchmark on one thread and writes the results as JSON to settings.bench, or to
+// standard output when that is "-". First it checks the vectorized noise against its reference
+// and, in builds counting allocations, that shading paths makes none.
+inline bool run_benchmarks(const render_settings& settings)
+{
+	if (!check_noise_accuracy())
+		return false;
+#if defined(RT_COUNT_ALLOCATIONS)
+	if (!check_path_allocations())
+		return false;
+#endif
+
+	bench_runner bench;
+	bench_primitives(bench);
+	bench_traversal(bench, settings);
+	bench_sampling(bench);
+	bench_noise(bench);
+	bench_materials(bench);
+	return write_bench_results(settings.bench, settings, bench.results);
+}
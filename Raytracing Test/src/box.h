@@ -10,6 +10,7 @@ public:
 	box(const point3& p0, const point3& p1, shared_ptr<material> ptr);
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
 	{
@@ -19,6 +20,7 @@ public:
 
 	point3 box_min;
 	point3 box_max;
+	shared_ptr<material> mp;
 	hittable_list sides;
 };
 
@@ -26,6 +28,7 @@ box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr)
 {
 	box_min = p0;
 	box_max = p1;
+	mp = ptr;
 
 	sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
 	sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
@@ -38,4 +41,26 @@ box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr)
 bool box::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 {
 	return sides.hit(r, t_min, t_max, rec);
+}
+
+void box::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	// Slab test every lane against the box first; only lanes that enter it test the six sides.
+	bool inside[max_packet_size];
+	for (int lane = 0; lane < max_packet_size; lane++)
+	{
+		auto t0 = t_min;
+		auto t1 = rays.t_max[lane];
+		for (int a = 0; a < 3; a++)
+		{
+			auto near_t = (box_min.e[a] - rays.org[a][lane]) * rays.inv_dir[a][lane];
+			auto far_t = (box_max.e[a] - rays.org[a][lane]) * rays.inv_dir[a][lane];
+			if (near_t > far_t) std::swap(near_t, far_t);
+			t0 = near_t > t0 ? near_t : t0;
+			t1 = far_t < t1 ? far_t : t1;
+		}
+		inside[lane] = t0 <= t1;
+	}
+
+	sides.hit_packet(rays, active & lanes_from_flags(inside, max_packet_size), t_min, hits);
 }
\ No newline at end of file
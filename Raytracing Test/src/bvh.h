@@ -1,104 +1,261 @@
 #pragma once
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
 
 #include "shared.h"
+#include "bvh_builder.h"
+#include "compiled_scene.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "stats.h"
 
-class bvh_node : public hittable
+class linear_bvh : public hittable
 {
 public:
-	bvh_node();
+	linear_bvh() {}
 
-	bvh_node(const hittable_list& list, double time0, double time1)
-		: bvh_node(list.objects, 0, list.objects.size(), time0, time1) {}
+	linear_bvh(const hittable_list& list, double time0, double time1, const bvh_build_options& options = {})
+		: linear_bvh(list.objects, time0, time1, options) {}
 
-	bvh_node( const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, double time0, double time1);
+	linear_bvh(const std::vector<shared_ptr<hittable>>& src_objects, double time0, double time1,
+		const bvh_build_options& options = {});
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
-	shared_ptr<hittable> left;
-	shared_ptr<hittable> right;
+	flat_array<bvh_linear_node> nodes;
+	flat_array<uint32_t> prim_indices;
+	shared_ptr<compiled_scene> scene;
 	aabb box;
+	bvh_build_stats stats;
+
+	// Packets whose active lane count drops below this finish the subtree one ray at a time.
+	int packet_min_active = 4;
+
+private:
+	bool traverse(uint32_t root, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	static bool node_hit(const bvh_linear_node& node, const point3& origin, const vec3& inv_dir, double t_min, double t_max);
 };
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis)
+linear_bvh::linear_bvh(const std::vector<shared_ptr<hittable>>& src_objects, double time0, double time1,
+	const bvh_build_options& options)
+	: scene(make_shared<compiled_scene>(src_objects, time0, time1))
 {
-	aabb box_a;
-	aabb box_b;
-
-	if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
-		std::cerr << "No bounding box in bvh_node constructor.\n";
+	if (scene->prims.empty()) return;
 
-	return box_a.min().e[axis] < box_b.min().e[axis];
-}
+	std::vector<bvh_linear_node> built_nodes;
+	std::vector<uint32_t> built_indices;
+	bvh_builder(options).build(scene->prim_boxes, built_nodes, built_indices, &stats);
+	nodes.assign(std::move(built_nodes));
+	prim_indices.assign(std::move(built_indices));
 
-bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
-{
-	return box_compare(a, b, 0);
+	const auto& root = nodes[0];
+	box = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+		point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
 }
 
-bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+inline bool linear_bvh::node_hit(const bvh_linear_node& node, const point3& origin, const vec3& inv_dir, double t_min, double t_max)
 {
-	return box_compare(a, b, 1);
+	for (int a = 0; a < 3; a++)
+	{
+		auto t0 = (node.bounds_min[a] - origin[a]) * inv_dir[a];
+		auto t1 = (node.bounds_max[a] - origin[a]) * inv_dir[a];
+		if (inv_dir[a] < 0.0) std::swap(t0, t1);
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if (t_max < t_min) return false;
+	}
+	return true;
 }
 
-bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+bool linear_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 {
-	return box_compare(a, b, 2);
+	if (nodes.empty()) return false;
+	return traverse(0, r, t_min, t_max, rec);
 }
 
-bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, double time0, double time1)
+bool linear_bvh::traverse(uint32_t root, const ray& r, double t_min, double t_max, hit_record& rec) const
 {
-	auto objects = src_objects;
-	int axis = random_int(0, 2);
-	auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
+	const auto origin = r.origin();
+	const vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+	const bool dir_is_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
 
-	size_t object_span = end - start;
-	if (object_span == 1)
-		left = right = objects[start];
+	uint32_t stack[64];
+	int stack_size = 0;
+	uint32_t current = root;
+	bool hit_anything = false;
 
-	else if (object_span == 2) {
-		if (comparator(objects[start], objects[start + 1]))
+	while (true)
+	{
+		count_node_visit();
+		const auto& node = nodes[current];
+		if (node_hit(node, origin, inv_dir, t_min, t_max))
 		{
-			left = objects[start];
-			right = objects[start + 1];
+			if (node.prim_count > 0)
+			{
+				for (uint32_t i = 0; i < node.prim_count; i++)
+				{
+					if (scene->hit(prim_indices[node.offset + i], r, t_min, t_max, rec))
+					{
+						hit_anything = true;
+						t_max = rec.t;
+					}
+				}
+				if (stack_size == 0) break;
+				current = stack[--stack_size];
+			}
+			else if (dir_is_neg[node.axis])
+			{
+				stack[stack_size++] = current + 1;
+				current = node.offset;
+			}
+			else
+			{
+				stack[stack_size++] = node.offset;
+				current = current + 1;
+			}
 		}
 		else
 		{
-			left = objects[start + 1];
-			right = objects[start];
+			if (stack_size == 0) break;
+			current = stack[--stack_size];
 		}
 	}
-	else
+	return hit_anything;
+}
+
+void linear_bvh::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	if (nodes.empty() || !active) return;
+
+	// Interval bounds of the packet's origins and inverse directions, used to cull whole nodes
+	// at once. They are only valid if every lane shares the same direction signs.
+	double org_lo[3], org_hi[3], inv_lo[3], inv_hi[3];
+	bool dir_is_neg[3];
+	bool coherent = true;
+	auto first = lowest_lane(active);
+	for (int a = 0; a < 3; a++)
 	{
-		std::sort(objects.begin() + start, objects.begin() + end, comparator);
+		org_lo[a] = org_hi[a] = rays.org[a][first];
+		inv_lo[a] = inv_hi[a] = rays.inv_dir[a][first];
+		dir_is_neg[a] = rays.inv_dir[a][first] < 0;
 
-		auto mid = start + object_span / 2;
-		left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-		right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+		for (auto lanes = active; lanes; lanes &= lanes - 1)
+		{
+			auto lane = lowest_lane(lanes);
+			org_lo[a] = fmin(org_lo[a], rays.org[a][lane]);
+			org_hi[a] = fmax(org_hi[a], rays.org[a][lane]);
+			inv_lo[a] = fmin(inv_lo[a], rays.inv_dir[a][lane]);
+			inv_hi[a] = fmax(inv_hi[a], rays.inv_dir[a][lane]);
+			coherent = coherent && (rays.inv_dir[a][lane] < 0) == dir_is_neg[a];
+		}
 	}
 
-	aabb box_left, box_right;
+	if (!coherent)
+	{
+		hittable::hit_packet(rays, active, t_min, hits);
+		return;
+	}
 
-	if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
-		std::cerr << "No bounding box in bvh_node constructor.\n";
+	struct stack_entry
+	{
+		uint32_t node;
+		uint32_t mask;
+	};
 
-	box = surrounding_box(box_left, box_right);
-}
+	stack_entry stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, active };
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
-{
-	if (!box.hit(r, t_min, t_max)) return false;
+	while (stack_size > 0)
+	{
+		auto entry = stack[--stack_size];
+		const auto& node = nodes[entry.node];
+		count_node_visit();
+
+		// Interval arithmetic: the earliest any lane can enter and the latest any lane can leave.
+		auto t_enter = t_min;
+		auto t_exit = rays.t_max[0];
+		for (int lane = 1; lane < max_packet_size; lane++)
+			t_exit = rays.t_max[lane] > t_exit ? rays.t_max[lane] : t_exit;
 
-	bool hit_left = left->hit(r, t_min, t_max, rec);
-	bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
-	return hit_left || hit_right;
+		double near_plane[3], far_plane[3];
+		for (int a = 0; a < 3; a++)
+		{
+			near_plane[a] = dir_is_neg[a] ? node.bounds_max[a] : node.bounds_min[a];
+			far_plane[a] = dir_is_neg[a] ? node.bounds_min[a] : node.bounds_max[a];
+		}
+
+		for (int a = 0; a < 3 && t_enter <= t_exit; a++)
+		{
+			auto n0 = near_plane[a] - org_lo[a], n1 = near_plane[a] - org_hi[a];
+			auto f0 = far_plane[a] - org_lo[a], f1 = far_plane[a] - org_hi[a];
+			auto near_lo = fmin(fmin(n0 * inv_lo[a], n0 * inv_hi[a]), fmin(n1 * inv_lo[a], n1 * inv_hi[a]));
+			auto far_hi = fmax(fmax(f0 * inv_lo[a], f0 * inv_hi[a]), fmax(f1 * inv_lo[a], f1 * inv_hi[a]));
+			t_enter = near_lo > t_enter ? near_lo : t_enter;
+			t_exit = far_hi < t_exit ? far_hi : t_exit;
+		}
+		if (t_enter > t_exit) continue;
+
+		// Every lane is tested, active or not, so the loop has a fixed trip count and vectorizes.
+		bool lane_hit[max_packet_size];
+		for (int lane = 0; lane < max_packet_size; lane++)
+		{
+			auto tx0 = (near_plane[0] - rays.org[0][lane]) * rays.inv_dir[0][lane];
+			auto ty0 = (near_plane[1] - rays.org[1][lane]) * rays.inv_dir[1][lane];
+			auto tz0 = (near_plane[2] - rays.org[2][lane]) * rays.inv_dir[2][lane];
+			auto tx1 = (far_plane[0] - rays.org[0][lane]) * rays.inv_dir[0][lane];
+			auto ty1 = (far_plane[1] - rays.org[1][lane]) * rays.inv_dir[1][lane];
+			auto tz1 = (far_plane[2] - rays.org[2][lane]) * rays.inv_dir[2][lane];
+			auto lo = tx0 > t_min ? tx0 : t_min;
+			lo = ty0 > lo ? ty0 : lo;
+			lo = tz0 > lo ? tz0 : lo;
+			auto hi = tx1 < rays.t_max[lane] ? tx1 : rays.t_max[lane];
+			hi = ty1 < hi ? ty1 : hi;
+			hi = tz1 < hi ? tz1 : hi;
+			lane_hit[lane] = lo <= hi;
+		}
+
+		auto mask = entry.mask & lanes_from_flags(lane_hit, max_packet_size);
+		if (!mask) continue;
+
+		if (lane_count(mask) < packet_min_active)
+		{
+			for (; mask; mask &= mask - 1)
+			{
+				auto lane = lowest_lane(mask);
+				if (traverse(entry.node, rays.get(lane), t_min, rays.t_max[lane], hits.rec[lane]))
+				{
+					rays.t_max[lane] = hits.rec[lane].t;
+					hits.mask |= 1u << lane;
+				}
+			}
+			continue;
+		}
+
+		if (node.prim_count > 0)
+		{
+			for (uint32_t i = 0; i < node.prim_count; i++)
+				scene->hit_packet(prim_indices[node.offset + i], rays, mask, t_min, hits);
+		}
+		else if (dir_is_neg[node.axis])
+		{
+			stack[stack_size++] = { entry.node + 1, mask };
+			stack[stack_size++] = { node.offset, mask };
+		}
+		else
+		{
+			stack[stack_size++] = { node.offset, mask };
+			stack[stack_size++] = { entry.node + 1, mask };
+		}
+	}
 }
 
-bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const
+bool linear_bvh::bounding_box(double time0, double time1, aabb& output_box) const
 {
 	output_box = box;
 	return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,512 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "shared.h"
+#include "aabb.h"
+
+// One node of the flattened tree. Nodes are laid out depth first, so the first child of
+// an interior node is always the next node in the array and only the second child needs
+// an index. Bounds are stored as floats rounded outwards to keep the node at 32 bytes.
+struct bvh_linear_node
+{
+	float bounds_min[3];
+	float bounds_max[3];
+	uint32_t offset;
+	uint16_t prim_count;
+	uint8_t axis;
+	uint8_t pad;
+};
+
+static_assert(sizeof(bvh_linear_node) == 32, "bvh_linear_node should stay 32 bytes");
+
+inline float round_down(double x)
+{
+	auto f = static_cast<float>(x);
+	return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up(double x)
+{
+	auto f = static_cast<float>(x);
+	return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+struct bvh_build_options
+{
+	int max_prims_in_leaf = 4;
+	int bin_count = 16;
+	double traversal_cost = 1.0;
+	double intersection_cost = 1.0;
+
+	// Spatial splits clip references against the split plane and may duplicate them into
+	// both children. They are only tried where the best object split leaves children that
+	// overlap by more than spatial_split_alpha of the root area.
+	bool spatial_splits = false;
+	double spatial_split_alpha = 1e-5;
+	double max_duplication = 1.0;
+
+	// Subtrees above this many references are built as separate tasks.
+	size_t parallel_threshold = 4096;
+};
+
+struct bvh_build_stats
+{
+	double build_ms = 0;
+	double sah_cost = 0;
+	size_t node_count = 0;
+	size_t leaf_count = 0;
+	size_t reference_count = 0;
+	int max_depth = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_build_stats& s)
+{
+	return out << s.node_count << " nodes, " << s.leaf_count << " leaves, "
+		<< s.reference_count << " refs, depth " << s.max_depth
+		<< ", SAH cost " << s.sah_cost << ", built in " << s.build_ms << " ms";
+}
+
+inline double surface_area(const aabb& b)
+{
+	auto d = b.max() - b.min();
+	return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+inline aabb empty_box()
+{
+	return aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+}
+
+inline bool box_is_empty(const aabb& b)
+{
+	return b.min().x() > b.max().x() || b.min().y() > b.max().y() || b.min().z() > b.max().z();
+}
+
+inline void grow_box(aabb& b, const aabb& other)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		if (other.minimum.e[a] < b.minimum.e[a]) b.minimum.e[a] = other.minimum.e[a];
+		if (other.maximum.e[a] > b.maximum.e[a]) b.maximum.e[a] = other.maximum.e[a];
+	}
+}
+
+inline void grow_box(aabb& b, const point3& p)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		if (p.e[a] < b.minimum.e[a]) b.minimum.e[a] = p.e[a];
+		if (p.e[a] > b.maximum.e[a]) b.maximum.e[a] = p.e[a];
+	}
+}
+
+inline aabb intersect_box(const aabb& a, const aabb& b)
+{
+	return aabb(point3(fmax(a.min().x(), b.min().x()), fmax(a.min().y(), b.min().y()), fmax(a.min().z(), b.min().z())),
+		point3(fmin(a.max().x(), b.max().x()), fmin(a.max().y(), b.max().y()), fmin(a.max().z(), b.max().z())));
+}
+
+// Binned SAH builder. Produces the depth-first node array and the leaf reference array
+// consumed by linear_bvh from nothing more than one bounding box per primitive.
+class bvh_builder
+{
+public:
+	bvh_builder(const bvh_build_options& _options) : options(_options) {}
+
+	void build(const std::vector<aabb>& prim_boxes, std::vector<bvh_linear_node>& nodes,
+		std::vector<uint32_t>& prim_indices, bvh_build_stats* stats = nullptr);
+
+private:
+	struct build_ref
+	{
+		aabb box;
+		uint32_t prim;
+
+		double centroid(int axis) const { return 0.5 * (box.min()[axis] + box.max()[axis]); }
+	};
+
+	struct build_node
+	{
+		aabb bounds;
+		int axis = 0;
+		std::unique_ptr<build_node> children[2];
+		std::vector<uint32_t> prims;
+	};
+
+	struct split
+	{
+		double cost = infinity;
+		int axis = -1;
+		int bin = 0;
+		double position = 0;
+		bool spatial = false;
+		aabb left_box, right_box;
+	};
+
+	std::unique_ptr<build_node> build_recursive(std::vector<build_ref> refs, int depth);
+	split find_object_split(const std::vector<build_ref>& refs, const aabb& centroid_bounds) const;
+	split find_spatial_split(const std::vector<build_ref>& refs, const aabb& bounds) const;
+	static void split_reference(const build_ref& ref, int axis, double position, build_ref& left, build_ref& right);
+
+	uint32_t flatten(const build_node* node, std::vector<bvh_linear_node>& nodes, std::vector<uint32_t>& prim_indices,
+		double root_area, bvh_build_stats& stats, int depth) const;
+
+	static constexpr int max_bins = 32;
+
+	bvh_build_options options;
+	double root_area = 0;
+	size_t spawn_depth = 0;
+	std::atomic<long long> duplication_budget = 0;
+};
+
+inline void bvh_builder::build(const std::vector<aabb>& prim_boxes, std::vector<bvh_linear_node>& nodes,
+	std::vector<uint32_t>& prim_indices, bvh_build_stats* stats)
+{
+	auto start_time = std::chrono::steady_clock::now();
+
+	nodes.clear();
+	prim_indices.clear();
+	if (prim_boxes.empty()) return;
+
+	std::vector<build_ref> refs;
+	refs.reserve(prim_boxes.size());
+	aabb bounds = empty_box();
+	for (size_t i = 0; i < prim_boxes.size(); i++)
+	{
+		refs.push_back({ prim_boxes[i], static_cast<uint32_t>(i) });
+		grow_box(bounds, prim_boxes[i]);
+	}
+
+	root_area = surface_area(bounds);
+	duplication_budget = options.spatial_splits
+		? static_cast<long long>(options.max_duplication * prim_boxes.size()) : 0;
+
+	auto threads = std::max(1u, std::thread::hardware_concurrency());
+	spawn_depth = 0;
+	while ((1u << spawn_depth) < 2 * threads) spawn_depth++;
+
+	auto root = build_recursive(std::move(refs), 0);
+
+	bvh_build_stats local_stats;
+	nodes.reserve(2 * prim_boxes.size());
+	prim_indices.reserve(prim_boxes.size());
+	flatten(root.get(), nodes, prim_indices, root_area, local_stats, 0);
+
+	local_stats.node_count = nodes.size();
+	local_stats.reference_count = prim_indices.size();
+	local_stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+	if (stats) *stats = local_stats;
+}
+
+inline std::unique_ptr<bvh_builder::build_node> bvh_builder::build_recursive(std::vector<build_ref> refs, int depth)
+{
+	auto node = std::make_unique<build_node>();
+
+	aabb bounds = empty_box();
+	aabb centroid_bounds = empty_box();
+	for (const auto& ref : refs)
+	{
+		grow_box(bounds, ref.box);
+		grow_box(centroid_bounds, point3(ref.centroid(0), ref.centroid(1), ref.centroid(2)));
+	}
+	node->bounds = bounds;
+
+	// A linear node counts at most 0xffff primitives. Larger sets, whose centroids coincide or
+	// that ran out of depth, are split evenly instead so leaves stay addressable.
+	auto make_leaf = [&]() {
+		if (refs.size() > 0xffff)
+		{
+			std::vector<build_ref> right(refs.begin() + refs.size() / 2, refs.end());
+			refs.resize(refs.size() / 2);
+			node->children[0] = build_recursive(std::move(refs), depth + 1);
+			node->children[1] = build_recursive(std::move(right), depth + 1);
+			return std::move(node);
+		}
+		for (const auto& ref : refs)
+			node->prims.push_back(ref.prim);
+		return std::move(node);
+	};
+
+	auto count = refs.size();
+	if (count == 1 || depth >= 60)
+		return make_leaf();
+
+	auto best = find_object_split(refs, centroid_bounds);
+
+	if (options.spatial_splits && duplication_budget > 0)
+	{
+		auto overlap = intersect_box(best.left_box, best.right_box);
+		if (best.axis < 0 || (!box_is_empty(overlap) && surface_area(overlap) > options.spatial_split_alpha * root_area))
+		{
+			auto spatial = find_spatial_split(refs, bounds);
+			if (spatial.cost < best.cost)
+				best = spatial;
+		}
+	}
+
+	auto leaf_cost = options.intersection_cost * count;
+	auto split_cost = options.traversal_cost + best.cost / surface_area(bounds);
+
+	if (best.axis < 0 || (count <= static_cast<size_t>(options.max_prims_in_leaf) && leaf_cost <= split_cost))
+		return make_leaf();
+
+	std::vector<build_ref> left, right;
+	left.reserve(count);
+	right.reserve(count);
+
+	if (best.spatial)
+	{
+		long long duplicated = 0;
+		for (const auto& ref : refs)
+		{
+			if (ref.box.max()[best.axis] <= best.position)
+				left.push_back(ref);
+			else if (ref.box.min()[best.axis] >= best.position)
+				right.push_back(ref);
+			else
+			{
+				build_ref l, r;
+				split_reference(ref, best.axis, best.position, l, r);
+				left.push_back(l);
+				right.push_back(r);
+				duplicated++;
+			}
+		}
+		duplication_budget -= duplicated;
+	}
+	else
+	{
+		const int bin_count = std::clamp(options.bin_count, 2, max_bins);
+		auto cmin = centroid_bounds.min()[best.axis];
+		auto scale = bin_count / (centroid_bounds.max()[best.axis] - cmin);
+		for (const auto& ref : refs)
+		{
+			auto b = std::min(static_cast<int>((ref.centroid(best.axis) - cmin) * scale), bin_count - 1);
+			(b <= best.bin ? left : right).push_back(ref);
+		}
+	}
+
+	if (left.empty() || right.empty())
+	{
+		refs = left.empty() ? std::move(right) : std::move(left);
+		return make_leaf();
+	}
+
+	refs.clear();
+	refs.shrink_to_fit();
+	node->axis = best.axis;
+
+	if (depth < static_cast<int>(spawn_depth) && count > options.parallel_threshold)
+	{
+		auto left_task = std::async(std::launch::async, [this, &left, depth]() {
+			return build_recursive(std::move(left), depth + 1);
+			});
+		node->children[1] = build_recursive(std::move(right), depth + 1);
+		node->children[0] = left_task.get();
+	}
+	else
+	{
+		node->children[0] = build_recursive(std::move(left), depth + 1);
+		node->children[1] = build_recursive(std::move(right), depth + 1);
+	}
+	return node;
+}
+
+inline bvh_builder::split bvh_builder::find_object_split(const std::vector<build_ref>& refs, const aabb& centroid_bounds) const
+{
+	split best;
+	const int bin_count = std::clamp(options.bin_count, 2, max_bins);
+	std::array<std::array<aabb, max_bins>, 3> bin_bounds;
+	std::array<std::array<size_t, max_bins>, 3> bin_counts;
+	std::array<double, max_bins> right_area;
+	std::array<aabb, max_bins> right_boxes;
+
+	double cmin[3], scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		auto extent = centroid_bounds.max()[axis] - centroid_bounds.min()[axis];
+		cmin[axis] = centroid_bounds.min()[axis];
+		scale[axis] = extent > 0 ? bin_count / extent : 0;
+		bin_bounds[axis].fill(empty_box());
+		bin_counts[axis].fill(0);
+	}
+
+	// Bin every axis in one pass over the references.
+	for (const auto& ref : refs)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			auto b = std::min(static_cast<int>((ref.centroid(axis) - cmin[axis]) * scale[axis]), bin_count - 1);
+			bin_counts[axis][b]++;
+			grow_box(bin_bounds[axis][b], ref.box);
+		}
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (scale[axis] <= 0) continue;
+
+		// Sweep from the right to get the area of every right-hand partition, then from the left to evaluate the splits.
+		aabb accum = empty_box();
+		for (int b = bin_count - 1; b > 0; b--)
+		{
+			grow_box(accum, bin_bounds[axis][b]);
+			right_boxes[b] = accum;
+			right_area[b] = surface_area(accum);
+		}
+
+		accum = empty_box();
+		size_t left_count = 0;
+		for (int b = 0; b < bin_count - 1; b++)
+		{
+			grow_box(accum, bin_bounds[axis][b]);
+			left_count += bin_counts[axis][b];
+			auto right_count = refs.size() - left_count;
+			if (left_count == 0 || right_count == 0) continue;
+
+			auto cost = options.intersection_cost * (surface_area(accum) * left_count + right_area[b + 1] * right_count);
+			if (cost < best.cost)
+			{
+				best.cost = cost;
+				best.axis = axis;
+				best.bin = b;
+				best.left_box = accum;
+				best.right_box = right_boxes[b + 1];
+			}
+		}
+	}
+	return best;
+}
+
+inline void bvh_builder::split_reference(const build_ref& ref, int axis, double position, build_ref& left, build_ref& right)
+{
+	auto left_max = ref.box.max();
+	auto right_min = ref.box.min();
+	left_max[axis] = position;
+	right_min[axis] = position;
+
+	left = { aabb(ref.box.min(), left_max), ref.prim };
+	right = { aabb(right_min, ref.box.max()), ref.prim };
+}
+
+inline bvh_builder::split bvh_builder::find_spatial_split(const std::vector<build_ref>& refs, const aabb& bounds) const
+{
+	split best;
+	const int bin_count = std::clamp(options.bin_count, 2, max_bins);
+	std::array<aabb, max_bins> bin_bounds;
+	std::array<size_t, max_bins> entries, exits, right_counts;
+	std::array<double, max_bins> right_area;
+	std::array<aabb, max_bins> right_boxes;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		auto origin = bounds.min()[axis];
+		auto bin_width = (bounds.max()[axis] - origin) / bin_count;
+		if (bin_width <= 0) continue;
+
+		bin_bounds.fill(empty_box());
+		entries.fill(0);
+		exits.fill(0);
+
+		auto bin_of = [&](double x) { return std::clamp(static_cast<int>((x - origin) / bin_width), 0, bin_count - 1); };
+
+		for (const auto& ref : refs)
+		{
+			auto first = bin_of(ref.box.min()[axis]);
+			auto last = bin_of(ref.box.max()[axis]);
+			auto rest = ref;
+
+			// Chop the reference into one piece per bin it overlaps.
+			for (int b = first; b < last; b++)
+			{
+				build_ref piece, remainder;
+				split_reference(rest, axis, origin + (b + 1) * bin_width, piece, remainder);
+				grow_box(bin_bounds[b], piece.box);
+				rest = remainder;
+			}
+			grow_box(bin_bounds[last], rest.box);
+			entries[first]++;
+			exits[last]++;
+		}
+
+		aabb accum = empty_box();
+		size_t right_count = 0;
+		for (int b = bin_count - 1; b > 0; b--)
+		{
+			grow_box(accum, bin_bounds[b]);
+			right_count += exits[b];
+			right_counts[b] = right_count;
+			right_boxes[b] = accum;
+			right_area[b] = box_is_empty(accum) ? 0 : surface_area(accum);
+		}
+
+		accum = empty_box();
+		size_t left_count = 0;
+		for (int b = 0; b < bin_count - 1; b++)
+		{
+			grow_box(accum, bin_bounds[b]);
+			left_count += entries[b];
+			if (left_count == 0 || right_counts[b + 1] == 0) continue;
+
+			auto cost = options.intersection_cost * (surface_area(accum) * left_count + right_area[b + 1] * right_counts[b + 1]);
+			if (cost < best.cost)
+			{
+				best.cost = cost;
+				best.axis = axis;
+				best.bin = b;
+				best.position = origin + (b + 1) * bin_width;
+				best.spatial = true;
+				best.left_box = accum;
+				best.right_box = right_boxes[b + 1];
+			}
+		}
+	}
+	return best;
+}
+
+inline uint32_t bvh_builder::flatten(const build_node* node, std::vector<bvh_linear_node>& nodes, std::vector<uint32_t>& prim_indices,
+	double root_area, bvh_build_stats& stats, int depth) const
+{
+	auto node_index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	stats.max_depth = std::max(stats.max_depth, depth);
+
+	bvh_linear_node linear{};
+	for (int a = 0; a < 3; a++)
+	{
+		linear.bounds_min[a] = round_down(node->bounds.min()[a]);
+		linear.bounds_max[a] = round_up(node->bounds.max()[a]);
+	}
+
+	auto area_ratio = root_area > 0 ? surface_area(node->bounds) / root_area : 1.0;
+
+	if (!node->children[0])
+	{
+		linear.offset = static_cast<uint32_t>(prim_indices.size());
+		linear.prim_count = static_cast<uint16_t>(node->prims.size());
+		prim_indices.insert(prim_indices.end(), node->prims.begin(), node->prims.end());
+
+		stats.leaf_count++;
+		stats.sah_cost += options.intersection_cost * node->prims.size() * area_ratio;
+	}
+	else
+	{
+		flatten(node->children[0].get(), nodes, prim_indices, root_area, stats, depth + 1);
+		linear.offset = flatten(node->children[1].get(), nodes, prim_indices, root_area, stats, depth + 1);
+		linear.axis = static_cast<uint8_t>(node->axis);
+
+		stats.sah_cost += options.traversal_cost * area_ratio;
+	}
+
+	nodes[node_index] = linear;
+	return node_index;
+}
@@ -10,7 +10,7 @@ public:
 	{
 		auto theta = degrees_to_radians(vfov);
 		auto h = tan(theta / 2);
-		auto viewport_height = 2.0 * h;
+		viewport_height = 2.0 * h;
 		auto viewport_width = aspect_ratio * viewport_height;
 
 		w = unit_vector(lookfrom - lookat);
@@ -37,7 +37,11 @@ public:
 			random_double(time0, time1));
 	}
 
+	// Angle between the rays through neighbouring rows of an image image_height pixels tall.
+	double pixel_spread(int image_height) const { return viewport_height / (image_height - 1); }
+
 private:
+	double viewport_height;
 	point3 origin;
 	point3 lower_left_corner;
 	vec3 horizontal;
@@ -0,0 +1,174 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "framebuffer.h"
+#include "mapped_file.h"
+#include "settings.h"
+
+struct checkpoint_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t samples_per_pixel;
+	uint32_t pass_samples;
+	float adaptive_threshold;
+	uint32_t passes_done;
+	uint32_t frame;
+	uint64_t identity;
+};
+
+// Identifies what a render is of, beyond the size and sample counts a checkpoint records itself:
+// the scene or mesh file by path, size and modification time, and the settings that change the
+// image. Resuming with any of them different would add passes of another image onto the old one.
+inline uint64_t render_identity(const render_settings& settings)
+{
+	namespace fs = std::filesystem;
+	std::string description = "depth " + std::to_string(settings.max_depth) + " rr-depth " + std::to_string(settings.rr_depth)
+		+ " integrator " + settings.integrator + " denoise " + std::to_string(settings.denoise);
+	for (const auto& source : { settings.scene, settings.mesh })
+	{
+		if (source.empty()) continue;
+		std::error_code error;
+		auto path = fs::absolute(source, error).string();
+		auto size = fs::file_size(source, error);
+		auto time = error ? 0 : fs::last_write_time(source, error).time_since_epoch().count();
+		description += " source " + path + ' ' + std::to_string(error ? 0 : size) + ' ' + std::to_string(time);
+	}
+
+	// FNV-1a, which unlike std::hash gives every build the same value.
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (unsigned char c : description)
+		hash = (hash ^ c) * 0x100000001b3ull;
+	return hash;
+}
+
+// Progressive render state kept in a memory mapped file: a header followed by two accumulation
+// slots, each holding the float RGB sums, luminance square sums and sample counts of every pixel.
+// A finished pass is summed into the slot that is not current, flushed, and only then counted. The
+// count alone picks the current slot, so one store makes a pass current and a crash at any point
+// leaves the last completed pass intact for --resume.
+class render_checkpoint
+{
+public:
+	static constexpr uint32_t current_version = 3;
+
+	bool create(const std::string& path, int width, int height, int samples_per_pixel, int pass_samples,
+		float adaptive_threshold, uint32_t frame, uint64_t identity);
+	bool open(const std::string& path, int width, int height, int samples_per_pixel, int pass_samples,
+		float adaptive_threshold, uint32_t frame, uint64_t identity);
+
+	// Adds a completed pass to the accumulated image and makes it durable.
+	void commit_pass(const framebuffer& pass);
+
+	int passes_done() const { return static_cast<int>(header()->passes_done); }
+	const framebuffer& film() const { return *slots[header()->passes_done & 1]; }
+
+private:
+	checkpoint_header* header() const { return reinterpret_cast<checkpoint_header*>(file.data()); }
+	static size_t slot_bytes(int width, int height);
+	void bind_slots(int width, int height);
+
+	mapped_file file;
+	std::unique_ptr<framebuffer> slots[2];
+};
+
+inline size_t render_checkpoint::slot_bytes(int width, int height)
+{
+	auto pixels = static_cast<size_t>(width) * height;
+	return pixels * 4 * sizeof(float) + pixels * sizeof(uint32_t);
+}
+
+inline void render_checkpoint::bind_slots(int width, int height)
+{
+	auto pixels = static_cast<size_t>(width) * height;
+	for (int s = 0; s < 2; s++)
+	{
+		auto base = file.data() + sizeof(checkpoint_header) + s * slot_bytes(width, height);
+		auto sums = reinterpret_cast<float*>(base);
+		auto squares = sums + pixels * 3;
+		auto counts = reinterpret_cast<uint32_t*>(base + pixels * 4 * sizeof(float));
+		slots[s] = std::make_unique<framebuffer>(width, height, sums, squares, counts);
+	}
+}
+
+bool render_checkpoint::create(const std::string& path, int width, int height, int samples_per_pixel, int pass_samples,
+	float adaptive_threshold, uint32_t frame, uint64_t identity)
+{
+	if (!file.create(path, sizeof(checkpoint_header) + 2 * slot_bytes(width, height)))
+	{
+		std::cerr << "Could not create checkpoint '" << path << "'.\n";
+		return false;
+	}
+
+	auto h = header();
+	std::memcpy(h->magic, "RTCHKPT", 8);
+	h->version = current_version;
+	h->width = width;
+	h->height = height;
+	h->samples_per_pixel = samples_per_pixel;
+	h->pass_samples = pass_samples;
+	h->adaptive_threshold = adaptive_threshold;
+	h->passes_done = 0;
+	h->frame = frame;
+	h->identity = identity;
+	file.flush();
+
+	bind_slots(width, height);
+	return true;
+}
+
+bool render_checkpoint::open(const std::string& path, int width, int height, int samples_per_pixel, int pass_samples,
+	float adaptive_threshold, uint32_t frame, uint64_t identity)
+{
+	if (!file.open(path))
+	{
+		std::cerr << "Could not open checkpoint '" << path << "'.\n";
+		return false;
+	}
+
+	auto h = header();
+	if (file.size() < sizeof(checkpoint_header) || std::memcmp(h->magic, "RTCHKPT", 8) != 0 || h->version != current_version
+		|| file.size() != sizeof(checkpoint_header) + 2 * slot_bytes(h->width, h->height))
+	{
+		std::cerr << "'" << path << "' is not a checkpoint written by this version.\n";
+		file.close();
+		return false;
+	}
+	if (h->width != static_cast<uint32_t>(width) || h->height != static_cast<uint32_t>(height)
+		|| h->samples_per_pixel != static_cast<uint32_t>(samples_per_pixel) || h->pass_samples != static_cast<uint32_t>(pass_samples)
+		|| h->adaptive_threshold != adaptive_threshold || h->frame != frame)
+	{
+		std::cerr << "Checkpoint '" << path << "' was rendered with different settings ("
+			<< h->width << 'x' << h->height << ", " << h->samples_per_pixel << " spp in passes of " << h->pass_samples << ").\n";
+		file.close();
+		return false;
+	}
+	if (h->identity != identity)
+	{
+		std::cerr << "Checkpoint '" << path << "' was rendered from another scene or with a different --depth, --rr-depth, "
+			<< "--integrator or --denoise.\n";
+		file.close();
+		return false;
+	}
+
+	bind_slots(width, height);
+	return true;
+}
+
+void render_checkpoint::commit_pass(const framebuffer& pass)
+{
+	auto h = header();
+	auto current = h->passes_done & 1;
+	slots[1 - current]->assign_sum(*slots[current], pass);
+	file.flush();
+
+	h->passes_done++;
+	file.flush();
+}
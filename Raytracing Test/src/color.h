@@ -1,20 +1,16 @@
 #pragma once
-#include <iostream>
+#include <cstdint>
 
 #include "vec3.h"
 
-void write_color(std::ostream& out, color pixel_color, int samples_per_pixel)
+// Gamma 2 encodes one linear color component into an 8 bit display value.
+inline uint8_t to_byte(double linear)
 {
-	auto r = pixel_color.x();
-	auto g = pixel_color.y();
-	auto b = pixel_color.z();
+	return static_cast<uint8_t>(256 * clamp(sqrt(linear), 0.0, 0.999));
+}
 
-	auto scale = 1.0 / samples_per_pixel;
-	r = sqrt(scale * r);
-	g = sqrt(scale * g);
-	b = sqrt(scale * b);
-
-	out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-		<< static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-		<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
-}
\ No newline at end of file
+// Rec. 709 luminance of a linear color.
+inline double luminance(const color& c)
+{
+	return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
@@ -0,0 +1,817 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "shared.h"
+#include "hittable_list.h"
+#include "aarect.h"
+#include "box.h"
+#include "constant_medium.h"
+#include "flat_array.h"
+#include "instance.h"
+#include "material.h"
+#include "stats.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+enum class prim_type : uint8_t
+{
+	sphere,
+	moving_sphere,
+	yz_rect,
+	xz_rect,
+	xy_rect,
+	box,
+	medium,
+	translate,
+	rotate_y,
+	triangle,
+	instance,
+	generic
+};
+
+inline const char* prim_type_name(prim_type type)
+{
+	switch (type)
+	{
+	case prim_type::sphere: return "sphere";
+	case prim_type::moving_sphere: return "moving_sphere";
+	case prim_type::yz_rect: return "yz_rect";
+	case prim_type::xz_rect: return "xz_rect";
+	case prim_type::xy_rect: return "xy_rect";
+	case prim_type::box: return "box";
+	case prim_type::medium: return "medium";
+	case prim_type::translate: return "translate";
+	case prim_type::rotate_y: return "rotate_y";
+	case prim_type::triangle: return "triangle";
+	case prim_type::instance: return "instance";
+	case prim_type::generic: return "generic";
+	}
+	return "unknown";
+}
+
+const int prim_type_count = static_cast<int>(prim_type::generic) + 1;
+static_assert(prim_type_count <= stats_slots && material_kind_count <= stats_slots, "render_stats counts every primitive type and material kind");
+
+// A compiled primitive: the array it lives in, its index there, and whether its faces are flipped.
+struct prim_ref
+{
+	prim_type type;
+	uint8_t flip;
+	uint32_t index;
+};
+
+struct sphere_prim
+{
+	point3 center;
+	double radius;
+	uint32_t material;
+};
+
+struct moving_sphere_prim
+{
+	point3 center0, center1;
+	double time0, time1;
+	double radius;
+	uint32_t material;
+};
+
+// Plane k on the rect's normal axis, bounded by [a0, a1] x [b0, b1] on the other two axes.
+struct rect_prim
+{
+	double a0, a1, b0, b1, k;
+	uint32_t material;
+};
+
+struct box_prim
+{
+	point3 box_min, box_max;
+	uint32_t material;
+};
+
+struct medium_prim
+{
+	prim_ref boundary;
+	double neg_inv_density;
+	uint32_t phase_function;
+};
+
+struct translate_prim
+{
+	vec3 offset;
+	prim_ref child;
+};
+
+struct rotate_y_prim
+{
+	double sin_theta, cos_theta;
+	prim_ref child;
+};
+
+struct instance_prim
+{
+	affine_transform to_world, to_object;
+	prim_ref child;
+};
+
+// One triangle of a mesh; its corners stay in the mesh's shared buffers.
+struct triangle_prim
+{
+	uint32_t mesh;
+	uint32_t triangle;
+	uint32_t material;
+};
+
+// Flat, data oriented copy of a scene built from the hittable authoring classes.
+// Primitives are grouped by type into contiguous arrays and intersected through a
+// switch on their type tag, so leaf tests are direct calls the compiler can inline.
+// Hittables without a compiled form are kept as generic primitives and hit virtually.
+// Top level triangle meshes become one primitive per triangle, so the BVH sees every triangle;
+// a mesh below a transform is kept whole and tests all of its triangles.
+// An instance transforms the ray once and hits its child; a child shared by many instances,
+// typically a linear_bvh over the instanced geometry, is kept once as a generic primitive.
+class compiled_scene
+{
+public:
+	compiled_scene() {}
+	compiled_scene(const std::vector<shared_ptr<hittable>>& objects, double time0, double time1);
+
+	bool hit(uint32_t prim, const ray& r, double t_min, double t_max, hit_record& rec) const
+	{
+		return hit(prims[prim], r, t_min, t_max, rec);
+	}
+
+	void hit_packet(uint32_t prim, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+	{
+		hit_packet(prims[prim], rays, active, t_min, hits);
+	}
+
+	bool hit(prim_ref ref, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	void hit_packet(prim_ref ref, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const;
+
+	// The top level primitives and their bounds; these are what acceleration structures index.
+	// The bounds are only needed to build one, and are not kept in a snapshot.
+	flat_array<prim_ref> prims;
+	std::vector<aabb> prim_boxes;
+
+	flat_array<sphere_prim> spheres;
+	flat_array<moving_sphere_prim> moving_spheres;
+	flat_array<rect_prim> rects[3];
+	flat_array<box_prim> boxes;
+	flat_array<medium_prim> media;
+	flat_array<translate_prim> translates;
+	flat_array<rotate_y_prim> rotations;
+	flat_array<triangle_prim> triangles;
+	flat_array<instance_prim> instances;
+	std::vector<shared_ptr<const mesh_data>> meshes;
+	std::vector<shared_ptr<hittable>> generics;
+	std::vector<shared_ptr<material>> materials;
+
+	// The top level objects made of a diffuse_light material, found while compiling, and the
+	// primitives they compiled to. Emissive meshes have no single primitive and are left out
+	// of emitter_prims.
+	std::vector<shared_ptr<hittable>> emitters;
+	flat_array<prim_ref> emitter_prims;
+
+	// Keeps alive the memory the arrays above view, when they were loaded from a snapshot.
+	shared_ptr<const void> storage;
+
+	// The material a compiled primitive is made of, or null for media and generic primitives.
+	const material* prim_material(prim_ref ref) const;
+
+private:
+	void add_top_level(const shared_ptr<hittable>& object, double time0, double time1);
+	prim_ref compile(const shared_ptr<hittable>& object);
+	uint32_t material_index(const shared_ptr<material>& mat);
+
+	// hit without counting the test, for callers that have counted it already.
+	bool intersect(prim_ref ref, const ray& r, double t_min, double t_max, hit_record& rec) const;
+
+	bool hit_sphere(const sphere_prim& s, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_moving_sphere(const moving_sphere_prim& s, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	template <int k_axis>
+	bool hit_rect(const rect_prim& rect, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_box(const box_prim& b, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_medium(const medium_prim& m, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_translate(const translate_prim& t, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_rotate_y(const rotate_y_prim& rot, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_triangle(const triangle_prim& tri, const ray& r, double t_min, double t_max, hit_record& rec) const;
+	bool hit_instance(const instance_prim& inst, const ray& r, double t_min, double t_max, hit_record& rec) const;
+
+	void hit_sphere_packet(const sphere_prim& s, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const;
+	template <int k_axis>
+	void hit_rect_packet(const rect_prim& rect, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const;
+	void hit_box_packet(const box_prim& b, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const;
+	void hit_triangle_packet(const triangle_prim& tri, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const;
+	void hit_instance_packet(const instance_prim& inst, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const;
+
+	void set_sphere_record(const point3& center, double radius, uint32_t material, const ray& r, double t, hit_record& rec) const;
+	template <int k_axis>
+	void set_rect_record(const rect_prim& rect, const ray& r, double t, double a, double b, hit_record& rec) const;
+
+	std::unordered_map<const material*, uint32_t> material_lookup;
+	std::unordered_map<const mesh_data*, uint32_t> mesh_lookup;
+	std::unordered_map<const hittable*, uint32_t> generic_lookup;
+};
+
+constexpr int rect_a_axis(int k_axis) { return k_axis == 0 ? 1 : 0; }
+constexpr int rect_b_axis(int k_axis) { return k_axis == 2 ? 1 : 2; }
+
+compiled_scene::compiled_scene(const std::vector<shared_ptr<hittable>>& objects, double time0, double time1)
+{
+	for (const auto& object : objects)
+		add_top_level(object, time0, time1);
+}
+
+void compiled_scene::add_top_level(const shared_ptr<hittable>& object, double time0, double time1)
+{
+	// Nested lists are flattened so their members become separate leaves of the BVH.
+	if (auto list = dynamic_cast<const hittable_list*>(object.get()))
+	{
+		for (const auto& child : list->objects)
+			add_top_level(child, time0, time1);
+		return;
+	}
+
+	if (auto mesh = dynamic_cast<const triangle_mesh*>(object.get()))
+	{
+		auto found = mesh_lookup.find(mesh->mesh.get());
+		auto mesh_index = found != mesh_lookup.end() ? found->second : static_cast<uint32_t>(meshes.size());
+		if (found == mesh_lookup.end())
+		{
+			meshes.push_back(mesh->mesh);
+			mesh_lookup[mesh->mesh.get()] = mesh_index;
+		}
+
+		auto mat = material_index(mesh->mp);
+		for (size_t t = 0; t < mesh->mesh->triangle_count(); t++)
+		{
+			triangles.push_back({ mesh_index, static_cast<uint32_t>(t), mat });
+			prims.push_back({ prim_type::triangle, 0, static_cast<uint32_t>(triangles.size() - 1) });
+			prim_boxes.push_back(mesh->mesh->triangle_box(t));
+		}
+		if (mesh->mp->kind() == material_kind::diffuse_light)
+			emitters.push_back(object);
+		return;
+	}
+
+	// An instance without a box, whose transform is singular, hits nothing, as instance::hit does.
+	if (auto inst = dynamic_cast<const instance*>(object.get()); inst && !inst->hasbox)
+		return;
+
+	aabb box;
+	if (!object->bounding_box(time0, time1, box))
+		std::cerr << "No bounding box in compiled_scene constructor.\n";
+
+	auto ref = compile(object);
+	auto mat = prim_material(ref);
+	if (mat && mat->kind() == material_kind::diffuse_light)
+	{
+		emitters.push_back(object);
+		emitter_prims.push_back(ref);
+	}
+
+	prims.push_back(ref);
+	prim_boxes.push_back(box);
+}
+
+prim_ref compiled_scene::compile(const shared_ptr<hittable>& object)
+{
+	auto ptr = object.get();
+
+	if (auto f = dynamic_cast<const flip_face*>(ptr))
+	{
+		auto ref = compile(f->ptr);
+		ref.flip ^= 1;
+		return ref;
+	}
+	if (auto s = dynamic_cast<const sphere*>(ptr))
+	{
+		spheres.push_back({ s->center, s->radius, material_index(s->mat_ptr) });
+		return { prim_type::sphere, 0, static_cast<uint32_t>(spheres.size() - 1) };
+	}
+	if (auto s = dynamic_cast<const moving_sphere*>(ptr))
+	{
+		moving_spheres.push_back({ s->center0, s->center1, s->time0, s->time1, s->radius, material_index(s->mat_ptr) });
+		return { prim_type::moving_sphere, 0, static_cast<uint32_t>(moving_spheres.size() - 1) };
+	}
+	if (auto rect = dynamic_cast<const yz_rect*>(ptr))
+	{
+		rects[0].push_back({ rect->y0, rect->y1, rect->z0, rect->z1, rect->k, material_index(rect->mp) });
+		return { prim_type::yz_rect, 0, static_cast<uint32_t>(rects[0].size() - 1) };
+	}
+	if (auto rect = dynamic_cast<const xz_rect*>(ptr))
+	{
+		rects[1].push_back({ rect->x0, rect->x1, rect->z0, rect->z1, rect->k, material_index(rect->mp) });
+		return { prim_type::xz_rect, 0, static_cast<uint32_t>(rects[1].size() - 1) };
+	}
+	if (auto rect = dynamic_cast<const xy_rect*>(ptr))
+	{
+		rects[2].push_back({ rect->x0, rect->x1, rect->y0, rect->y1, rect->k, material_index(rect->mp) });
+		return { prim_type::xy_rect, 0, static_cast<uint32_t>(rects[2].size() - 1) };
+	}
+	if (auto b = dynamic_cast<const box*>(ptr))
+	{
+		boxes.push_back({ b->box_min, b->box_max, material_index(b->mp) });
+		return { prim_type::box, 0, static_cast<uint32_t>(boxes.size() - 1) };
+	}
+	if (auto m = dynamic_cast<const constant_medium*>(ptr))
+	{
+		auto boundary = compile(m->boundary);
+		media.push_back({ boundary, m->neg_inv_density, material_index(m->phase_function) });
+		return { prim_type::medium, 0, static_cast<uint32_t>(media.size() - 1) };
+	}
+	if (auto t = dynamic_cast<const translate*>(ptr))
+	{
+		auto child = compile(t->ptr);
+		translates.push_back({ t->offset, child });
+		return { prim_type::translate, 0, static_cast<uint32_t>(translates.size() - 1) };
+	}
+	if (auto rot = dynamic_cast<const rotate_y*>(ptr))
+	{
+		auto child = compile(rot->ptr);
+		rotations.push_back({ rot->sin_theta, rot->cos_theta, child });
+		return { prim_type::rotate_y, 0, static_cast<uint32_t>(rotations.size() - 1) };
+	}
+	// One inside a translate or rotation falls through to the generic case, where its own hit
+	// never reports anything.
+	if (auto inst = dynamic_cast<const instance*>(ptr); inst && inst->hasbox)
+	{
+		auto child = compile(inst->ptr);
+		instances.push_back({ inst->to_world, inst->to_object, child });
+		return { prim_type::instance, 0, static_cast<uint32_t>(instances.size() - 1) };
+	}
+
+	auto found = generic_lookup.find(ptr);
+	if (found != generic_lookup.end())
+		return { prim_type::generic, 0, found->second };
+
+	generics.push_back(object);
+	generic_lookup[ptr] = static_cast<uint32_t>(generics.size() - 1);
+	return { prim_type::generic, 0, static_cast<uint32_t>(generics.size() - 1) };
+}
+
+uint32_t compiled_scene::material_index(const shared_ptr<material>& mat)
+{
+	auto found = material_lookup.find(mat.get());
+	if (found != material_lookup.end())
+		return found->second;
+
+	auto index = static_cast<uint32_t>(materials.size());
+	materials.push_back(mat);
+	material_lookup[mat.get()] = index;
+	return index;
+}
+
+const material* compiled_scene::prim_material(prim_ref ref) const
+{
+	switch (ref.type)
+	{
+	case prim_type::sphere: return materials[spheres[ref.index].material].get();
+	case prim_type::moving_sphere: return materials[moving_spheres[ref.index].material].get();
+	case prim_type::yz_rect: return materials[rects[0][ref.index].material].get();
+	case prim_type::xz_rect: return materials[rects[1][ref.index].material].get();
+	case prim_type::xy_rect: return materials[rects[2][ref.index].material].get();
+	case prim_type::box: return materials[boxes[ref.index].material].get();
+	case prim_type::translate: return prim_material(translates[ref.index].child);
+	case prim_type::rotate_y: return prim_material(rotations[ref.index].child);
+	case prim_type::triangle: return materials[triangles[ref.index].material].get();
+	case prim_type::instance: return prim_material(instances[ref.index].child);
+	default: return nullptr;
+	}
+}
+
+inline bool compiled_scene::hit(prim_ref ref, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	count_prim_tests(static_cast<int>(ref.type));
+	return intersect(ref, r, t_min, t_max, rec);
+}
+
+bool compiled_scene::intersect(prim_ref ref, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	bool hit_anything = false;
+	switch (ref.type)
+	{
+	case prim_type::sphere: hit_anything = hit_sphere(spheres[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::moving_sphere: hit_anything = hit_moving_sphere(moving_spheres[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::yz_rect: hit_anything = hit_rect<0>(rects[0][ref.index], r, t_min, t_max, rec); break;
+	case prim_type::xz_rect: hit_anything = hit_rect<1>(rects[1][ref.index], r, t_min, t_max, rec); break;
+	case prim_type::xy_rect: hit_anything = hit_rect<2>(rects[2][ref.index], r, t_min, t_max, rec); break;
+	case prim_type::box: hit_anything = hit_box(boxes[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::medium: hit_anything = hit_medium(media[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::translate: hit_anything = hit_translate(translates[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::rotate_y: hit_anything = hit_rotate_y(rotations[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::triangle: hit_anything = hit_triangle(triangles[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::instance: hit_anything = hit_instance(instances[ref.index], r, t_min, t_max, rec); break;
+	case prim_type::generic: hit_anything = generics[ref.index]->hit(r, t_min, t_max, rec); break;
+	}
+
+	if (hit_anything && ref.flip)
+		rec.front_face = !rec.front_face;
+	return hit_anything;
+}
+
+void compiled_scene::hit_packet(prim_ref ref, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	if (ref.flip)
+	{
+		packet_hits own_hits;
+		prim_ref unflipped = { ref.type, 0, ref.index };
+		hit_packet(unflipped, rays, active, t_min, own_hits);
+
+		for (auto lanes = own_hits.mask; lanes; lanes &= lanes - 1)
+		{
+			auto lane = lowest_lane(lanes);
+			hits.rec[lane] = own_hits.rec[lane];
+			hits.rec[lane].front_face = !hits.rec[lane].front_face;
+			hits.mask |= 1u << lane;
+		}
+		return;
+	}
+
+	count_prim_tests(static_cast<int>(ref.type), lane_count(active));
+	switch (ref.type)
+	{
+	case prim_type::sphere: hit_sphere_packet(spheres[ref.index], rays, active, t_min, hits); return;
+	case prim_type::yz_rect: hit_rect_packet<0>(rects[0][ref.index], rays, active, t_min, hits); return;
+	case prim_type::xz_rect: hit_rect_packet<1>(rects[1][ref.index], rays, active, t_min, hits); return;
+	case prim_type::xy_rect: hit_rect_packet<2>(rects[2][ref.index], rays, active, t_min, hits); return;
+	case prim_type::box: hit_box_packet(boxes[ref.index], rays, active, t_min, hits); return;
+	case prim_type::triangle: hit_triangle_packet(triangles[ref.index], rays, active, t_min, hits); return;
+	case prim_type::instance: hit_instance_packet(instances[ref.index], rays, active, t_min, hits); return;
+	case prim_type::generic: generics[ref.index]->hit_packet(rays, active, t_min, hits); return;
+	default: break;
+	}
+
+	for (; active; active &= active - 1)
+	{
+		auto lane = lowest_lane(active);
+		if (intersect(ref, rays.get(lane), t_min, rays.t_max[lane], hits.rec[lane]))
+		{
+			rays.t_max[lane] = hits.rec[lane].t;
+			hits.mask |= 1u << lane;
+		}
+	}
+}
+
+inline void compiled_scene::set_sphere_record(const point3& center, double radius, uint32_t material, const ray& r, double t,
+	hit_record& rec) const
+{
+	rec.t = t;
+	// Project the hit point back onto the sphere, so its error is a few ulps of the surface, not of the ray.
+	vec3 outward_normal = unit_vector(r.at(rec.t) - center);
+	rec.p = center + radius * outward_normal;
+	rec.set_face_normal(r, outward_normal);
+	rec.u = (atan2(-outward_normal.z(), outward_normal.x()) + pi) / (2 * pi);
+	rec.v = acos(-outward_normal.y()) / pi;
+	rec.uv_scale = 2 * sqrt(pi) * radius;
+	rec.mat_ptr = materials[material].get();
+}
+
+inline bool compiled_scene::hit_sphere(const sphere_prim& s, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	vec3 oc = r.origin() - s.center;
+	auto a = r.direction().length_squared();
+	auto half_b = dot(oc, r.direction());
+	auto c = oc.length_squared() - s.radius * s.radius;
+
+	auto discriminant = half_b * half_b - a * c;
+	if (discriminant < 0) return false;
+	auto sqrtd = sqrt(discriminant);
+
+	auto root = (-half_b - sqrtd) / a;
+	if (root < t_min || t_max < root)
+	{
+		root = (-half_b + sqrtd) / a;
+		if (root < t_min || t_max < root)
+			return false;
+	}
+
+	set_sphere_record(s.center, s.radius, s.material, r, root, rec);
+	return true;
+}
+
+inline bool compiled_scene::hit_moving_sphere(const moving_sphere_prim& s, const ray& r, double t_min, double t_max,
+	hit_record& rec) const
+{
+	auto center = s.center0 + ((r.time() - s.time0) / (s.time1 - s.time0)) * (s.center1 - s.center0);
+	vec3 oc = r.origin() - center;
+	auto a = r.direction().length_squared();
+	auto half_b = dot(oc, r.direction());
+	auto c = oc.length_squared() - s.radius * s.radius;
+
+	auto discriminant = half_b * half_b - a * c;
+	if (discriminant < 0) return false;
+	auto sqrtd = sqrt(discriminant);
+
+	auto root = (-half_b - sqrtd) / a;
+	if (root < t_min || t_max < root)
+	{
+		root = (-half_b + sqrtd) / a;
+		if (root < t_min || t_max < root)
+			return false;
+	}
+
+	rec.t = root;
+	auto outward_normal = unit_vector(r.at(rec.t) - center);
+	rec.p = center + s.radius * outward_normal;
+	rec.set_face_normal(r, outward_normal);
+	rec.mat_ptr = materials[s.material].get();
+	return true;
+}
+
+template <int k_axis>
+inline void compiled_scene::set_rect_record(const rect_prim& rect, const ray& r, double t, double a, double b,
+	hit_record& rec) const
+{
+	rec.u = (a - rect.a0) / (rect.a1 - rect.a0);
+	rec.v = (b - rect.b0) / (rect.b1 - rect.b0);
+	rec.uv_scale = sqrt((rect.a1 - rect.a0) * (rect.b1 - rect.b0));
+	rec.t = t;
+	vec3 outward_normal(0, 0, 0);
+	outward_normal[k_axis] = 1;
+	rec.set_face_normal(r, outward_normal);
+	rec.mat_ptr = materials[rect.material].get();
+	rec.p = r.at(t);
+	rec.p[k_axis] = rect.k;
+}
+
+template <int k_axis>
+inline bool compiled_scene::hit_rect(const rect_prim& rect, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	constexpr int a_axis = rect_a_axis(k_axis);
+	constexpr int b_axis = rect_b_axis(k_axis);
+
+	auto t = (rect.k - r.orig.e[k_axis]) / r.dir.e[k_axis];
+	if (t < t_min || t > t_max)
+		return false;
+
+	auto a = r.orig.e[a_axis] + t * r.dir.e[a_axis];
+	auto b = r.orig.e[b_axis] + t * r.dir.e[b_axis];
+	if (a < rect.a0 || a > rect.a1 || b < rect.b0 || b > rect.b1)
+		return false;
+
+	set_rect_record<k_axis>(rect, r, t, a, b, rec);
+	return true;
+}
+
+inline bool compiled_scene::hit_box(const box_prim& b, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	// Same faces, in the same order, as the six rects of box::sides.
+	const rect_prim faces[6] = {
+		{ b.box_min.x(), b.box_max.x(), b.box_min.y(), b.box_max.y(), b.box_max.z(), b.material },
+		{ b.box_min.x(), b.box_max.x(), b.box_min.y(), b.box_max.y(), b.box_min.z(), b.material },
+		{ b.box_min.x(), b.box_max.x(), b.box_min.z(), b.box_max.z(), b.box_max.y(), b.material },
+		{ b.box_min.x(), b.box_max.x(), b.box_min.z(), b.box_max.z(), b.box_min.y(), b.material },
+		{ b.box_min.y(), b.box_max.y(), b.box_min.z(), b.box_max.z(), b.box_max.x(), b.material },
+		{ b.box_min.y(), b.box_max.y(), b.box_min.z(), b.box_max.z(), b.box_min.x(), b.material }
+	};
+
+	bool hit_anything = false;
+	for (int f = 0; f < 6; f++)
+	{
+		bool face_hit = f < 2 ? hit_rect<2>(faces[f], r, t_min, t_max, rec)
+			: f < 4 ? hit_rect<1>(faces[f], r, t_min, t_max, rec)
+			: hit_rect<0>(faces[f], r, t_min, t_max, rec);
+		if (face_hit)
+		{
+			hit_anything = true;
+			t_max = rec.t;
+		}
+	}
+	return hit_anything;
+}
+
+bool compiled_scene::hit_medium(const medium_prim& m, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	hit_record rec1, rec2;
+
+	if (!hit(m.boundary, r, -infinity, infinity, rec1))
+		return false;
+	if (!hit(m.boundary, r, rec1.t + 0.0001, infinity, rec2))
+		return false;
+
+	if (rec1.t < t_min) rec1.t = t_min;
+	if (rec2.t > t_max) rec2.t = t_max;
+
+	if (rec1.t >= rec2.t)
+		return false;
+
+	if (rec1.t < 0)
+		rec1.t = 0;
+
+	const auto ray_length = r.direction().length();
+	const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+	const auto hit_distance = m.neg_inv_density * log(random_double());
+
+	if (hit_distance > distance_inside_boundary)
+		return false;
+
+	rec.t = rec1.t + hit_distance / ray_length;
+	rec.p = r.at(rec.t);
+
+	rec.normal = rec.geometric_normal = vec3(1, 0, 0);
+	rec.front_face = true;
+	rec.mat_ptr = materials[m.phase_function].get();
+	return true;
+}
+
+bool compiled_scene::hit_translate(const translate_prim& t, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	ray moved_r(r.origin() - t.offset, r.direction(), r.time());
+	if (!hit(t.child, moved_r, t_min, t_max, rec))
+		return false;
+
+	rec.p += t.offset;
+	rec.set_transformed_normals(moved_r, rec.normal, rec.geometric_normal);
+	return true;
+}
+
+bool compiled_scene::hit_rotate_y(const rotate_y_prim& rot, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	auto origin = r.origin();
+	auto direction = r.direction();
+
+	origin[0] = rot.cos_theta * r.origin()[0] - rot.sin_theta * r.origin()[2];
+	origin[2] = rot.sin_theta * r.origin()[0] + rot.cos_theta * r.origin()[2];
+
+	direction[0] = rot.cos_theta * r.direction()[0] - rot.sin_theta * r.direction()[2];
+	direction[2] = rot.sin_theta * r.direction()[0] + rot.cos_theta * r.direction()[2];
+
+	ray rotated_r(origin, direction, r.time());
+
+	if (!hit(rot.child, rotated_r, t_min, t_max, rec))
+		return false;
+
+	auto p = rec.p;
+	auto normal = rec.normal;
+	auto geometric = rec.geometric_normal;
+
+	p[0] = rot.cos_theta * rec.p[0] + rot.sin_theta * rec.p[2];
+	p[2] = -rot.sin_theta * rec.p[0] + rot.cos_theta * rec.p[2];
+
+	normal[0] = rot.cos_theta * rec.normal[0] + rot.sin_theta * rec.normal[2];
+	normal[2] = -rot.sin_theta * rec.normal[0] + rot.cos_theta * rec.normal[2];
+
+	geometric[0] = rot.cos_theta * rec.geometric_normal[0] + rot.sin_theta * rec.geometric_normal[2];
+	geometric[2] = -rot.sin_theta * rec.geometric_normal[0] + rot.cos_theta * rec.geometric_normal[2];
+
+	rec.p = p;
+	rec.set_transformed_normals(rotated_r, normal, geometric);
+	return true;
+}
+
+inline bool compiled_scene::hit_triangle(const triangle_prim& tri, const ray& r, double t_min, double t_max,
+	hit_record& rec) const
+{
+	const auto& mesh = *meshes[tri.mesh];
+	const auto& p0 = mesh.vertex(tri.triangle, 0);
+	double t, b1, b2;
+	if (!intersect_triangle(p0, mesh.vertex(tri.triangle, 1) - p0, mesh.vertex(tri.triangle, 2) - p0, r, t_min, t_max, t, b1, b2))
+		return false;
+
+	mesh.set_hit_record(tri.triangle, r, t, b1, b2, materials[tri.material].get(), rec);
+	return true;
+}
+
+bool compiled_scene::hit_instance(const instance_prim& inst, const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	if (!hit(inst.child, inst.to_object.apply(r), t_min, t_max, rec))
+		return false;
+
+	instance_hit_to_world(inst.to_world, inst.to_object, rec);
+	return true;
+}
+
+void compiled_scene::hit_sphere_packet(const sphere_prim& s, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	double root[max_packet_size];
+	bool found[max_packet_size];
+
+	for (int k = 0; k < max_packet_size; k++)
+	{
+		auto ocx = rays.org[0][k] - s.center.e[0];
+		auto ocy = rays.org[1][k] - s.center.e[1];
+		auto ocz = rays.org[2][k] - s.center.e[2];
+		auto a = rays.dir[0][k] * rays.dir[0][k] + rays.dir[1][k] * rays.dir[1][k] + rays.dir[2][k] * rays.dir[2][k];
+		auto half_b = ocx * rays.dir[0][k] + ocy * rays.dir[1][k] + ocz * rays.dir[2][k];
+		auto c = ocx * ocx + ocy * ocy + ocz * ocz - s.radius * s.radius;
+
+		auto discriminant = half_b * half_b - a * c;
+		auto sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+		auto near_root = (-half_b - sqrtd) / a;
+		auto far_root = (-half_b + sqrtd) / a;
+
+		bool near_ok = discriminant >= 0 && near_root >= t_min && near_root <= rays.t_max[k];
+		bool far_ok = discriminant >= 0 && far_root >= t_min && far_root <= rays.t_max[k];
+		root[k] = near_ok ? near_root : far_root;
+		found[k] = near_ok || far_ok;
+	}
+
+	for (auto lanes = active & lanes_from_flags(found, max_packet_size); lanes; lanes &= lanes - 1)
+	{
+		auto lane = lowest_lane(lanes);
+		set_sphere_record(s.center, s.radius, s.material, rays.get(lane), root[lane], hits.rec[lane]);
+		rays.t_max[lane] = root[lane];
+		hits.mask |= 1u << lane;
+	}
+}
+
+template <int k_axis>
+void compiled_scene::hit_rect_packet(const rect_prim& rect, ray_packet& rays, uint32_t active, double t_min,
+	packet_hits& hits) const
+{
+	struct rect_view
+	{
+		const compiled_scene& scene;
+		const rect_prim& rect;
+
+		void set_hit_record(const ray& r, double t, double a, double b, hit_record& rec) const
+		{
+			scene.set_rect_record<k_axis>(rect, r, t, a, b, rec);
+		}
+	};
+
+	aarect_hit_packet(rect_view{ *this, rect }, k_axis, rect_a_axis(k_axis), rect_b_axis(k_axis),
+		rect.a0, rect.a1, rect.b0, rect.b1, rect.k, rays, active, t_min, hits);
+}
+
+void compiled_scene::hit_box_packet(const box_prim& b, ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	// Slab test every lane against the box first; only lanes that enter it test the six faces.
+	bool inside[max_packet_size];
+	for (int lane = 0; lane < max_packet_size; lane++)
+	{
+		auto t0 = t_min;
+		auto t1 = rays.t_max[lane];
+		for (int a = 0; a < 3; a++)
+		{
+			auto near_t = (b.box_min.e[a] - rays.org[a][lane]) * rays.inv_dir[a][lane];
+			auto far_t = (b.box_max.e[a] - rays.org[a][lane]) * rays.inv_dir[a][lane];
+			if (near_t > far_t) std::swap(near_t, far_t);
+			t0 = near_t > t0 ? near_t : t0;
+			t1 = far_t < t1 ? far_t : t1;
+		}
+		inside[lane] = t0 <= t1;
+	}
+
+	active &= lanes_from_flags(inside, max_packet_size);
+	if (!active) return;
+
+	const rect_prim faces[6] = {
+		{ b.box_min.x(), b.box_max.x(), b.box_min.y(), b.box_max.y(), b.box_max.z(), b.material },
+		{ b.box_min.x(), b.box_max.x(), b.box_min.y(), b.box_max.y(), b.box_min.z(), b.material },
+		{ b.box_min.x(), b.box_max.x(), b.box_min.z(), b.box_max.z(), b.box_max.y(), b.material },
+		{ b.box_min.x(), b.box_max.x(), b.box_min.z(), b.box_max.z(), b.box_min.y(), b.material },
+		{ b.box_min.y(), b.box_max.y(), b.box_min.z(), b.box_max.z(), b.box_max.x(), b.material },
+		{ b.box_min.y(), b.box_max.y(), b.box_min.z(), b.box_max.z(), b.box_min.x(), b.material }
+	};
+
+	hit_rect_packet<2>(faces[0], rays, active, t_min, hits);
+	hit_rect_packet<2>(faces[1], rays, active, t_min, hits);
+	hit_rect_packet<1>(faces[2], rays, active, t_min, hits);
+	hit_rect_packet<1>(faces[3], rays, active, t_min, hits);
+	hit_rect_packet<0>(faces[4], rays, active, t_min, hits);
+	hit_rect_packet<0>(faces[5], rays, active, t_min, hits);
+}
+
+void compiled_scene::hit_triangle_packet(const triangle_prim& tri, ray_packet& rays, uint32_t active, double t_min,
+	packet_hits& hits) const
+{
+	double t[max_packet_size], b1[max_packet_size], b2[max_packet_size];
+	bool found[max_packet_size];
+
+	const auto& mesh = *meshes[tri.mesh];
+	const auto& p0 = mesh.vertex(tri.triangle, 0);
+	intersect_triangle_packet(p0, mesh.vertex(tri.triangle, 1) - p0, mesh.vertex(tri.triangle, 2) - p0, rays, t_min, t, b1, b2, found);
+
+	for (auto lanes = active & lanes_from_flags(found, max_packet_size); lanes; lanes &= lanes - 1)
+	{
+		auto lane = lowest_lane(lanes);
+		mesh.set_hit_record(tri.triangle, rays.get(lane), t[lane], b1[lane], b2[lane], materials[tri.material].get(), hits.rec[lane]);
+		rays.t_max[lane] = t[lane];
+		hits.mask |= 1u << lane;
+	}
+}
+
+void compiled_scene::hit_instance_packet(const instance_prim& inst, ray_packet& rays, uint32_t active, double t_min,
+	packet_hits& hits) const
+{
+	ray_packet local;
+	transform_packet(inst.to_object, rays, local);
+
+	packet_hits own_hits;
+	hit_packet(inst.child, local, active, t_min, own_hits);
+
+	for (auto lanes = own_hits.mask; lanes; lanes &= lanes - 1)
+	{
+		auto lane = lowest_lane(lanes);
+		hits.rec[lane] = own_hits.rec[lane];
+		instance_hit_to_world(inst.to_world, inst.to_object, hits.rec[lane]);
+		rays.t_max[lane] = local.t_max[lane];
+		hits.mask |= 1u << lane;
+	}
+}
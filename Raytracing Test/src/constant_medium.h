@@ -53,9 +53,9 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 	rec.t = rec1.t + hit_distance / ray_length;
 	rec.p = r.at(rec.t);
 
-	rec.normal = vec3(1, 0, 0);
+	rec.normal = rec.geometric_normal = vec3(1, 0, 0);
 	rec.front_face = true;
-	rec.mat_ptr = phase_function;
+	rec.mat_ptr = phase_function.get();
 
 	return true;
 }
\ No newline at end of file
@@ -0,0 +1,197 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "shared.h"
+#include "color.h"
+#include "feature_buffer.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the first hit features.
+// Every iteration applies a 5x5 B3 spline kernel whose taps are 2^iteration pixels apart, and
+// weights each tap down where normal, depth, albedo or luminance differ from the center pixel.
+// As in SVGF the luminance threshold is the pixel's own standard deviation, which is carried
+// through the iterations, so the filter smooths noise harder where fewer samples converged.
+// Radiance is divided by the albedo before filtering and multiplied back afterwards, so
+// texture and color edges stay sharp while only the lighting is smoothed.
+struct denoise_options
+{
+	int iterations = 5;
+	double sigma_luminance = 4;
+	double sigma_normal = 128;
+	double sigma_depth = 1;
+	double sigma_albedo = 0.1;
+};
+
+class atrous_denoiser
+{
+public:
+	atrous_denoiser(const framebuffer& film, const feature_buffer& features, const denoise_options& _options = denoise_options());
+
+	// Filters the film and writes the result to out as a single sample per pixel.
+	void run(framebuffer& out, int threads);
+
+private:
+	struct texel
+	{
+		float rgb[3];
+		float variance;
+	};
+
+	struct guide
+	{
+		float albedo[3];
+		float normal[3];
+		float depth;
+		float depth_dx, depth_dy;
+	};
+
+	void filter(const std::vector<texel>& in, std::vector<texel>& out, int step, int threads) const;
+
+	denoise_options options;
+	int w, h;
+	std::vector<texel> image;
+	std::vector<guide> guides;
+};
+
+inline atrous_denoiser::atrous_denoiser(const framebuffer& film, const feature_buffer& features, const denoise_options& _options)
+	: options(_options), w(film.width()), h(film.height()), image(film.pixel_count()), guides(film.pixel_count())
+{
+	const float floor = 0.01f;
+
+	for (size_t p = 0; p < image.size(); p++)
+	{
+		auto albedo = features.albedo(p);
+		auto normal = features.normal(p);
+		auto& g = guides[p];
+		for (int a = 0; a < 3; a++)
+		{
+			g.albedo[a] = static_cast<float>(albedo[a]);
+			g.normal[a] = static_cast<float>(normal[a]);
+		}
+		g.depth = static_cast<float>(features.depth(p));
+
+		// Demodulate, and scale the luminance variance by the same factor.
+		auto c = film.average(p);
+		for (int a = 0; a < 3; a++)
+			image[p].rgb[a] = static_cast<float>(c[a]) / std::max(g.albedo[a], floor);
+		auto scale = 1.0 / std::max(luminance(albedo), 0.01);
+		auto variance = film.mean_variance(p);
+		if (!std::isfinite(variance))
+			variance = luminance(c) * luminance(c);
+		image[p].variance = static_cast<float>(variance * scale * scale);
+	}
+
+	// Central differences of depth predict how far a neighbour on the same surface may lie.
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			auto& g = guides[static_cast<size_t>(j) * w + i];
+			auto depth_at = [&](int x, int y) { return guides[static_cast<size_t>(std::clamp(y, 0, h - 1)) * w + std::clamp(x, 0, w - 1)].depth; };
+			g.depth_dx = 0.5f * std::fabs(depth_at(i + 1, j) - depth_at(i - 1, j));
+			g.depth_dy = 0.5f * std::fabs(depth_at(i, j + 1) - depth_at(i, j - 1));
+		}
+}
+
+inline void atrous_denoiser::run(framebuffer& out, int threads)
+{
+	std::vector<texel> scratch(image.size());
+	auto* src = &image;
+	auto* dst = &scratch;
+	for (int iteration = 0; iteration < options.iterations; iteration++)
+	{
+		filter(*src, *dst, 1 << iteration, threads);
+		std::swap(src, dst);
+	}
+
+	out.clear();
+	for (size_t p = 0; p < image.size(); p++)
+	{
+		const auto& t = (*src)[p];
+		const auto& g = guides[p];
+		color c(t.rgb[0] * std::max(g.albedo[0], 0.01f), t.rgb[1] * std::max(g.albedo[1], 0.01f), t.rgb[2] * std::max(g.albedo[2], 0.01f));
+		out.add(p, c, luminance(c) * luminance(c), 1);
+	}
+}
+
+inline void atrous_denoiser::filter(const std::vector<texel>& in, std::vector<texel>& out, int step, int threads) const
+{
+	static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	const auto sigma_l = static_cast<float>(options.sigma_luminance);
+	const auto sigma_n = static_cast<float>(options.sigma_normal);
+	const auto sigma_z = static_cast<float>(options.sigma_depth);
+	const auto inv_albedo = static_cast<float>(1.0 / (options.sigma_albedo * options.sigma_albedo));
+
+	auto lum = [](const texel& t) { return 0.2126f * t.rgb[0] + 0.7152f * t.rgb[1] + 0.0722f * t.rgb[2]; };
+
+	parallel_for(static_cast<size_t>(h), threads, [&](size_t begin, size_t end) {
+		for (int j = static_cast<int>(begin); j < static_cast<int>(end); j++)
+			for (int i = 0; i < w; i++)
+			{
+				auto p = static_cast<size_t>(j) * w + i;
+				const auto& center = in[p];
+				const auto& gp = guides[p];
+				auto lp = lum(center);
+
+				// Variance blurred over the 3x3 neighbourhood is a steadier edge threshold than the pixel's own.
+				float blurred = 0;
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						auto x = std::clamp(i + dx, 0, w - 1), y = std::clamp(j + dy, 0, h - 1);
+						blurred += kernel[dx + 2] * kernel[dy + 2] * in[static_cast<size_t>(y) * w + x].variance;
+					}
+				blurred /= (kernel[1] + kernel[2] + kernel[3]) * (kernel[1] + kernel[2] + kernel[3]);
+				auto luminance_scale = 1.0f / (sigma_l * std::sqrt(blurred) + 1e-6f);
+				bool has_normal = gp.normal[0] != 0 || gp.normal[1] != 0 || gp.normal[2] != 0;
+
+				float sum[3] = { 0, 0, 0 };
+				float weight_sum = 0, variance_sum = 0;
+				for (int ky = -2; ky <= 2; ky++)
+				{
+					auto y = j + ky * step;
+					if (y < 0 || y >= h) continue;
+					for (int kx = -2; kx <= 2; kx++)
+					{
+						auto x = i + kx * step;
+						if (x < 0 || x >= w) continue;
+
+						auto q = static_cast<size_t>(y) * w + x;
+						const auto& tap = in[q];
+						const auto& gq = guides[q];
+
+						auto cos_normal = gp.normal[0] * gq.normal[0] + gp.normal[1] * gq.normal[1] + gp.normal[2] * gq.normal[2];
+						bool tap_has_normal = gq.normal[0] != 0 || gq.normal[1] != 0 || gq.normal[2] != 0;
+						float w_normal = has_normal != tap_has_normal ? 0.0f
+							: has_normal ? std::pow(std::max(0.0f, cos_normal), sigma_n) : 1.0f;
+						if (w_normal <= 0) continue;
+
+						auto expected_depth = sigma_z * (gp.depth_dx * std::abs(kx * step) + gp.depth_dy * std::abs(ky * step))
+							+ 1e-3f * gp.depth;
+						auto w_depth = std::fabs(gp.depth - gq.depth) / (expected_depth + 1e-6f);
+
+						float albedo_distance = 0;
+						for (int a = 0; a < 3; a++)
+							albedo_distance += (gp.albedo[a] - gq.albedo[a]) * (gp.albedo[a] - gq.albedo[a]);
+
+						auto w_luminance = std::fabs(lp - lum(tap)) * luminance_scale;
+						auto weight = kernel[kx + 2] * kernel[ky + 2] * w_normal
+							* std::exp(-w_depth - w_luminance - albedo_distance * inv_albedo);
+
+						for (int a = 0; a < 3; a++)
+							sum[a] += weight * tap.rgb[a];
+						weight_sum += weight;
+						variance_sum += weight * weight * tap.variance;
+					}
+				}
+
+				// The center tap always has a positive weight, so weight_sum is never zero.
+				auto& result = out[p];
+				for (int a = 0; a < 3; a++)
+					result.rgb[a] = sum[a] / weight_sum;
+				result.variance = variance_sum / (weight_sum * weight_sum);
+			}
+		}, 4);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "shared.h"
+#include "vec3.h"
+
+// Auxiliary features of the first surface a camera ray sees, which guide the denoiser.
+// A ray that escapes keeps a zero normal and depth and takes the background as its albedo.
+struct path_features
+{
+	color albedo;
+	vec3 normal;
+	double depth = 0;
+};
+
+// Sums the first hit features of every sample per pixel, laid out like the framebuffer.
+// Distinct pixels may be written from different threads at the same time.
+class feature_buffer
+{
+public:
+	feature_buffer(int _width, int _height)
+		: w(_width), h(_height), albedo_sums(pixel_count() * 3, 0.0f), normal_sums(pixel_count() * 3, 0.0f),
+		depth_sums(pixel_count(), 0.0f), counts(pixel_count(), 0) {}
+
+	int width() const { return w; }
+	int height() const { return h; }
+	size_t pixel_count() const { return static_cast<size_t>(w) * h; }
+	size_t index(int i, int j) const { return static_cast<size_t>(j) * w + i; }
+
+	void add(size_t pixel, const path_features& f)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			albedo_sums[pixel * 3 + a] += static_cast<float>(f.albedo[a]);
+			normal_sums[pixel * 3 + a] += static_cast<float>(f.normal[a]);
+		}
+		depth_sums[pixel] += static_cast<float>(f.depth);
+		counts[pixel]++;
+	}
+
+	uint32_t samples(size_t pixel) const { return counts[pixel]; }
+
+	color albedo(size_t pixel) const
+	{
+		if (counts[pixel] == 0) return color(0, 0, 0);
+		auto scale = 1.0 / counts[pixel];
+		return color(albedo_sums[pixel * 3] * scale, albedo_sums[pixel * 3 + 1] * scale, albedo_sums[pixel * 3 + 2] * scale);
+	}
+
+	// Direction of the summed normals; pixels that straddle an edge get a shorter, blended normal
+	// before normalizing, which is still the best single estimate of their orientation.
+	vec3 normal(size_t pixel) const
+	{
+		vec3 n(normal_sums[pixel * 3], normal_sums[pixel * 3 + 1], normal_sums[pixel * 3 + 2]);
+		return n.near_zero() ? vec3(0, 0, 0) : unit_vector(n);
+	}
+
+	double depth(size_t pixel) const
+	{
+		return counts[pixel] == 0 ? 0.0 : depth_sums[pixel] / counts[pixel];
+	}
+
+private:
+	int w, h;
+	std::vector<float> albedo_sums, normal_sums, depth_sums;
+	std::vector<uint32_t> counts;
+};
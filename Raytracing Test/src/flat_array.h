@@ -0,0 +1,126 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A contiguous array of plain data that either owns its elements, while a scene is built, or
+// views elements that live elsewhere, such as a mapped snapshot file. Reads go through one
+// pointer either way, so traversal pays nothing for the choice. A view is read only: writing
+// through one faults on a read only mapping, and growing one drops the view.
+template <class T>
+class flat_array
+{
+	static_assert(std::is_trivially_copyable_v<T>, "flat_array holds plain data that can be saved byte for byte");
+
+public:
+	flat_array() {}
+	flat_array(const flat_array& other) : owned(other.owned) { adopt(other); }
+	flat_array(flat_array&& other) noexcept : owned(std::move(other.owned))
+	{
+		adopt(other);
+		other.sync();
+	}
+
+	flat_array& operator=(const flat_array& other)
+	{
+		owned = other.owned;
+		adopt(other);
+		return *this;
+	}
+
+	flat_array& operator=(flat_array&& other) noexcept
+	{
+		owned = std::move(other.owned);
+		adopt(other);
+		other.sync();
+		return *this;
+	}
+
+	// Takes over a built vector without copying it.
+	void assign(std::vector<T>&& elements)
+	{
+		owned = std::move(elements);
+		sync();
+	}
+
+	// Drops any owned elements and views count elements at data, which must outlive this array.
+	void view(const T* data, size_t count)
+	{
+		owned = std::vector<T>();
+		items = data;
+		length = count;
+		viewing = true;
+	}
+
+	bool is_view() const { return viewing; }
+
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	const T* data() const { return items; }
+	T* data() { return const_cast<T*>(items); }
+
+	const T& operator[](size_t i) const { return items[i]; }
+	T& operator[](size_t i) { return const_cast<T&>(items[i]); }
+	const T& back() const { return items[length - 1]; }
+
+	const T* begin() const { return items; }
+	const T* end() const { return items + length; }
+	T* begin() { return data(); }
+	T* end() { return data() + length; }
+
+	void push_back(const T& value)
+	{
+		owned.push_back(value);
+		sync();
+	}
+
+	void append(const T* first, const T* last)
+	{
+		owned.insert(owned.end(), first, last);
+		sync();
+	}
+
+	void reserve(size_t count)
+	{
+		owned.reserve(count);
+		sync();
+	}
+
+	void resize(size_t count)
+	{
+		owned.resize(count);
+		sync();
+	}
+
+	void clear()
+	{
+		owned.clear();
+		sync();
+	}
+
+private:
+	void sync()
+	{
+		items = owned.data();
+		length = owned.size();
+		viewing = false;
+	}
+
+	// A copied view keeps viewing the same memory; a copied owner points at its own elements.
+	void adopt(const flat_array& other)
+	{
+		if (other.viewing)
+		{
+			items = other.items;
+			length = other.length;
+			viewing = true;
+		}
+		else sync();
+	}
+
+	std::vector<T> owned;
+	const T* items = nullptr;
+	size_t length = 0;
+	bool viewing = false;
+};
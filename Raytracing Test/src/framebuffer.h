@@ -0,0 +1,97 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "shared.h"
+#include "color.h"
+#include "vec3.h"
+
+// Accumulates linear radiance per pixel as a float RGB sum plus the number of samples in it.
+// The sum of squared sample luminances is kept alongside to estimate each pixel's variance.
+// Pixel (i, j) lives at j * width + i with row 0 at the bottom, matching the camera's v axis.
+// Distinct pixels may be written from different threads at the same time.
+class framebuffer
+{
+public:
+	framebuffer(int _width, int _height)
+		: w(_width), h(_height), owned_sums(pixel_count() * 4, 0.0f), owned_counts(pixel_count(), 0),
+		sums(owned_sums.data()), squares(sums + pixel_count() * 3), counts(owned_counts.data()) {}
+
+	// Views storage owned elsewhere, such as a memory mapped checkpoint: 3 sums, 1 square sum and 1 count per pixel.
+	framebuffer(int _width, int _height, float* _sums, float* _squares, uint32_t* _counts)
+		: w(_width), h(_height), sums(_sums), squares(_squares), counts(_counts) {}
+
+	framebuffer(const framebuffer&) = delete;
+	framebuffer& operator=(const framebuffer&) = delete;
+
+	int width() const { return w; }
+	int height() const { return h; }
+	size_t pixel_count() const { return static_cast<size_t>(w) * h; }
+	size_t index(int i, int j) const { return static_cast<size_t>(j) * w + i; }
+
+	// Adds samples whose radiance sums to sum and whose squared luminances sum to luminance_squares.
+	void add(size_t pixel, const color& sum, double luminance_squares, uint32_t samples)
+	{
+		sums[pixel * 3 + 0] += static_cast<float>(sum.x());
+		sums[pixel * 3 + 1] += static_cast<float>(sum.y());
+		sums[pixel * 3 + 2] += static_cast<float>(sum.z());
+		squares[pixel] += static_cast<float>(luminance_squares);
+		counts[pixel] += samples;
+	}
+
+	// Sets every pixel to the sum of the same pixel in a and b; either may be this framebuffer.
+	void assign_sum(const framebuffer& a, const framebuffer& b)
+	{
+		for (size_t k = 0; k < pixel_count() * 3; k++)
+			sums[k] = a.sums[k] + b.sums[k];
+		for (size_t p = 0; p < pixel_count(); p++)
+		{
+			squares[p] = a.squares[p] + b.squares[p];
+			counts[p] = a.counts[p] + b.counts[p];
+		}
+	}
+
+	void clear()
+	{
+		std::fill(sums, sums + pixel_count() * 3, 0.0f);
+		std::fill(squares, squares + pixel_count(), 0.0f);
+		std::fill(counts, counts + pixel_count(), 0u);
+	}
+
+	uint32_t samples(size_t pixel) const { return counts[pixel]; }
+
+	// Mean radiance of the pixel, or black before its first sample.
+	color average(size_t pixel) const
+	{
+		if (counts[pixel] == 0) return color(0, 0, 0);
+		auto scale = 1.0 / counts[pixel];
+		return color(sums[pixel * 3] * scale, sums[pixel * 3 + 1] * scale, sums[pixel * 3 + 2] * scale);
+	}
+
+	// Estimated variance of the pixel's mean luminance, or infinity below two samples.
+	double mean_variance(size_t pixel) const
+	{
+		auto n = counts[pixel];
+		if (n < 2) return infinity;
+		auto mean = luminance(average(pixel));
+		auto variance = std::max(0.0, (squares[pixel] / n - mean * mean) * n / (n - 1));
+		return variance / n;
+	}
+
+	// Standard error of the pixel's mean luminance relative to that mean. The mean is offset by a
+	// small floor so that nearly black pixels do not demand unbounded samples.
+	double relative_error(size_t pixel) const
+	{
+		return std::sqrt(mean_variance(pixel)) / std::sqrt(luminance(average(pixel)) + 0.001);
+	}
+
+private:
+	int w, h;
+	std::vector<float> owned_sums;
+	std::vector<uint32_t> owned_counts;
+	float* sums;
+	float* squares;
+	uint32_t* counts;
+};
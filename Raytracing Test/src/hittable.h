@@ -1,6 +1,7 @@
 #pragma once
 #include "shared.h"
 #include "aabb.h"
+#include "ray_packet.h"
 
 class material;
 
@@ -8,17 +9,50 @@ struct hit_record
 {
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat_ptr;
+
+	// The normal of the surface itself, on the side the ray arrived from. It is normal except where
+	// a mesh interpolates vertex normals for shading; rays leaving the hit are offset along this
+	// one, which keeps them off the true surface.
+	vec3 geometric_normal;
+
+	const material* mat_ptr;
 	double t;
 	double u;
 	double v;
 	bool front_face;
 
+	// World distance covered by a unit step in u or v: the square root of the surface's area per
+	// unit of uv area. Zero for surfaces without a texture mapping.
+	double uv_scale = 0;
+
+	// Width of the ray's footprint at the hit in uv units, which textures filter over. The
+	// integrator sets it before shading; zero asks for the finest detail.
+	double footprint = 0;
+
+	// The material's albedo here when the integrator looked it up ahead of shading, in a batch with
+	// other hits; null to have the material look it up itself.
+	const color* albedo = nullptr;
+
 	inline void set_face_normal(const ray& r, const vec3& outward_normal)
 	{
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
+		geometric_normal = normal;
 	}
+
+	// Sets the normals of a hit carried out of a moved or rotated object space, where they were
+	// shading and geometric. The shading normal stays on the geometric normal's side.
+	inline void set_transformed_normals(const ray& r, const vec3& shading, const vec3& geometric)
+	{
+		set_face_normal(r, geometric);
+		normal = dot(shading, geometric_normal) < 0 ? -shading : shading;
+	}
+};
+
+struct packet_hits
+{
+	uint32_t mask = 0;
+	hit_record rec[max_packet_size];
 };
 
 
@@ -28,6 +62,21 @@ public:
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
 
+	// Intersects the active lanes of a packet, shrinking their t_max and recording hits.
+	// The default traces each lane on its own; coherent primitives override it.
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+	{
+		for (; active; active &= active - 1)
+		{
+			auto lane = lowest_lane(active);
+			if (hit(rays.get(lane), t_min, rays.t_max[lane], hits.rec[lane]))
+			{
+				rays.t_max[lane] = hits.rec[lane].t;
+				hits.mask |= 1u << lane;
+			}
+		}
+	}
+
 	virtual double pdf_value(const vec3& o, const vec3& v) const { return 0.0; }
 	virtual vec3 random(const vec3& o) const { return vec3(1, 0, 0); }
 };
@@ -45,11 +94,28 @@ public:
 		return true;
 	}
 
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override
+	{
+		packet_hits own_hits;
+		ptr->hit_packet(rays, active, t_min, own_hits);
+
+		for (auto lanes = own_hits.mask; lanes; lanes &= lanes - 1)
+		{
+			auto lane = lowest_lane(lanes);
+			hits.rec[lane] = own_hits.rec[lane];
+			hits.rec[lane].front_face = !hits.rec[lane].front_face;
+			hits.mask |= 1u << lane;
+		}
+	}
+
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
 	{
 		return ptr->bounding_box(time0, time1, output_box);
 	}
 
+	virtual double pdf_value(const point3& o, const vec3& v) const override { return ptr->pdf_value(o, v); }
+	virtual vec3 random(const point3& o) const override { return ptr->random(o); }
+
 	shared_ptr<hittable> ptr;
 };
 
@@ -62,6 +128,9 @@ public:
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+	virtual double pdf_value(const point3& o, const vec3& v) const override { return ptr->pdf_value(o - offset, v); }
+	virtual vec3 random(const point3& o) const override { return ptr->random(o - offset); }
+
 	shared_ptr<hittable> ptr;
 	vec3 offset;
 };
@@ -73,7 +142,7 @@ bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) c
 		return false;
 
 	rec.p += offset;
-	rec.set_face_normal(moved_r, rec.normal);
+	rec.set_transformed_normals(moved_r, rec.normal, rec.geometric_normal);
 
 	return true;
 }
@@ -157,6 +226,7 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 
 	auto p = rec.p;
 	auto normal = rec.normal;
+	auto geometric = rec.geometric_normal;
 
 	p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
 	p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
@@ -164,8 +234,11 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 	normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
 	normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
 
+	geometric[0] = cos_theta * rec.geometric_normal[0] + sin_theta * rec.geometric_normal[2];
+	geometric[2] = -sin_theta * rec.geometric_normal[0] + cos_theta * rec.geometric_normal[2];
+
 	rec.p = p;
-	rec.set_face_normal(rotated_r, normal);
+	rec.set_transformed_normals(rotated_r, normal, geometric);
 
 	return true;
 }
\ No newline at end of file
@@ -15,6 +15,7 @@ public:
 	void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 	virtual double pdf_value(const vec3& o, const vec3& v) const override;
@@ -41,6 +42,12 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 	return hit_anything;
 }
 
+void hittable_list::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	for (const auto& object : objects)
+		object->hit_packet(rays, active, t_min, hits);
+}
+
 bool hittable_list::bounding_box(double time0, double time1, aabb& output_box) const
 {
 	if (objects.empty()) return false;
@@ -0,0 +1,55 @@
+#pragma once
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "shared.h"
+#include "framebuffer.h"
+
+// Reference images for the quality harness: render once at a high sample count to .pfm, then
+// measure lower sample count renders, noisy and denoised, against it.
+struct reference_image
+{
+	int width = 0, height = 0;
+	std::vector<float> rgb;
+
+	// Loads a little endian RGB PFM as written by encode_pfm, rows bottom to top like the framebuffer.
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		std::string magic;
+		double scale = 0;
+		if (!(file >> magic >> width >> height >> scale) || magic != "PF" || width < 1 || height < 1 || scale >= 0)
+		{
+			std::cerr << "Could not read '" << path << "'; the reference must be a little endian RGB .pfm.\n";
+			return false;
+		}
+		file.get();
+
+		rgb.resize(static_cast<size_t>(width) * height * 3);
+		if (!file.read(reinterpret_cast<char*>(rgb.data()), static_cast<std::streamsize>(rgb.size() * sizeof(float))))
+		{
+			std::cerr << "'" << path << "' is truncated.\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Relative mean squared error of film's averages, the usual measure for comparing Monte
+	// Carlo renders: each squared error is divided by the squared reference value plus 0.01.
+	double relative_mse(const framebuffer& film) const
+	{
+		double sum = 0;
+		for (size_t p = 0; p < film.pixel_count(); p++)
+		{
+			auto c = film.average(p);
+			for (int a = 0; a < 3; a++)
+			{
+				double ref = rgb[p * 3 + a];
+				sum += (c[a] - ref) * (c[a] - ref) / (ref * ref + 0.01);
+			}
+		}
+		return sum / (film.pixel_count() * 3);
+	}
+};
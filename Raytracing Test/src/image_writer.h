@@ -0,0 +1,329 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "shared.h"
+#include "color.h"
+#include "framebuffer.h"
+
+// Encoders that turn a framebuffer into a complete file image in memory, so output is one bulk write.
+// P6 and PNG are gamma encoded 8 bit; PFM and EXR hold the linear float averages.
+enum class image_format
+{
+	ppm,
+	pfm,
+	png,
+	exr
+};
+
+inline void put_u16_le(std::vector<uint8_t>& out, uint32_t v)
+{
+	out.push_back(static_cast<uint8_t>(v));
+	out.push_back(static_cast<uint8_t>(v >> 8));
+}
+
+inline void put_u32_le(std::vector<uint8_t>& out, uint32_t v)
+{
+	for (int b = 0; b < 4; b++) out.push_back(static_cast<uint8_t>(v >> (8 * b)));
+}
+
+inline void put_u64_le(std::vector<uint8_t>& out, uint64_t v)
+{
+	for (int b = 0; b < 8; b++) out.push_back(static_cast<uint8_t>(v >> (8 * b)));
+}
+
+inline void put_u32_be(std::vector<uint8_t>& out, uint32_t v)
+{
+	for (int b = 3; b >= 0; b--) out.push_back(static_cast<uint8_t>(v >> (8 * b)));
+}
+
+inline void put_f32_le(std::vector<uint8_t>& out, float f)
+{
+	uint32_t v;
+	std::memcpy(&v, &f, sizeof(v));
+	put_u32_le(out, v);
+}
+
+inline void put_string(std::vector<uint8_t>& out, const std::string& s, bool terminate = false)
+{
+	out.insert(out.end(), s.begin(), s.end());
+	if (terminate) out.push_back(0);
+}
+
+inline bool image_format_from_path(const std::string& path, image_format& format)
+{
+	auto dot = path.find_last_of('.');
+	auto ext = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+	for (auto& c : ext) c = static_cast<char>(tolower(c));
+
+	if (ext == "ppm") format = image_format::ppm;
+	else if (ext == "pfm") format = image_format::pfm;
+	else if (ext == "png") format = image_format::png;
+	else if (ext == "exr") format = image_format::exr;
+	else return false;
+	return true;
+}
+
+// Display row y counts down from the top of the image; the framebuffer stores rows bottom up.
+inline size_t display_pixel(const framebuffer& film, int x, int y)
+{
+	return film.index(x, film.height() - 1 - y);
+}
+
+void encode_ppm(const framebuffer& film, std::vector<uint8_t>& out)
+{
+	put_string(out, "P6\n" + std::to_string(film.width()) + ' ' + std::to_string(film.height()) + "\n255\n");
+	out.reserve(out.size() + film.pixel_count() * 3);
+	for (int y = 0; y < film.height(); y++)
+		for (int x = 0; x < film.width(); x++)
+		{
+			auto c = film.average(display_pixel(film, x, y));
+			out.push_back(to_byte(c.x()));
+			out.push_back(to_byte(c.y()));
+			out.push_back(to_byte(c.z()));
+		}
+}
+
+void encode_pfm(const framebuffer& film, std::vector<uint8_t>& out)
+{
+	// A negative scale marks little endian data; PFM rows run bottom to top like the framebuffer.
+	put_string(out, "PF\n" + std::to_string(film.width()) + ' ' + std::to_string(film.height()) + "\n-1.0\n");
+	out.reserve(out.size() + film.pixel_count() * 12);
+	for (size_t p = 0; p < film.pixel_count(); p++)
+	{
+		auto c = film.average(p);
+		put_f32_le(out, static_cast<float>(c.x()));
+		put_f32_le(out, static_cast<float>(c.y()));
+		put_f32_le(out, static_cast<float>(c.z()));
+	}
+}
+
+inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+	static const auto table = [] {
+		std::vector<uint32_t> t(256);
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			t[n] = c;
+		}
+		return t;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline void put_png_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+	put_u32_be(out, static_cast<uint32_t>(data.size()));
+	auto start = out.size();
+	put_string(out, type);
+	out.insert(out.end(), data.begin(), data.end());
+	put_u32_be(out, crc32(out.data() + start, out.size() - start));
+}
+
+// Only stb_image (the reader) is vendored, so PNGs are written directly: 8 bit RGB with the
+// pixel data in stored (uncompressed) deflate blocks, which every PNG reader accepts.
+void encode_png(const framebuffer& film, std::vector<uint8_t>& out)
+{
+	const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	out.insert(out.end(), signature, signature + sizeof(signature));
+
+	std::vector<uint8_t> header;
+	put_u32_be(header, film.width());
+	put_u32_be(header, film.height());
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });
+	put_png_chunk(out, "IHDR", header);
+
+	// Every scanline starts with filter type 0 (none).
+	std::vector<uint8_t> raw;
+	raw.reserve(film.pixel_count() * 3 + film.height());
+	for (int y = 0; y < film.height(); y++)
+	{
+		raw.push_back(0);
+		for (int x = 0; x < film.width(); x++)
+		{
+			auto c = film.average(display_pixel(film, x, y));
+			raw.push_back(to_byte(c.x()));
+			raw.push_back(to_byte(c.y()));
+			raw.push_back(to_byte(c.z()));
+		}
+	}
+
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	uint32_t adler_a = 1, adler_b = 0;
+	for (size_t pos = 0; pos < raw.size(); )
+	{
+		auto block = std::min<size_t>(65535, raw.size() - pos);
+		zlib.push_back(pos + block == raw.size() ? 1 : 0);
+		put_u16_le(zlib, static_cast<uint32_t>(block));
+		put_u16_le(zlib, static_cast<uint32_t>(~block & 0xffff));
+		zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + block);
+
+		for (size_t i = pos; i < pos + block; i++)
+		{
+			adler_a = (adler_a + raw[i]) % 65521;
+			adler_b = (adler_b + adler_a) % 65521;
+		}
+		pos += block;
+	}
+	put_u32_be(zlib, (adler_b << 16) | adler_a);
+
+	put_png_chunk(out, "IDAT", zlib);
+	put_png_chunk(out, "IEND", {});
+}
+
+// Single part scanline OpenEXR with uncompressed 32 bit float B, G and R channels.
+void encode_exr(const framebuffer& film, std::vector<uint8_t>& out)
+{
+	auto attribute = [&](const char* name, const char* type, const std::vector<uint8_t>& value) {
+		put_string(out, name, true);
+		put_string(out, type, true);
+		put_u32_le(out, static_cast<uint32_t>(value.size()));
+		out.insert(out.end(), value.begin(), value.end());
+	};
+
+	put_u32_le(out, 20000630);
+	put_u32_le(out, 2);
+
+	std::vector<uint8_t> channels;
+	for (const char* name : { "B", "G", "R" })
+	{
+		put_string(channels, name, true);
+		put_u32_le(channels, 2);
+		put_u32_le(channels, 0);
+		put_u32_le(channels, 1);
+		put_u32_le(channels, 1);
+	}
+	channels.push_back(0);
+	attribute("channels", "chlist", channels);
+	attribute("compression", "compression", { 0 });
+
+	std::vector<uint8_t> window;
+	put_u32_le(window, 0);
+	put_u32_le(window, 0);
+	put_u32_le(window, film.width() - 1);
+	put_u32_le(window, film.height() - 1);
+	attribute("dataWindow", "box2i", window);
+	attribute("displayWindow", "box2i", window);
+	attribute("lineOrder", "lineOrder", { 0 });
+
+	std::vector<uint8_t> value;
+	put_f32_le(value, 1.0f);
+	attribute("pixelAspectRatio", "float", value);
+	attribute("screenWindowWidth", "float", value);
+	value.clear();
+	put_f32_le(value, 0.0f);
+	put_f32_le(value, 0.0f);
+	attribute("screenWindowCenter", "v2f", value);
+	out.push_back(0);
+
+	// Offset table, then one block per scanline: y, byte count, and the row of each channel in turn.
+	auto row_bytes = static_cast<uint64_t>(film.width()) * 3 * 4;
+	auto first_block = out.size() + static_cast<uint64_t>(film.height()) * 8;
+	for (int y = 0; y < film.height(); y++)
+		put_u64_le(out, first_block + y * (row_bytes + 8));
+
+	out.reserve(out.size() + film.height() * (row_bytes + 8));
+	for (int y = 0; y < film.height(); y++)
+	{
+		put_u32_le(out, y);
+		put_u32_le(out, static_cast<uint32_t>(row_bytes));
+		for (int channel = 2; channel >= 0; channel--)
+			for (int x = 0; x < film.width(); x++)
+				put_f32_le(out, static_cast<float>(film.average(display_pixel(film, x, y))[channel]));
+	}
+}
+
+void encode_image(const framebuffer& film, image_format format, std::vector<uint8_t>& out)
+{
+	switch (format)
+	{
+	case image_format::ppm: encode_ppm(film, out); break;
+	case image_format::pfm: encode_pfm(film, out); break;
+	case image_format::png: encode_png(film, out); break;
+	case image_format::exr: encode_exr(film, out); break;
+	}
+}
+
+bool write_image(std::ostream& out, const framebuffer& film, image_format format)
+{
+	std::vector<uint8_t> bytes;
+	encode_image(film, format, bytes);
+	out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	out.flush();
+	return static_cast<bool>(out);
+}
+
+// Writes the framebuffer to path in the format named by its extension.
+bool write_image(const std::string& path, const framebuffer& film)
+{
+	image_format format;
+	if (!image_format_from_path(path, format))
+	{
+		std::cerr << "Unknown image format for '" << path << "'; use .ppm, .pfm, .png or .exr.\n";
+		return false;
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file || !write_image(file, film, format))
+	{
+		std::cerr << "Could not write '" << path << "'.\n";
+		return false;
+	}
+	return true;
+}
+
+// Writes a map of one value per pixel, such as render cost, held in the first channel of values.
+// PFM and EXR keep the values themselves in every channel; PPM and PNG show them as heat colors
+// from black through red and yellow to white, scaled so the 99th percentile is white.
+bool write_heatmap(const std::string& path, const framebuffer& values)
+{
+	image_format format;
+	if (!image_format_from_path(path, format))
+	{
+		std::cerr << "Unknown image format for '" << path << "'; use .ppm, .pfm, .png or .exr.\n";
+		return false;
+	}
+
+	framebuffer map(values.width(), values.height());
+	std::vector<double> sorted;
+	for (size_t p = 0; p < values.pixel_count(); p++)
+		sorted.push_back(values.average(p).x());
+	std::sort(sorted.begin(), sorted.end());
+	auto scale = sorted.empty() ? 0.0 : sorted[sorted.size() * 99 / 100];
+
+	for (size_t p = 0; p < values.pixel_count(); p++)
+	{
+		auto value = values.average(p).x();
+		if (format == image_format::pfm || format == image_format::exr)
+		{
+			map.add(p, color(value, value, value), 0, 1);
+			continue;
+		}
+
+		// Squared, so the gamma encoding of 8 bit formats leaves the ramp linear on screen.
+		auto x = scale > 0 ? clamp(value / scale, 0.0, 1.0) * 3 : 0.0;
+		auto heat = color(clamp(x, 0.0, 1.0), clamp(x - 1, 0.0, 1.0), clamp(x - 2, 0.0, 1.0));
+		map.add(p, heat * heat, 0, 1);
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file || !write_image(file, map, format))
+	{
+		std::cerr << "Could not write '" << path << "'.\n";
+		return false;
+	}
+	return true;
+}
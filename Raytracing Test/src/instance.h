@@ -0,0 +1,100 @@
+#pragma once
+#include <iostream>
+
+#include "shared.h"
+#include "hittable.h"
+#include "transform.h"
+
+// Carries a hit found on an object space ray back to world space. The ray's t and the side it
+// arrived on survive any affine transform; the normals need the inverse transpose, and the
+// texture scale grows by the transform's average stretch.
+inline void instance_hit_to_world(const affine_transform& to_world, const affine_transform& to_object, hit_record& rec)
+{
+	rec.p = to_world.point(rec.p);
+	rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+	rec.geometric_normal = unit_vector(to_object.transposed_vector(rec.geometric_normal));
+	rec.uv_scale *= cbrt(fabs(to_world.determinant()));
+}
+
+// An object placed in the world by an affine transform, whose inverse is computed once here so a
+// ray is transformed into object space once per instance. The object is usually a linear_bvh
+// shared by every instance of the same geometry: that is the bottom level of a two level
+// structure, and the BVH the instances are compiled into is the top level.
+class instance : public hittable
+{
+public:
+	instance(shared_ptr<hittable> p, const affine_transform& transform);
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+	{
+		output_box = bbox;
+		return hasbox;
+	}
+
+	shared_ptr<hittable> ptr;
+	affine_transform to_world;
+	affine_transform to_object;
+	bool hasbox;
+	aabb bbox;
+};
+
+inline instance::instance(shared_ptr<hittable> p, const affine_transform& transform) : ptr(p), to_world(transform)
+{
+	hasbox = ptr->bounding_box(0, 1, bbox);
+	if (!to_world.inverse(to_object))
+	{
+		std::cerr << "Instance transform is singular; the instance is left out.\n";
+		hasbox = false;
+	}
+	bbox = to_world.box(bbox);
+}
+
+bool instance::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	if (!hasbox || !ptr->hit(to_object.apply(r), t_min, t_max, rec))
+		return false;
+
+	instance_hit_to_world(to_world, to_object, rec);
+	return true;
+}
+
+// Transforms every lane of a packet into the object space of to_object, for any lane count.
+inline void transform_packet(const affine_transform& to_object, const ray_packet& rays, ray_packet& local)
+{
+	const auto& m = to_object.m;
+	local.size = rays.size;
+	for (int k = 0; k < max_packet_size; k++)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			local.org[a][k] = m[a][0] * rays.org[0][k] + m[a][1] * rays.org[1][k] + m[a][2] * rays.org[2][k] + m[a][3];
+			local.dir[a][k] = m[a][0] * rays.dir[0][k] + m[a][1] * rays.dir[1][k] + m[a][2] * rays.dir[2][k];
+			local.inv_dir[a][k] = 1.0 / local.dir[a][k];
+		}
+		local.time[k] = rays.time[k];
+		local.t_max[k] = rays.t_max[k];
+	}
+}
+
+void instance::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	if (!hasbox) return;
+
+	ray_packet local;
+	transform_packet(to_object, rays, local);
+
+	packet_hits own_hits;
+	ptr->hit_packet(local, active, t_min, own_hits);
+
+	for (auto lanes = own_hits.mask; lanes; lanes &= lanes - 1)
+	{
+		auto lane = lowest_lane(lanes);
+		hits.rec[lane] = own_hits.rec[lane];
+		instance_hit_to_world(to_world, to_object, hits.rec[lane]);
+		rays.t_max[lane] = local.t_max[lane];
+		hits.mask |= 1u << lane;
+	}
+}
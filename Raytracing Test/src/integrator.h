@@ -0,0 +1,210 @@
+#pragma once
+#include "shared.h"
+#include "feature_buffer.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "lights.h"
+#include "material.h"
+#include "pdf.h"
+#include "stats.h"
+
+// One vertex of a path that is advanced a bounce at a time instead of by recursion.
+struct path_state
+{
+	ray r;
+	color throughput;
+	color radiance;
+	int depth;
+	// Solid angle pdf the last diffuse bounce sampled r with; camera rays and specular bounces
+	// have no pdf to weigh against light sampling, so they see emission at full weight.
+	double bsdf_pdf;
+	bool specular;
+	// The ray cone around r: its width where r starts and how fast it widens, in radians.
+	double cone_width;
+	double cone_spread;
+	path_features first_hit;
+};
+
+// A diffuse bounce scatters over the whole hemisphere, so what its rays see is blurred anyway;
+// their cones widen by at least this many radians, so textures are read from coarse levels.
+constexpr double diffuse_cone_spread = 0.1;
+
+// Grazing hits stretch the footprint without bound; it is cut off at ten times its width.
+constexpr double min_cone_cosine = 0.1;
+
+// Ray cones (Akenine-Moller et al.): the width of the cone around r where it lands at rec...
+inline double cone_width_at(const ray& r, const hit_record& rec, double cone_width, double cone_spread)
+{
+	return cone_width + cone_spread * rec.t * r.direction().length();
+}
+
+// ...and that width foreshortened by the angle r arrives at and measured in uv, the footprint
+// textures at rec are filtered over.
+inline double cone_footprint(const ray& r, const hit_record& rec, double width)
+{
+	auto cosine = fabs(dot(rec.normal, r.direction())) / r.direction().length();
+	return rec.uv_scale > 0 ? width / (rec.uv_scale * fmax(cosine, min_cone_cosine)) : 0;
+}
+
+// Power heuristic (beta = 2) weight of a sample drawn with pdf f against another strategy with pdf g.
+inline double power_heuristic(double f, double g)
+{
+	return f * f / (f * f + g * g);
+}
+
+// Russian roulette: ends the path with a probability that grows as its throughput falls, and
+// scales the survivors up by the same amount, so the estimate stays unbiased.
+inline bool survive_roulette(path_state& path)
+{
+	auto q = fmax(path.throughput.x(), fmax(path.throughput.y(), path.throughput.z()));
+	if (q >= 1)
+		return true;
+	if (q <= 0 || random_double() >= q)
+		return false;
+	path.throughput /= q;
+	return true;
+}
+
+// Direct light at a diffuse vertex by next-event estimation: one shadow ray towards a point
+// sampled on the lights, weighted against the chance that BSDF sampling finds the same light.
+inline color sample_direct(const ray& r_in, const hit_record& rec, const scatter_record& srec, const hittable& world,
+	const light_set& lights)
+{
+	if (lights.empty())
+		return color(0, 0, 0);
+
+	ray shadow = spawn_ray(rec.p, rec.geometric_normal, lights.random(rec.p), r_in.time());
+	auto light_pdf_val = lights.pdf_value(rec.p, shadow.direction());
+	auto bsdf = rec.mat_ptr->scattering_pdf(r_in, rec, shadow);
+	if (light_pdf_val <= 0 || bsdf <= 0)
+		return color(0, 0, 0);
+
+	hit_record light_rec;
+	count_ray(ray_kind::shadow);
+	if (!world.hit(shadow, 0, infinity, light_rec))
+		return color(0, 0, 0);
+	color emitted = light_rec.mat_ptr->emitted(shadow, light_rec, light_rec.u, light_rec.v, light_rec.p);
+	if (emitted.near_zero())
+		return color(0, 0, 0);
+
+	auto weight = power_heuristic(light_pdf_val, srec.pdf_ptr()->value(shadow.direction()));
+	return srec.attenuation * emitted * (bsdf * weight / light_pdf_val);
+}
+
+// Adds the emission at rec and the direct light it receives to the path, then replaces its ray
+// with one sampled from the BSDF. On the first bounce it also records the surface's features
+// for the denoiser.
+// Returns false once the path is absorbed, has reached max_depth bounces, or loses the
+// Russian roulette that starts after rr_depth bounces.
+inline bool shade_path(path_state& path, hit_record& rec, const hittable& world, const light_set& lights,
+	int max_depth, int rr_depth)
+{
+	path.cone_width = cone_width_at(path.r, rec, path.cone_width, path.cone_spread);
+	rec.footprint = cone_footprint(path.r, rec, path.cone_width);
+	count_material_hit(static_cast<int>(rec.mat_ptr->kind()));
+
+	scatter_record srec;
+	color emitted = rec.mat_ptr->emitted(path.r, rec, rec.u, rec.v, rec.p);
+	if (path.specular || emitted.near_zero())
+		path.radiance += path.throughput * emitted;
+	else
+	{
+		// Next-event estimation at the previous vertex could also have found this light.
+		auto light_pdf_val = lights.pdf_value(path.r.origin(), path.r.direction());
+		path.radiance += path.throughput * emitted * power_heuristic(path.bsdf_pdf, light_pdf_val);
+	}
+
+	bool scatters = rec.mat_ptr->scatter(path.r, rec, srec);
+	if (path.depth == 0)
+	{
+		// Lights have no albedo; their clamped emission keeps them distinct from the surfaces around them.
+		path.first_hit.albedo = scatters ? srec.attenuation
+			: color(fmin(emitted.x(), 1.0), fmin(emitted.y(), 1.0), fmin(emitted.z(), 1.0));
+		path.first_hit.normal = rec.normal;
+		path.first_hit.depth = rec.t * path.r.direction().length();
+	}
+
+	if (!scatters)
+	{
+		count_path_end(path_end::absorbed, path.depth);
+		return false;
+	}
+
+	if (srec.is_specular)
+	{
+		path.throughput = path.throughput * srec.attenuation;
+		path.r = srec.specular_ray;
+		path.specular = true;
+	}
+	else
+	{
+		path.radiance += path.throughput * sample_direct(path.r, rec, srec, world, lights);
+
+		const pdf& bsdf_pdf = *srec.pdf_ptr();
+		ray scattered = spawn_ray(rec.p, rec.geometric_normal, bsdf_pdf.generate(), path.r.time());
+		auto pdf_val = bsdf_pdf.value(scattered.direction());
+		if (pdf_val <= 0)
+		{
+			count_path_end(path_end::absorbed, path.depth);
+			return false;
+		}
+
+		path.throughput = path.throughput * srec.attenuation * rec.mat_ptr->scattering_pdf(path.r, rec, scattered) / pdf_val;
+		path.r = scattered;
+		path.bsdf_pdf = pdf_val;
+		path.specular = false;
+		path.cone_spread = fmax(path.cone_spread, diffuse_cone_spread);
+	}
+
+	if (++path.depth >= max_depth)
+	{
+		count_path_end(path_end::max_depth, path.depth);
+		return false;
+	}
+	if (path.depth < rr_depth || survive_roulette(path))
+		return true;
+	count_path_end(path_end::roulette, path.depth);
+	return false;
+}
+
+// Follows the path bounce by bounce until it escapes to the background or ends.
+inline void trace_path(path_state& path, const color& background, const hittable& world, const light_set& lights,
+	int max_depth, int rr_depth)
+{
+	hit_record rec;
+	for (;;)
+	{
+		count_ray(path.depth == 0 ? ray_kind::camera : ray_kind::bounce);
+		if (!world.hit(path.r, 0, infinity, rec))
+			break;
+		if (!shade_path(path, rec, world, lights, max_depth, rr_depth))
+			return;
+	}
+	count_path_end(path_end::escaped, path.depth);
+	if (path.depth == 0)
+		path.first_hit.albedo = background;
+	path.radiance += path.throughput * background;
+}
+
+// Radiance along r, a camera ray whose cone widens by pixel_spread radians. The features of its
+// first hit go to features when that is given.
+color ray_color(const ray& r, const color& background, const hittable& world, const light_set& lights,
+	int max_depth, int rr_depth, double pixel_spread, path_features* features = nullptr)
+{
+	path_state path{ r, color(1, 1, 1), color(0, 0, 0), 0, 0, true, 0, pixel_spread, {} };
+	trace_path(path, background, world, lights, max_depth, rr_depth);
+	if (features) *features = path.first_hit;
+	return path.radiance;
+}
+
+// Radiance along r given its first hit rec, which has already been found.
+color shade(const ray& r, const hit_record& rec, const color& background, const hittable& world, const light_set& lights,
+	int max_depth, int rr_depth, double pixel_spread, path_features* features = nullptr)
+{
+	path_state path{ r, color(1, 1, 1), color(0, 0, 0), 0, 0, true, 0, pixel_spread, {} };
+	hit_record first = rec;
+	if (shade_path(path, first, world, lights, max_depth, rr_depth))
+		trace_path(path, background, world, lights, max_depth, rr_depth);
+	if (features) *features = path.first_hit;
+	return path.radiance;
+}
@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "shared.h"
+#include "aarect.h"
+#include "bvh_builder.h"
+#include "color.h"
+#include "hittable.h"
+#include "material.h"
+#include "sphere.h"
+
+// Walker's alias method, built with Vose's algorithm: draws index i with probability
+// weights[i] / sum(weights) in constant time. All zero weights fall back to uniform.
+class alias_table
+{
+public:
+	alias_table() {}
+	alias_table(const std::vector<double>& weights);
+
+	size_t size() const { return probability.size(); }
+	double pmf(size_t i) const { return pmfs[i]; }
+
+	// One uniform number picks the column and, from its fraction, between the column and its alias.
+	size_t sample(double u) const
+	{
+		auto scaled = u * size();
+		auto column = std::min(static_cast<size_t>(scaled), size() - 1);
+		return scaled - column < probability[column] ? column : alias[column];
+	}
+
+private:
+	std::vector<double> probability, pmfs;
+	std::vector<uint32_t> alias;
+};
+
+inline alias_table::alias_table(const std::vector<double>& weights)
+	: probability(weights.size(), 1.0), pmfs(weights.size()), alias(weights.size())
+{
+	auto n = weights.size();
+	double sum = 0;
+	for (auto w : weights) sum += w;
+
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++)
+	{
+		pmfs[i] = sum > 0 ? weights[i] / sum : 1.0 / n;
+		scaled[i] = pmfs[i] * n;
+		alias[i] = static_cast<uint32_t>(i);
+		(scaled[i] < 1 ? small : large).push_back(static_cast<uint32_t>(i));
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		auto s = small.back(); small.pop_back();
+		auto l = large.back(); large.pop_back();
+		probability[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] += scaled[s] - 1;
+		(scaled[l] < 1 ? small : large).push_back(l);
+	}
+	// Whatever is left is 1 up to rounding and keeps its own column.
+}
+
+// The emitters of a scene, for next-event estimation. A light is picked with probability
+// proportional to its emitted power (radiance times area) from an alias table, then sampled
+// by its own shape. The pdf of a direction sums only over the lights the ray can reach: small
+// sets test each light's bounds, larger ones find the candidates through a BVH over the lights.
+class light_set
+{
+public:
+	light_set(const std::vector<shared_ptr<hittable>>& emitters, double time0, double time1);
+
+	bool empty() const { return lights.empty(); }
+	size_t size() const { return lights.size(); }
+
+	double pdf_value(const point3& o, const vec3& v) const;
+	vec3 random(const point3& o) const;
+
+	// Sets of more lights than this are searched through a BVH instead of one by one.
+	static constexpr size_t bvh_threshold = 16;
+
+private:
+	static bool sample_shape(const hittable* object, double& area, const material*& mat);
+	static bool box_hit(const float* bounds_min, const float* bounds_max, const point3& o, const vec3& inv_dir);
+
+	std::vector<shared_ptr<hittable>> lights;
+	std::vector<aabb> boxes;
+	std::vector<float> box_bounds;
+	alias_table table;
+	std::vector<bvh_linear_node> nodes;
+	std::vector<uint32_t> prim_indices;
+};
+
+// Lights need a shape that can sample directions towards itself: spheres and rects, possibly
+// flipped or translated. Reports the shape's area and material.
+inline bool light_set::sample_shape(const hittable* object, double& area, const material*& mat)
+{
+	if (auto f = dynamic_cast<const flip_face*>(object)) return sample_shape(f->ptr.get(), area, mat);
+	if (auto t = dynamic_cast<const translate*>(object)) return sample_shape(t->ptr.get(), area, mat);
+	if (auto s = dynamic_cast<const sphere*>(object))
+	{
+		area = 4 * pi * s->radius * s->radius;
+		mat = s->mat_ptr.get();
+	}
+	else if (auto rect = dynamic_cast<const xy_rect*>(object))
+	{
+		area = (rect->x1 - rect->x0) * (rect->y1 - rect->y0);
+		mat = rect->mp.get();
+	}
+	else if (auto rect = dynamic_cast<const xz_rect*>(object))
+	{
+		area = (rect->x1 - rect->x0) * (rect->z1 - rect->z0);
+		mat = rect->mp.get();
+	}
+	else if (auto rect = dynamic_cast<const yz_rect*>(object))
+	{
+		area = (rect->y1 - rect->y0) * (rect->z1 - rect->z0);
+		mat = rect->mp.get();
+	}
+	else return false;
+	return true;
+}
+
+inline light_set::light_set(const std::vector<shared_ptr<hittable>>& emitters, double time0, double time1)
+{
+	std::vector<double> power;
+	for (const auto& object : emitters)
+	{
+		double area;
+		const material* mat = nullptr;
+		aabb box;
+		if (!sample_shape(object.get(), area, mat) || !mat || !object->bounding_box(time0, time1, box))
+		{
+			std::cerr << "Skipping an emitter whose shape cannot be sampled; it is only found by chance.\n";
+			continue;
+		}
+
+		// Emitted radiance at the center of the light, seen from the side it shines towards.
+		hit_record rec;
+		rec.front_face = true;
+		rec.p = 0.5 * (box.min() + box.max());
+		auto radiance = luminance(mat->emitted(ray(), rec, 0.5, 0.5, rec.p));
+
+		lights.push_back(object);
+		boxes.push_back(box);
+		power.push_back(radiance * area);
+	}
+
+	table = alias_table(power);
+	if (lights.size() > bvh_threshold)
+		bvh_builder(bvh_build_options()).build(boxes, nodes, prim_indices);
+	else
+		for (const auto& box : boxes)
+			for (int a = 0; a < 6; a++)
+				box_bounds.push_back(a < 3 ? round_down(box.min()[a]) : round_up(box.max()[a - 3]));
+}
+
+inline bool light_set::box_hit(const float* bounds_min, const float* bounds_max, const point3& o, const vec3& inv_dir)
+{
+	double t_min = 0, t_max = infinity;
+	for (int a = 0; a < 3; a++)
+	{
+		auto t0 = (bounds_min[a] - o[a]) * inv_dir[a];
+		auto t1 = (bounds_max[a] - o[a]) * inv_dir[a];
+		if (inv_dir[a] < 0.0) std::swap(t0, t1);
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if (t_max < t_min) return false;
+	}
+	return true;
+}
+
+inline double light_set::pdf_value(const point3& o, const vec3& v) const
+{
+	const vec3 inv_dir(1.0 / v.x(), 1.0 / v.y(), 1.0 / v.z());
+	double sum = 0;
+
+	if (nodes.empty())
+	{
+		for (size_t i = 0; i < lights.size(); i++)
+			if (box_hit(&box_bounds[i * 6], &box_bounds[i * 6 + 3], o, inv_dir))
+				sum += table.pmf(i) * lights[i]->pdf_value(o, v);
+		return sum;
+	}
+
+	// Every light along the ray counts, not just the nearest, so all overlapping leaves are visited.
+	uint32_t stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0)
+	{
+		const auto& node = nodes[stack[--stack_size]];
+		if (!box_hit(node.bounds_min, node.bounds_max, o, inv_dir))
+			continue;
+
+		if (node.prim_count > 0)
+		{
+			for (uint32_t k = 0; k < node.prim_count; k++)
+			{
+				auto i = prim_indices[node.offset + k];
+				sum += table.pmf(i) * lights[i]->pdf_value(o, v);
+			}
+		}
+		else
+		{
+			stack[stack_size++] = node.offset;
+			stack[stack_size++] = static_cast<uint32_t>(&node - nodes.data()) + 1;
+		}
+	}
+	return sum;
+}
+
+inline vec3 light_set::random(const point3& o) const
+{
+	return lights[table.sample(random_double())]->random(o);
+}
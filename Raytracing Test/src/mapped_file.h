@@ -0,0 +1,173 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A file mapped read/write into memory. Writes through data() reach the file when flush()
+// returns or the mapping is closed, so the file survives the process being killed.
+// Files opened read only are mapped without write access and never flushed.
+class mapped_file
+{
+public:
+	mapped_file() {}
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// Maps an existing file at its current size.
+	bool open(const std::string& path, bool read_only = false);
+
+	// Creates or truncates the file to size bytes of zeros and maps it.
+	bool create(const std::string& path, size_t size);
+
+	void flush();
+	void close();
+
+	bool is_open() const { return base != nullptr; }
+	uint8_t* data() const { return base; }
+	size_t size() const { return length; }
+
+private:
+	bool map(const std::string& path, size_t size, bool create_file, bool read_only);
+
+	uint8_t* base = nullptr;
+	size_t length = 0;
+	bool writable = false;
+
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+inline bool mapped_file::open(const std::string& path, bool read_only)
+{
+	return map(path, 0, false, read_only);
+}
+
+inline bool mapped_file::create(const std::string& path, size_t size)
+{
+	return map(path, size, true, false);
+}
+
+#if defined(_WIN32)
+
+inline bool mapped_file::map(const std::string& path, size_t size, bool create_file, bool read_only)
+{
+	close();
+
+	file = CreateFileA(path.c_str(), read_only ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+		create_file ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	if (!create_file)
+	{
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size)) { close(); return false; }
+		size = static_cast<size_t>(file_size.QuadPart);
+	}
+	if (size == 0) { close(); return false; }
+
+	auto size64 = static_cast<uint64_t>(size);
+	mapping = CreateFileMappingA(file, nullptr, read_only ? PAGE_READONLY : PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+		static_cast<DWORD>(size64 & 0xffffffffu), nullptr);
+	if (!mapping) { close(); return false; }
+
+	base = static_cast<uint8_t*>(MapViewOfFile(mapping, read_only ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, 0, 0, size));
+	if (!base) { close(); return false; }
+
+	length = size;
+	writable = !read_only;
+	return true;
+}
+
+inline void mapped_file::flush()
+{
+	if (!base || !writable) return;
+	FlushViewOfFile(base, length);
+	FlushFileBuffers(file);
+}
+
+inline void mapped_file::close()
+{
+	if (base)
+	{
+		if (writable) FlushViewOfFile(base, length);
+		UnmapViewOfFile(base);
+	}
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+
+	base = nullptr;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+	length = 0;
+	writable = false;
+}
+
+#else
+
+inline bool mapped_file::map(const std::string& path, size_t size, bool create_file, bool read_only)
+{
+	close();
+
+	fd = ::open(path.c_str(), create_file ? (O_RDWR | O_CREAT | O_TRUNC) : read_only ? O_RDONLY : O_RDWR, 0644);
+	if (fd < 0) return false;
+
+	if (create_file)
+	{
+		if (ftruncate(fd, static_cast<off_t>(size)) != 0) { close(); return false; }
+	}
+	else
+	{
+		struct stat st;
+		if (fstat(fd, &st) != 0) { close(); return false; }
+		size = static_cast<size_t>(st.st_size);
+	}
+	if (size == 0) { close(); return false; }
+
+	void* address = mmap(nullptr, size, read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED) { close(); return false; }
+
+	base = static_cast<uint8_t*>(address);
+	length = size;
+	writable = !read_only;
+	return true;
+}
+
+inline void mapped_file::flush()
+{
+	if (base && writable) msync(base, length, MS_SYNC);
+}
+
+inline void mapped_file::close()
+{
+	if (base)
+	{
+		if (writable) msync(base, length, MS_SYNC);
+		munmap(base, length);
+	}
+	if (fd >= 0) ::close(fd);
+
+	base = nullptr;
+	fd = -1;
+	length = 0;
+	writable = false;
+}
+
+#endif
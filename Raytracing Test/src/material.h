@@ -1,4 +1,6 @@
 #pragma once
+#include <variant>
+
 #include "shared.h"
 #include "pdf.h"
 #include "texture.h"
@@ -8,9 +10,40 @@ struct scatter_record
 	ray specular_ray;
 	bool is_specular;
 	color attenuation;
-	shared_ptr<pdf> pdf_ptr;
+
+	// The scattering pdf is held by value so a bounce never allocates. Specular scatters leave it empty.
+	std::variant<std::monostate, cosine_pdf> scatter_pdf;
+
+	const pdf* pdf_ptr() const { return std::get_if<cosine_pdf>(&scatter_pdf); }
 };
 
+// Coarse material families, used to batch shading work of the same kind together.
+enum class material_kind
+{
+	other,
+	lambertian,
+	metal,
+	dielectric,
+	diffuse_light,
+	isotropic
+};
+
+inline const char* material_kind_name(material_kind kind)
+{
+	switch (kind)
+	{
+	case material_kind::other: return "other";
+	case material_kind::lambertian: return "lambertian";
+	case material_kind::metal: return "metal";
+	case material_kind::dielectric: return "dielectric";
+	case material_kind::diffuse_light: return "diffuse_light";
+	case material_kind::isotropic: return "isotropic";
+	}
+	return "unknown";
+}
+
+const int material_kind_count = static_cast<int>(material_kind::isotropic) + 1;
+
 class material
 {
 public:
@@ -21,6 +54,12 @@ public:
 
 	virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const { return false; }
 
+	virtual material_kind kind() const { return material_kind::other; }
+
+	// The texture scatter reads the attenuation from, for materials whose attenuation is exactly
+	// that texture's value, so an integrator can look it up for many hits at once.
+	virtual const texture* albedo_texture() const { return nullptr; }
+
 	virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const
 	{
 		return 0;
@@ -33,11 +72,14 @@ public:
 	lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
 	lambertian(shared_ptr<texture> a) : albedo(a) {}
 
+	virtual material_kind kind() const override { return material_kind::lambertian; }
+	virtual const texture* albedo_texture() const override { return albedo.get(); }
+
 	virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 	{
 		srec.is_specular = false;
-		srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-		srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+		srec.attenuation = rec.albedo ? *rec.albedo : albedo->filtered_value(rec.u, rec.v, rec.footprint, rec.p);
+		srec.scatter_pdf = cosine_pdf(rec.normal);
 		return true;
 	}
 
@@ -55,13 +97,15 @@ class metal : public material
 public:
 	metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
+	virtual material_kind kind() const override { return material_kind::metal; }
+
 	virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 	{
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		srec.specular_ray = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
+		srec.specular_ray = spawn_ray(rec.p, rec.geometric_normal, reflected + fuzz * random_in_unit_sphere(), r_in.time());
 		srec.attenuation = albedo;
 		srec.is_specular = true;
-		srec.pdf_ptr = nullptr;
+		srec.scatter_pdf = std::monostate();
 		return true;
 	}
 
@@ -74,10 +118,12 @@ class dielectric : public material
 public:
 	dielectric(double index_of_refraction) : ior(index_of_refraction) {}
 
+	virtual material_kind kind() const override { return material_kind::dielectric; }
+
 	virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 	{
 		srec.is_specular = true;
-		srec.pdf_ptr = nullptr;
+		srec.scatter_pdf = std::monostate();
 		srec.attenuation = color(1.0, 1.0, 1.0);
 		double refraction_ratio = rec.front_face ? (1.0 / ior) : ior;
 
@@ -92,7 +138,7 @@ public:
 			direction = reflect(unit_direction, rec.normal);
 		else direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-		srec.specular_ray = ray(rec.p, direction, r_in.time());
+		srec.specular_ray = spawn_ray(rec.p, rec.geometric_normal, direction, r_in.time());
 		return true;
 	}
 
@@ -113,10 +159,12 @@ public:
 	diffuse_light(shared_ptr<texture> a) : emit(a) {}
 	diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
 
+	virtual material_kind kind() const override { return material_kind::diffuse_light; }
+
 	virtual color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override
 	{
 		if (!rec.front_face) return color(0, 0, 0);
-		return emit->value(u, v, p);
+		return emit->filtered_value(u, v, rec.footprint, p);
 	}
 
 	shared_ptr<texture> emit;
@@ -128,5 +176,7 @@ public:
 	isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
 	isotropic(shared_ptr<texture> a) : albedo(a) {}
 
+	virtual material_kind kind() const override { return material_kind::isotropic; }
+
 	shared_ptr<texture> albedo;
 };
\ No newline at end of file
@@ -0,0 +1,605 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "shared.h"
+#include "mapped_file.h"
+#include "scheduler.h"
+#include "triangle_mesh.h"
+
+// Loads Wavefront OBJ and PLY (ascii or binary little endian) triangle meshes. The file is
+// mapped read only and its text is split at line breaks into chunks that worker threads parse
+// with std::from_chars, each into its own buffers; the chunks are then stitched together in
+// file order. Polygons are triangulated as fans around their first corner. Normals and UVs are
+// kept only when every corner of every face has one.
+
+// Splits [begin, end) into pieces of roughly target bytes that each end just after a line break.
+inline std::vector<size_t> split_lines(const char* text, size_t begin, size_t end, size_t target)
+{
+	std::vector<size_t> bounds{ begin };
+	while (bounds.back() < end)
+	{
+		auto cut = std::min(end, bounds.back() + target);
+		if (cut < end)
+		{
+			auto line_end = static_cast<const char*>(std::memchr(text + cut, '\n', end - cut));
+			cut = line_end ? static_cast<size_t>(line_end - text) + 1 : end;
+		}
+		bounds.push_back(cut);
+	}
+	return bounds;
+}
+
+inline const char* skip_blanks(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+inline bool parse_number(const char*& p, const char* end, double& value)
+{
+	p = skip_blanks(p, end);
+	if (p < end && *p == '+') p++;
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+inline bool parse_number(const char*& p, const char* end, int64_t& value)
+{
+	if (p < end && *p == '+') p++;
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+// Chunk size for the parallel parsers; small files are parsed by a single thread.
+const size_t mesh_chunk_bytes = 1 << 20;
+
+// What one thread parsed from a chunk of an OBJ file. Face corners are kept as the file wrote
+// them: positive indices count from the start of the file, negative ones back from the
+// vertices read so far. The latter are stored relative to the chunk's first vertex, since the
+// number of vertices in earlier chunks is only known once every chunk is parsed.
+struct obj_chunk
+{
+	struct corner
+	{
+		int64_t v, vt, vn;
+		uint8_t relative;
+	};
+
+	std::vector<point3> positions;
+	std::vector<vec3> normals;
+	std::vector<float> uvs;
+	std::vector<corner> corners;
+	bool all_uvs = true, all_normals = true;
+	std::string error;
+};
+
+inline void parse_obj_chunk(const char* p, const char* end, obj_chunk& chunk)
+{
+	std::vector<obj_chunk::corner> polygon;
+
+	while (p < end && chunk.error.empty())
+	{
+		auto line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if (!line_end) line_end = end;
+		auto line = p;
+		p = skip_blanks(p, line_end);
+
+		bool ok = true;
+		if (line_end - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			double x, y, z;
+			p += 2;
+			ok = parse_number(p, line_end, x) && parse_number(p, line_end, y) && parse_number(p, line_end, z);
+			chunk.positions.push_back(point3(x, y, z));
+		}
+		else if (line_end - p > 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			double x, y, z;
+			p += 3;
+			ok = parse_number(p, line_end, x) && parse_number(p, line_end, y) && parse_number(p, line_end, z);
+			chunk.normals.push_back(vec3(x, y, z));
+		}
+		else if (line_end - p > 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			// A missing v is 0 and a third coordinate is ignored.
+			double u, v = 0;
+			p += 3;
+			ok = parse_number(p, line_end, u);
+			if (ok && skip_blanks(p, line_end) < line_end)
+				ok = parse_number(p, line_end, v);
+			chunk.uvs.push_back(static_cast<float>(u));
+			chunk.uvs.push_back(static_cast<float>(v));
+		}
+		else if (line_end - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			polygon.clear();
+			p += 2;
+			while (ok && (p = skip_blanks(p, line_end)) < line_end)
+			{
+				// v, v/vt, v//vn or v/vt/vn
+				obj_chunk::corner c = { 0, 0, 0, 0 };
+				ok = parse_number(p, line_end, c.v);
+				if (ok && p < line_end && *p == '/')
+				{
+					p++;
+					if (p < line_end && *p != '/')
+						ok = parse_number(p, line_end, c.vt);
+					if (ok && p < line_end && *p == '/')
+					{
+						p++;
+						ok = parse_number(p, line_end, c.vn);
+					}
+				}
+				ok = ok && c.v != 0;
+
+				// Stored 0 based: from the file start, or from this chunk's first element.
+				auto resolve = [&](int64_t& index, size_t count, uint8_t bit) {
+					if (index > 0) index -= 1;
+					else if (index < 0) { index += static_cast<int64_t>(count); c.relative |= bit; }
+				};
+				chunk.all_uvs = chunk.all_uvs && c.vt != 0;
+				chunk.all_normals = chunk.all_normals && c.vn != 0;
+				resolve(c.v, chunk.positions.size(), 1);
+				resolve(c.vt, chunk.uvs.size() / 2, 2);
+				resolve(c.vn, chunk.normals.size(), 4);
+				polygon.push_back(c);
+			}
+
+			for (size_t k = 2; ok && k < polygon.size(); k++)
+			{
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[k - 1]);
+				chunk.corners.push_back(polygon[k]);
+			}
+		}
+		// Comments, groups, smoothing groups, materials, lines and points are skipped.
+
+		if (!ok)
+			chunk.error.assign(line, std::min<size_t>(line_end - line, 80));
+		p = line_end < end ? line_end + 1 : end;
+	}
+}
+
+inline bool load_obj(const char* text, size_t size, mesh_data& mesh, int threads, const std::string& path)
+{
+	auto bounds = split_lines(text, 0, size, mesh_chunk_bytes);
+	std::vector<obj_chunk> chunks(bounds.size() - 1);
+	parallel_for(chunks.size(), threads, [&](size_t begin, size_t end) {
+		for (auto c = begin; c < end; c++)
+			parse_obj_chunk(text + bounds[c], text + bounds[c + 1], chunks[c]);
+		}, 1);
+
+	// Prefix counts of every chunk, so chunk relative indices and output offsets can be resolved.
+	struct offsets { size_t positions, normals, uvs, corners; };
+	std::vector<offsets> starts(chunks.size() + 1, { 0, 0, 0, 0 });
+	bool all_uvs = true, all_normals = true;
+	for (size_t c = 0; c < chunks.size(); c++)
+	{
+		if (!chunks[c].error.empty())
+		{
+			std::cerr << "Could not parse '" << chunks[c].error << "' in '" << path << "'.\n";
+			return false;
+		}
+		starts[c + 1] = { starts[c].positions + chunks[c].positions.size(), starts[c].normals + chunks[c].normals.size(),
+			starts[c].uvs + chunks[c].uvs.size() / 2, starts[c].corners + chunks[c].corners.size() };
+		all_uvs = all_uvs && chunks[c].all_uvs;
+		all_normals = all_normals && chunks[c].all_normals;
+	}
+
+	const auto& total = starts.back();
+	if (total.corners == 0 || total.positions > UINT32_MAX || total.corners > UINT32_MAX)
+	{
+		std::cerr << "'" << path << "' has no faces, or more vertices or faces than a mesh can hold.\n";
+		return false;
+	}
+	all_uvs = all_uvs && total.uvs > 0;
+	all_normals = all_normals && total.normals > 0;
+
+	mesh = mesh_data();
+	mesh.positions.resize(total.positions);
+	mesh.normals.resize(all_normals ? total.normals : 0);
+	mesh.uvs.resize(all_uvs ? total.uvs * 2 : 0);
+	mesh.indices.resize(total.corners);
+	mesh.normal_indices.resize(all_normals ? total.corners : 0);
+	mesh.uv_indices.resize(all_uvs ? total.corners : 0);
+
+	std::vector<uint8_t> bad(chunks.size(), 0);
+	parallel_for(chunks.size(), threads, [&](size_t begin, size_t end) {
+		for (auto c = begin; c < end; c++)
+		{
+			const auto& chunk = chunks[c];
+			const auto& start = starts[c];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + start.positions);
+			if (all_normals) std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + start.normals);
+			if (all_uvs) std::copy(chunk.uvs.begin(), chunk.uvs.end(), mesh.uvs.begin() + start.uvs * 2);
+
+			auto resolve = [&](int64_t index, bool relative, size_t chunk_start, size_t count, uint32_t& out) {
+				if (relative) index += static_cast<int64_t>(chunk_start);
+				if (index < 0 || index >= static_cast<int64_t>(count)) bad[c] = 1;
+				else out = static_cast<uint32_t>(index);
+			};
+			for (size_t k = 0; k < chunk.corners.size(); k++)
+			{
+				const auto& corner = chunk.corners[k];
+				auto at = start.corners + k;
+				resolve(corner.v, corner.relative & 1, start.positions, total.positions, mesh.indices[at]);
+				if (all_uvs) resolve(corner.vt, corner.relative & 2, start.uvs, total.uvs, mesh.uv_indices[at]);
+				if (all_normals) resolve(corner.vn, corner.relative & 4, start.normals, total.normals, mesh.normal_indices[at]);
+			}
+		}
+		}, 1);
+
+	if (std::find(bad.begin(), bad.end(), 1) != bad.end())
+	{
+		std::cerr << "'" << path << "' has a face that refers to a vertex it does not define.\n";
+		return false;
+	}
+	return true;
+}
+
+enum class ply_type : uint8_t { int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid };
+
+struct ply_property
+{
+	std::string name;
+	ply_type type = ply_type::invalid;
+	ply_type count_type = ply_type::invalid;
+	bool is_list = false;
+};
+
+struct ply_element
+{
+	std::string name;
+	size_t count = 0;
+	std::vector<ply_property> properties;
+};
+
+inline ply_type ply_type_from_name(const std::string& name)
+{
+	if (name == "char" || name == "int8") return ply_type::int8;
+	if (name == "uchar" || name == "uint8") return ply_type::uint8;
+	if (name == "short" || name == "int16") return ply_type::int16;
+	if (name == "ushort" || name == "uint16") return ply_type::uint16;
+	if (name == "int" || name == "int32") return ply_type::int32;
+	if (name == "uint" || name == "uint32") return ply_type::uint32;
+	if (name == "float" || name == "float32") return ply_type::float32;
+	if (name == "double" || name == "float64") return ply_type::float64;
+	return ply_type::invalid;
+}
+
+inline size_t ply_type_size(ply_type type)
+{
+	static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+	return sizes[static_cast<int>(type)];
+}
+
+// Reads one binary value. PLY's little endian layout is the host's on every platform we build for.
+inline double ply_read(const uint8_t* p, ply_type type)
+{
+	switch (type)
+	{
+	case ply_type::int8: { int8_t v; std::memcpy(&v, p, 1); return v; }
+	case ply_type::uint8: return *p;
+	case ply_type::int16: { int16_t v; std::memcpy(&v, p, 2); return v; }
+	case ply_type::uint16: { uint16_t v; std::memcpy(&v, p, 2); return v; }
+	case ply_type::int32: { int32_t v; std::memcpy(&v, p, 4); return v; }
+	case ply_type::uint32: { uint32_t v; std::memcpy(&v, p, 4); return v; }
+	case ply_type::float32: { float v; std::memcpy(&v, p, 4); return v; }
+	case ply_type::float64: { double v; std::memcpy(&v, p, 8); return v; }
+	default: return 0;
+	}
+}
+
+// Where the vertex attributes we use sit among the vertex element's properties, or -1.
+struct ply_vertex_layout
+{
+	int position[3] = { -1, -1, -1 };
+	int normal[3] = { -1, -1, -1 };
+	int uv[2] = { -1, -1 };
+
+	explicit ply_vertex_layout(const ply_element& vertex)
+	{
+		for (int k = 0; k < static_cast<int>(vertex.properties.size()); k++)
+		{
+			const auto& name = vertex.properties[k].name;
+			if (name == "x") position[0] = k;
+			else if (name == "y") position[1] = k;
+			else if (name == "z") position[2] = k;
+			else if (name == "nx") normal[0] = k;
+			else if (name == "ny") normal[1] = k;
+			else if (name == "nz") normal[2] = k;
+			else if (name == "u" || name == "s" || name == "texture_u" || name == "texture_s") uv[0] = k;
+			else if (name == "v" || name == "t" || name == "texture_v" || name == "texture_t") uv[1] = k;
+		}
+	}
+
+	bool has_position() const { return position[0] >= 0 && position[1] >= 0 && position[2] >= 0; }
+	bool has_normal() const { return normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0; }
+	bool has_uv() const { return uv[0] >= 0 && uv[1] >= 0; }
+
+	// values holds the vertex's properties in declaration order.
+	void store(const double* values, mesh_data& mesh, size_t i) const
+	{
+		mesh.positions[i] = point3(values[position[0]], values[position[1]], values[position[2]]);
+		if (has_normal()) mesh.normals[i] = vec3(values[normal[0]], values[normal[1]], values[normal[2]]);
+		if (has_uv())
+		{
+			mesh.uvs[i * 2] = static_cast<float>(values[uv[0]]);
+			mesh.uvs[i * 2 + 1] = static_cast<float>(values[uv[1]]);
+		}
+	}
+};
+
+// Appends the fan triangulation of one face, or returns false for an index out of range.
+inline bool add_ply_face(const std::vector<int64_t>& face, size_t vertex_count, std::vector<uint32_t>& indices)
+{
+	for (auto index : face)
+		if (index < 0 || index >= static_cast<int64_t>(vertex_count)) return false;
+	for (size_t k = 2; k < face.size(); k++)
+	{
+		indices.push_back(static_cast<uint32_t>(face[0]));
+		indices.push_back(static_cast<uint32_t>(face[k - 1]));
+		indices.push_back(static_cast<uint32_t>(face[k]));
+	}
+	return true;
+}
+
+inline bool load_ply(const char* text, size_t size, mesh_data& mesh, int threads, const std::string& path)
+{
+	auto fail = [&](const char* why) {
+		std::cerr << "Could not load '" << path << "': " << why << ".\n";
+		return false;
+	};
+
+	// The header is short, so it is read line by line.
+	std::vector<ply_element> elements;
+	bool binary = false;
+	size_t p = 0;
+	for (bool first = true; ; first = false)
+	{
+		if (p >= size) return fail("the header has no end_header line");
+		auto line_end = static_cast<const char*>(std::memchr(text + p, '\n', size - p));
+		auto next = line_end ? static_cast<size_t>(line_end - text) + 1 : size;
+		std::string line(text + p, next - p);
+		p = next;
+		while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+
+		std::vector<std::string> words;
+		for (size_t w = 0; w < line.size(); )
+		{
+			auto start = line.find_first_not_of(" \t", w);
+			if (start == std::string::npos) break;
+			auto stop = std::min(line.find_first_of(" \t", start), line.size());
+			words.push_back(line.substr(start, stop - start));
+			w = stop;
+		}
+
+		if (first && (words.size() != 1 || words[0] != "ply")) return fail("it is not a PLY file");
+		if (first || words.empty() || words[0] == "comment" || words[0] == "obj_info") continue;
+		if (words[0] == "end_header") break;
+
+		if (words[0] == "format" && words.size() >= 2)
+		{
+			if (words[1] == "binary_little_endian") binary = true;
+			else if (words[1] != "ascii") return fail("only ascii and binary_little_endian PLY files are supported");
+		}
+		else if (words[0] == "element" && words.size() == 3)
+		{
+			ply_element element;
+			element.name = words[1];
+			element.count = std::strtoull(words[2].c_str(), nullptr, 10);
+			elements.push_back(element);
+		}
+		else if (words[0] == "property" && !elements.empty())
+		{
+			ply_property property;
+			if (words.size() == 5 && words[1] == "list")
+			{
+				property.is_list = true;
+				property.count_type = ply_type_from_name(words[2]);
+				property.type = ply_type_from_name(words[3]);
+				property.name = words[4];
+				if (property.count_type == ply_type::invalid) return fail("a list has an unknown count type");
+			}
+			else if (words.size() == 3)
+			{
+				property.type = ply_type_from_name(words[1]);
+				property.name = words[2];
+			}
+			if (property.type == ply_type::invalid) return fail("a property has an unknown type");
+			elements.back().properties.push_back(property);
+		}
+		else return fail("the header has a line it does not understand");
+	}
+
+	const ply_element* vertex = nullptr;
+	const ply_element* face = nullptr;
+	for (const auto& element : elements)
+	{
+		if (element.name == "vertex") vertex = &element;
+		if (element.name == "face") face = &element;
+	}
+	if (!vertex || !face || vertex->count > UINT32_MAX) return fail("it needs a vertex and a face element");
+
+	ply_vertex_layout layout(*vertex);
+	int face_list = -1;
+	for (int k = 0; k < static_cast<int>(face->properties.size()); k++)
+		if (face->properties[k].is_list && (face->properties[k].name == "vertex_indices" || face->properties[k].name == "vertex_index"))
+			face_list = k;
+	if (!layout.has_position() || face_list < 0) return fail("vertices need x, y and z and faces need vertex_indices");
+	for (const auto& property : vertex->properties)
+		if (property.is_list) return fail("vertices with list properties are not supported");
+
+	mesh = mesh_data();
+	mesh.positions.resize(vertex->count);
+	mesh.normals.resize(layout.has_normal() ? vertex->count : 0);
+	mesh.uvs.resize(layout.has_uv() ? vertex->count * 2 : 0);
+	const auto property_count = vertex->properties.size();
+
+	for (const auto& element : elements)
+	{
+		if (!binary)
+		{
+			// Every element instance is one line. Finding the lines is a fast memchr walk;
+			// turning them into numbers is the slow part and is done in parallel chunks.
+			auto begin = p;
+			for (size_t n = 0; n < element.count; n++)
+			{
+				if (p >= size) return fail("the file ends early");
+				auto line_end = static_cast<const char*>(std::memchr(text + p, '\n', size - p));
+				p = line_end ? static_cast<size_t>(line_end - text) + 1 : size;
+			}
+			if (&element != vertex && &element != face) continue;
+
+			auto bounds = split_lines(text, begin, p, mesh_chunk_bytes);
+			std::vector<size_t> first_line(bounds.size(), 0);
+			std::vector<std::vector<uint32_t>> chunk_indices(bounds.size() - 1);
+			std::vector<uint8_t> bad(bounds.size() - 1, 0);
+
+			// Vertices are written in place, so each chunk needs the number of the first line it holds.
+			if (&element == vertex)
+				for (size_t c = 1; c < bounds.size(); c++)
+					first_line[c] = first_line[c - 1] + std::count(text + bounds[c - 1], text + bounds[c], '\n');
+
+			parallel_for(bounds.size() - 1, threads, [&](size_t chunk_begin, size_t chunk_end) {
+				std::vector<double> values(property_count);
+				std::vector<int64_t> polygon;
+				for (auto c = chunk_begin; c < chunk_end; c++)
+				{
+					auto q = text + bounds[c];
+					auto stop = text + bounds[c + 1];
+					for (auto line = first_line[c]; q < stop && !bad[c]; line++)
+					{
+						auto line_end = static_cast<const char*>(std::memchr(q, '\n', stop - q));
+						if (!line_end) line_end = stop;
+
+						bool ok = true;
+						if (&element == vertex)
+						{
+							for (size_t k = 0; ok && k < property_count; k++)
+								ok = parse_number(q, line_end, values[k]);
+							if (ok) layout.store(values.data(), mesh, line);
+						}
+						else
+						{
+							for (int k = 0; ok && k < static_cast<int>(element.properties.size()); k++)
+							{
+								const auto& property = element.properties[k];
+								double count = 1;
+								if (property.is_list) ok = parse_number(q, line_end, count);
+								polygon.clear();
+								for (int64_t n = 0; ok && n < static_cast<int64_t>(count); n++)
+								{
+									double value;
+									ok = parse_number(q, line_end, value);
+									polygon.push_back(static_cast<int64_t>(value));
+								}
+								if (ok && k == face_list)
+									ok = add_ply_face(polygon, vertex->count, chunk_indices[c]);
+							}
+						}
+						if (!ok) bad[c] = 1;
+						q = line_end < stop ? line_end + 1 : stop;
+					}
+				}
+				}, 1);
+
+			if (std::find(bad.begin(), bad.end(), 1) != bad.end()) return fail("an element line is malformed");
+			for (const auto& indices : chunk_indices)
+				mesh.indices.append(indices.data(), indices.data() + indices.size());
+			continue;
+		}
+
+		// Binary vertices have a fixed stride, so they are decoded in parallel straight from the map.
+		auto data = reinterpret_cast<const uint8_t*>(text);
+		if (&element == vertex)
+		{
+			std::vector<size_t> offsets;
+			size_t stride = 0;
+			for (const auto& property : vertex->properties)
+			{
+				offsets.push_back(stride);
+				stride += ply_type_size(property.type);
+			}
+			if (stride * vertex->count > size - p) return fail("the file ends early");
+
+			parallel_for(vertex->count, threads, [&](size_t begin, size_t end) {
+				std::vector<double> values(property_count);
+				for (auto i = begin; i < end; i++)
+				{
+					auto at = data + p + i * stride;
+					for (size_t k = 0; k < property_count; k++)
+						values[k] = ply_read(at + offsets[k], vertex->properties[k].type);
+					layout.store(values.data(), mesh, i);
+				}
+				}, 1 << 14);
+			p += stride * vertex->count;
+			continue;
+		}
+
+		// Other elements may hold lists, whose lengths are only known by reading them in order.
+		std::vector<int64_t> polygon;
+		std::vector<uint32_t> face_indices;
+		for (size_t n = 0; n < element.count; n++)
+			for (int k = 0; k < static_cast<int>(element.properties.size()); k++)
+			{
+				const auto& property = element.properties[k];
+				size_t count = 1;
+				if (property.is_list)
+				{
+					if (ply_type_size(property.count_type) > size - p) return fail("the file ends early");
+					count = static_cast<size_t>(ply_read(data + p, property.count_type));
+					p += ply_type_size(property.count_type);
+				}
+				auto value_size = ply_type_size(property.type);
+				if (count * value_size > size - p) return fail("the file ends early");
+
+				if (&element == face && k == face_list)
+				{
+					polygon.clear();
+					for (size_t v = 0; v < count; v++)
+						polygon.push_back(static_cast<int64_t>(ply_read(data + p + v * value_size, property.type)));
+					if (!add_ply_face(polygon, vertex->count, face_indices)) return fail("a face refers to a missing vertex");
+				}
+				p += count * value_size;
+			}
+		mesh.indices.append(face_indices.data(), face_indices.data() + face_indices.size());
+	}
+
+	if (mesh.indices.empty() || mesh.indices.size() > UINT32_MAX) return fail("it has no faces, or more than a mesh can hold");
+	return true;
+}
+
+// Loads an .obj or .ply file, parsing with up to threads threads.
+inline bool load_mesh(const std::string& path, mesh_data& mesh, int threads)
+{
+	auto dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension != "obj" && extension != "ply")
+	{
+		std::cerr << "Unknown mesh format '" << path << "'; use .obj or .ply.\n";
+		return false;
+	}
+
+	mapped_file file;
+	if (!file.open(path, true))
+	{
+		std::cerr << "Could not open '" << path << "'.\n";
+		return false;
+	}
+
+	auto text = reinterpret_cast<const char*>(file.data());
+	return extension == "obj" ? load_obj(text, file.size(), mesh, threads, path) : load_ply(text, file.size(), mesh, threads, path);
+}
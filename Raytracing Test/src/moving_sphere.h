@@ -44,10 +44,10 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
 	}
 
 	rec.t = root;
-	rec.p = r.at(rec.t);
-	auto outward_normal = (rec.p - center(r.time())) / radius;
+	auto outward_normal = unit_vector(r.at(rec.t) - center(r.time()));
+	rec.p = center(r.time()) + radius * outward_normal;
 	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mat_ptr;
+	rec.mat_ptr = mat_ptr.get();
 
 	return true;
 }
@@ -59,7 +59,7 @@ public:
 class hittable_pdf : public pdf
 {
 public:
-	hittable_pdf(shared_ptr<hittable> p, const point3& origin) : ptr(p), o(origin) {}
+	hittable_pdf(const hittable& p, const point3& origin) : ptr(&p), o(origin) {}
 
 	virtual double value(const vec3& direction) const override
 	{
@@ -69,16 +69,17 @@ public:
 	virtual vec3 generate() const override { return ptr->random(o); }
 
 	point3 o;
-	shared_ptr<hittable> ptr;
+	const hittable* ptr;
 };
 
 class mixture_pdf : public pdf
 {
 public:
-	mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1)
+	// Both pdfs are borrowed and must outlive the mixture.
+	mixture_pdf(const pdf& p0, const pdf& p1)
 	{
-		p[0] = p0;
-		p[1] = p1;
+		p[0] = &p0;
+		p[1] = &p1;
 	}
 
 	virtual double value(const vec3& direction) const override
@@ -92,5 +93,5 @@ public:
 		else return p[1]->generate();
 	}
 
-	shared_ptr<pdf> p[2];
+	const pdf* p[2];
 };
\ No newline at end of file
@@ -1,31 +1,31 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+
 #include "shared.h"
 #include "vec3.h"
 
+// Points, or octaves of one point, the noise kernel evaluates together.
+const int noise_lanes = 4;
+
 class perlin
 {
 public:
 	perlin()
 	{
-		ranvec = new vec3[point_count];
 		for (int i = 0; i < point_count; ++i)
 		{
 			ranvec[i] = unit_vector(vec3::random(-1, 1));
 		}
 
-		perm_x = perlin_generate_perm();
-		perm_y = perlin_generate_perm();
-		perm_z = perlin_generate_perm();
-	}
-
-	~perlin()
-	{
-		delete[] ranvec;
-		delete[] perm_x;
-		delete[] perm_y;
-		delete[] perm_z;
+		perlin_generate_perm(perm_x);
+		perlin_generate_perm(perm_y);
+		perlin_generate_perm(perm_z);
+		build_table();
 	}
 
+	// Noise and turbulence at one point in double precision throughout, the reference the
+	// vectorized kernel below is checked against.
 	double noise(const point3& p) const
 	{
 		auto u = p.x() - floor(p.x());
@@ -48,7 +48,7 @@ public:
 			return perlin_interp(c, u, v, w);
 	}
 
-	double turb(const point3& p, int depth = 7) const
+	double reference_turb(const point3& p, int depth = 7) const
 	{
 		auto accum = 0.0;
 		auto temp_p = p;
@@ -63,21 +63,193 @@ public:
 		return fabs(accum);
 	}
 
-private:
+	// Sums depth octaves of noise at p, noise_lanes octaves to a pass of the kernel.
+	double turb(const point3& p, int depth = 7) const
+	{
+		auto accum = 0.0;
+		auto scale = 1.0;
+		auto weight = 1.0;
+
+		for (int first = 0; first < depth; first += noise_lanes)
+		{
+			double x[noise_lanes], y[noise_lanes], z[noise_lanes], weights[noise_lanes];
+			for (int lane = 0; lane < noise_lanes; lane++)
+			{
+				x[lane] = p.x() * scale;
+				y[lane] = p.y() * scale;
+				z[lane] = p.z() * scale;
+				weights[lane] = first + lane < depth ? weight : 0;
+				scale *= 2;
+				weight *= 0.5;
+			}
+
+			float n[noise_lanes];
+			noise_kernel(x, y, z, n);
+			for (int lane = 0; lane < noise_lanes; lane++)
+				accum += weights[lane] * n[lane];
+		}
+		return fabs(accum);
+	}
+
+	// turb at count points at once, noise_lanes points to a pass of the kernel: out[i] is turb(p[i], depth).
+	void turb(const point3* p, size_t count, double* out, int depth = 7) const
+	{
+		for (size_t first = 0; first < count; first += noise_lanes)
+		{
+			// A short last group repeats its last point in the spare lanes.
+			auto lanes = static_cast<int>(std::min<size_t>(noise_lanes, count - first));
+			double accum[noise_lanes] = {};
+			auto scale = 1.0;
+			auto weight = 1.0;
+
+			for (int octave = 0; octave < depth; octave++)
+			{
+				double x[noise_lanes], y[noise_lanes], z[noise_lanes];
+				for (int lane = 0; lane < noise_lanes; lane++)
+				{
+					const auto& q = p[first + std::min(lane, lanes - 1)];
+					x[lane] = q.x() * scale;
+					y[lane] = q.y() * scale;
+					z[lane] = q.z() * scale;
+				}
+
+				float n[noise_lanes];
+				noise_kernel(x, y, z, n);
+				for (int lane = 0; lane < noise_lanes; lane++)
+					accum[lane] += weight * n[lane];
+				scale *= 2;
+				weight *= 0.5;
+			}
+
+			for (int lane = 0; lane < lanes; lane++)
+				out[first + lane] = fabs(accum[lane]);
+		}
+	}
+
 	static const int point_count = 256;
-	vec3* ranvec;
-	int* perm_x;
-	int* perm_y;
-	int* perm_z;
 
-	static int* perlin_generate_perm()
+	// The random tables, so a snapshot can save them and restore exactly the same noise.
+	const vec3* vectors() const { return ranvec; }
+	const int* permutation(int axis) const { return axis == 0 ? perm_x : axis == 1 ? perm_y : perm_z; }
+
+	void restore(const vec3* vectors, const int* x, const int* y, const int* z)
 	{
-		auto p = new int[point_count];
+		std::copy(vectors, vectors + point_count, ranvec);
+		std::copy(x, x + point_count, perm_x);
+		std::copy(y, y + point_count, perm_y);
+		std::copy(z, z + point_count, perm_z);
+		build_table();
+	}
+
+private:
+	vec3 ranvec[point_count];
+	int perm_x[point_count];
+	int perm_y[point_count];
+	int perm_z[point_count];
+
+	// The tables again in the form the kernel reads: byte permutations and float gradients padded
+	// to one 16 byte load each, under 5 KB together so they stay in L1 while a batch runs.
+	struct noise_table
+	{
+		alignas(16) float gradient[point_count][4];
+		uint8_t perm[3][point_count];
+	};
+	noise_table table;
 
+	void build_table()
+	{
+		for (int i = 0; i < point_count; i++)
+		{
+			for (int a = 0; a < 3; a++)
+				table.gradient[i][a] = static_cast<float>(ranvec[i][a]);
+			table.gradient[i][3] = 0;
+			table.perm[0][i] = static_cast<uint8_t>(perm_x[i]);
+			table.perm[1][i] = static_cast<uint8_t>(perm_y[i]);
+			table.perm[2][i] = static_cast<uint8_t>(perm_z[i]);
+		}
+	}
+
+	// Noise at noise_lanes points. Cells and offsets within them are found in double precision so
+	// fine octaves keep their detail; the gradients and the blend, where the time goes, run in
+	// float lanes. Corner c of a cell is (c >> 2, (c >> 1) & 1, c & 1) from its lowest corner.
+	void noise_kernel(const double* x, const double* y, const double* z, float* out) const
+	{
+		alignas(16) float u[noise_lanes], v[noise_lanes], w[noise_lanes];
+		uint8_t hash[8][noise_lanes];
+
+		for (int lane = 0; lane < noise_lanes; lane++)
+		{
+			// Truncation rounds negative coordinates up; stepping back one finds the floor without
+			// a call into the math library.
+			auto i = static_cast<int>(x[lane]), j = static_cast<int>(y[lane]), k = static_cast<int>(z[lane]);
+			i -= x[lane] < i;
+			j -= y[lane] < j;
+			k -= z[lane] < k;
+			u[lane] = static_cast<float>(x[lane] - i);
+			v[lane] = static_cast<float>(y[lane] - j);
+			w[lane] = static_cast<float>(z[lane] - k);
+
+			uint8_t hx[2] = { table.perm[0][i & 255], table.perm[0][(i + 1) & 255] };
+			uint8_t hy[2] = { table.perm[1][j & 255], table.perm[1][(j + 1) & 255] };
+			uint8_t hz[2] = { table.perm[2][k & 255], table.perm[2][(k + 1) & 255] };
+			for (int c = 0; c < 8; c++)
+				hash[c][lane] = hx[c >> 2] ^ hy[(c >> 1) & 1] ^ hz[c & 1];
+		}
+
+#if RT_SSE
+		auto uf = _mm_load_ps(u), vf = _mm_load_ps(v), wf = _mm_load_ps(w);
+		auto one = _mm_set1_ps(1), two = _mm_set1_ps(2), three = _mm_set1_ps(3);
+
+		// Each corner's gradient is one load per lane; a transpose turns the four into x, y and z
+		// rows, and its dot product with the offset to every lane's point runs across the lanes.
+		__m128 corner[8];
+		for (int c = 0; c < 8; c++)
+		{
+			auto gx = _mm_load_ps(table.gradient[hash[c][0]]);
+			auto gy = _mm_load_ps(table.gradient[hash[c][1]]);
+			auto gz = _mm_load_ps(table.gradient[hash[c][2]]);
+			auto gw = _mm_load_ps(table.gradient[hash[c][3]]);
+			_MM_TRANSPOSE4_PS(gx, gy, gz, gw);
+
+			auto dx = c & 4 ? _mm_sub_ps(uf, one) : uf;
+			auto dy = c & 2 ? _mm_sub_ps(vf, one) : vf;
+			auto dz = c & 1 ? _mm_sub_ps(wf, one) : wf;
+			corner[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, dx), _mm_mul_ps(gy, dy)), _mm_mul_ps(gz, dz));
+		}
+
+		auto hermite = [&](__m128 t) { return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(three, _mm_mul_ps(two, t))); };
+		auto lerp = [](__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))); };
+		auto uu = hermite(uf), vv = hermite(vf), ww = hermite(wf);
+
+		auto x0 = lerp(lerp(corner[0], corner[1], ww), lerp(corner[2], corner[3], ww), vv);
+		auto x1 = lerp(lerp(corner[4], corner[5], ww), lerp(corner[6], corner[7], ww), vv);
+		_mm_storeu_ps(out, lerp(x0, x1, uu));
+#else
+		for (int lane = 0; lane < noise_lanes; lane++)
+		{
+			float corner[8];
+			for (int c = 0; c < 8; c++)
+			{
+				const auto* g = table.gradient[hash[c][lane]];
+				corner[c] = g[0] * (u[lane] - (c >> 2)) + g[1] * (v[lane] - ((c >> 1) & 1)) + g[2] * (w[lane] - (c & 1));
+			}
+
+			auto hermite = [](float t) { return t * t * (3 - 2 * t); };
+			auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+			auto uu = hermite(u[lane]), vv = hermite(v[lane]), ww = hermite(w[lane]);
+
+			auto x0 = lerp(lerp(corner[0], corner[1], ww), lerp(corner[2], corner[3], ww), vv);
+			auto x1 = lerp(lerp(corner[4], corner[5], ww), lerp(corner[6], corner[7], ww), vv);
+			out[lane] = lerp(x0, x1, uu);
+		}
+#endif
+	}
+
+	static void perlin_generate_perm(int* p)
+	{
 		for (int i = 0; i < perlin::point_count; i++) p[i] = i;
 
 		permute(p, point_count);
-		return p;
 	}
 
 	static void permute(int* p, int n)
@@ -111,4 +283,4 @@ private:
 
 		return accum;
 	}
-};
\ No newline at end of file
+};
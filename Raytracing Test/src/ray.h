@@ -1,4 +1,8 @@
 #pragma once
+#include <bit>
+#include <cstdint>
+#include <type_traits>
+
 #include "vec3.h"
 
 class ray
@@ -17,4 +21,31 @@ public:
 	point3 orig;
 	vec3 dir;
 	double tm;
-};
\ No newline at end of file
+};
+
+// Moves p, a point on a surface with geometric normal n, off the surface towards the side
+// dir leaves on. The offset is a fixed number of ulps of each coordinate, so it scales with
+// the rounding error of p and spawned rays cannot re-hit their own surface, in float or double.
+// See Waechter and Binder, "A Fast and Robust Method for Avoiding Self-Intersection".
+inline point3 offset_ray_origin(const point3& p, const vec3& n, const vec3& dir)
+{
+	using bits = std::conditional_t<sizeof(real) == 4, int32_t, int64_t>;
+	constexpr real origin = real(1.0 / 32.0);
+	constexpr real float_scale = sizeof(real) == 4 ? real(1.0 / 65536.0) : real(1.0 / 4294967296.0);
+	constexpr real int_scale = sizeof(real) == 4 ? real(256.0) : real(16777216.0);
+
+	auto side = dot(dir, n) > 0 ? n : -n;
+	point3 result;
+	for (int a = 0; a < 3; a++)
+	{
+		auto offset = static_cast<bits>(int_scale * side[a]);
+		auto moved = std::bit_cast<real>(std::bit_cast<bits>(p[a]) + (p[a] < 0 ? -offset : offset));
+		result[a] = fabs(p[a]) < origin ? p[a] + float_scale * side[a] : moved;
+	}
+	return result;
+}
+
+inline ray spawn_ray(const point3& p, const vec3& n, const vec3& dir, double time)
+{
+	return ray(offset_ray_origin(p, n, dir), dir, time);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+
+#include "shared.h"
+#include "ray.h"
+
+const int max_packet_size = 16;
+
+// A bundle of up to 16 rays stored as structure of arrays so per-lane loops vectorize.
+// Lanes are addressed by bit masks; t_max shrinks per lane as closer hits are found.
+// Lanes past size keep t_max at -infinity so fixed-width loops over them never report a hit.
+struct ray_packet
+{
+	int size = 0;
+	double org[3][max_packet_size] = {};
+	double dir[3][max_packet_size] = {};
+	double inv_dir[3][max_packet_size] = {};
+	double time[max_packet_size] = {};
+	double t_max[max_packet_size] = {};
+
+	void set(int lane, const ray& r, double lane_t_max = infinity)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			org[a][lane] = r.orig.e[a];
+			dir[a][lane] = r.dir.e[a];
+			inv_dir[a][lane] = 1.0 / r.dir.e[a];
+		}
+		time[lane] = r.tm;
+		t_max[lane] = lane_t_max;
+	}
+
+	ray get(int lane) const
+	{
+		return ray(point3(org[0][lane], org[1][lane], org[2][lane]),
+			vec3(dir[0][lane], dir[1][lane], dir[2][lane]), time[lane]);
+	}
+
+	void resize(int lanes)
+	{
+		size = lanes;
+		for (int lane = lanes; lane < max_packet_size; lane++)
+			t_max[lane] = -infinity;
+	}
+
+	uint32_t all_lanes() const { return size >= 32 ? ~0u : (1u << size) - 1; }
+};
+
+inline int lowest_lane(uint32_t mask)
+{
+	int lane = 0;
+	while (!(mask & 1u))
+	{
+		mask >>= 1;
+		lane++;
+	}
+	return lane;
+}
+
+inline int lane_count(uint32_t mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1) count++;
+	return count;
+}
+
+inline uint32_t lanes_from_flags(const bool* flags, int size)
+{
+	uint32_t mask = 0;
+	for (int k = 0; k < size; k++)
+		mask |= static_cast<uint32_t>(flags[k]) << k;
+	return mask;
+}
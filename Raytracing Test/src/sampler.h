@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+
+inline uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+// PCG32 (XSH RR) generator. Every worker thread owns one, and it is reseeded from
+// (pixel, sample, frame) before each sample, so the random stream a sample sees does
+// not depend on which thread renders it or in what order.
+class sampler
+{
+public:
+	sampler() { seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull); }
+
+	void seed(uint64_t initstate, uint64_t sequence)
+	{
+		state = 0;
+		inc = (sequence << 1) | 1;
+		next();
+		state += initstate;
+		next();
+	}
+
+	void start_sample(uint32_t pixel, uint32_t sample, uint32_t frame)
+	{
+		auto key = (static_cast<uint64_t>(sample) << 32) | pixel;
+		seed(splitmix64(key ^ splitmix64(frame)), splitmix64(pixel));
+	}
+
+	uint32_t next()
+	{
+		auto old = state;
+		state = old * 6364136223846793005ull + inc;
+		auto xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+		auto rot = static_cast<uint32_t>(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	double next_double() { return next() * (1.0 / 4294967296.0); }
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+inline sampler& thread_sampler()
+{
+	thread_local sampler s;
+	return s;
+}
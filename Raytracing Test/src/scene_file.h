@@ -0,0 +1,465 @@
+#pragma once
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "shared.h"
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "mesh_loader.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+#include "texture.h"
+#include "transform.h"
+#include "triangle_mesh.h"
+
+// Everything main needs to render a scene: the top level objects, the camera and background,
+// and render options given as command line arguments, which the real command line overrides.
+struct scene_description
+{
+	hittable_list objects;
+	color background = color(0, 0, 0);
+
+	point3 lookfrom = point3(278, 278, -800);
+	point3 lookat = point3(278, 278, 0);
+	vec3 vup = vec3(0, 1, 0);
+	double vfov = 40;
+	double aspect_ratio = 1;
+	double aperture = 0;
+	double focus_dist = 10;
+	double time0 = 0, time1 = 1;
+
+	std::vector<std::string> render_arguments;
+	size_t statements = 0;
+};
+
+// Reads the text scene format in one pass over the mapped file. Every line is one statement;
+// # starts a comment. Names are looked up in hash maps, so a statement costs the same however
+// many came before it, and must be defined before they are used:
+//
+//   render <option> <value> ...           command line options without their dashes
+//   camera [lookfrom x y z] [lookat x y z] [up x y z] [vfov deg] [aspect a] [aperture a] [focus d] [time t0 t1]
+//   background r g b
+//   texture <name> solid r g b | checker <even> <odd> | noise <scale> | image <file>
+//   material <name> lambertian <color> | metal r g b <fuzz> | dielectric <ior> | light <color> | isotropic <color>
+//   sphere <material> x y z radius
+//   moving_sphere <material> x0 y0 z0 x1 y1 z1 t0 t1 radius
+//   rect xy|xz|yz <material> a0 a1 b0 b1 k [flip]
+//   box <material> x0 y0 z0 x1 y1 z1
+//   mesh <material> <file>
+//   object <name> ... end                 geometry in between forms a BVH placed only by instances
+//   instance <object> [translate x y z] [rotate deg ax ay az] [scale s | scale x y z] [matrix m00 .. m23] ...
+//   medium <object> <density> <color>
+//
+// A <color> is either r g b or a texture name. Transforms apply in the order written. Files are
+// relative to the scene file. Images load while the file is read, so texture-cache and
+// texture-dir are taken from the command line only.
+class scene_parser
+{
+public:
+	scene_parser(const std::string& _path, int _threads) : path(_path), threads(_threads)
+	{
+		auto slash = path.find_last_of("/\\");
+		directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+	}
+
+	bool parse(const char* text, size_t size, scene_description& scene);
+
+private:
+	bool statement(std::string_view keyword, scene_description& scene);
+	bool add_geometry(shared_ptr<hittable> object, scene_description& scene);
+
+	bool word(std::string_view& out);
+	bool number(double& out);
+	bool vector(vec3& out);
+	bool next_is_number() const;
+	bool color_or_texture(shared_ptr<texture>& out);
+	bool fail(const std::string& message);
+
+	template <class T>
+	bool lookup(const std::unordered_map<std::string, shared_ptr<T>>& names, const char* kind, shared_ptr<T>& out)
+	{
+		std::string_view name;
+		if (!word(name)) return fail(std::string("expected a ") + kind + " name");
+		auto found = names.find(std::string(name));
+		if (found == names.end()) return fail(std::string("unknown ") + kind + " '" + std::string(name) + "'");
+		out = found->second;
+		return true;
+	}
+
+	std::string path, directory;
+	int threads;
+	size_t line_number = 0;
+	const char* p = nullptr;
+	const char* line_end = nullptr;
+
+	std::unordered_map<std::string, shared_ptr<texture>> textures;
+	std::unordered_map<std::string, shared_ptr<material>> materials;
+	std::unordered_map<std::string, shared_ptr<hittable>> objects;
+	std::unordered_map<std::string, shared_ptr<mesh_data>> meshes;
+
+	// The object block being read, if any, and the geometry collected for it so far.
+	std::string object_name;
+	bool in_object = false;
+	std::vector<shared_ptr<hittable>> object_members;
+};
+
+inline bool scene_parser::fail(const std::string& message)
+{
+	std::cerr << path << ':' << line_number << ": " << message << ".\n";
+	return false;
+}
+
+inline bool scene_parser::word(std::string_view& out)
+{
+	p = skip_blanks(p, line_end);
+	auto start = p;
+	while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+	out = std::string_view(start, p - start);
+	return !out.empty();
+}
+
+inline bool scene_parser::number(double& out)
+{
+	return parse_number(p, line_end, out) || fail("expected a number");
+}
+
+inline bool scene_parser::vector(vec3& out)
+{
+	double x, y, z;
+	if (!number(x) || !number(y) || !number(z)) return false;
+	out = vec3(x, y, z);
+	return true;
+}
+
+inline bool scene_parser::next_is_number() const
+{
+	auto q = skip_blanks(p, line_end);
+	return q < line_end && (std::isdigit(static_cast<unsigned char>(*q)) || *q == '.' || *q == '-' || *q == '+');
+}
+
+inline bool scene_parser::color_or_texture(shared_ptr<texture>& out)
+{
+	if (next_is_number())
+	{
+		vec3 c;
+		if (!vector(c)) return false;
+		out = make_shared<solid_color>(c);
+		return true;
+	}
+	return lookup(textures, "texture", out);
+}
+
+inline bool scene_parser::parse(const char* text, size_t size, scene_description& scene)
+{
+	const char* end = text + size;
+	p = text;
+	while (p < end)
+	{
+		line_number++;
+		line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if (!line_end) line_end = end;
+		auto comment = static_cast<const char*>(std::memchr(p, '#', line_end - p));
+		auto next = line_end < end ? line_end + 1 : end;
+		if (comment) line_end = comment;
+
+		std::string_view keyword;
+		if (word(keyword))
+		{
+			if (!statement(keyword, scene)) return false;
+			std::string_view extra;
+			if (word(extra)) return fail("unexpected '" + std::string(extra) + "'");
+			scene.statements++;
+		}
+		p = next;
+	}
+
+	if (in_object) return fail("object '" + object_name + "' has no end");
+	return true;
+}
+
+inline bool scene_parser::add_geometry(shared_ptr<hittable> object, scene_description& scene)
+{
+	if (in_object) object_members.push_back(object);
+	else scene.objects.add(object);
+	return true;
+}
+
+inline bool scene_parser::statement(std::string_view keyword, scene_description& scene)
+{
+	std::string_view name;
+
+	if (keyword == "render")
+	{
+		std::string_view option, value;
+		while (word(option))
+		{
+			if (option == "texture-cache" || option == "texture-dir")
+				return fail("option '" + std::string(option) + "' must be given on the command line");
+			scene.render_arguments.push_back("--" + std::string(option));
+			// Flags such as denoise take no value; everything else takes exactly one.
+			if (option == "denoise" || option == "resume") continue;
+			if (!word(value)) return fail("option '" + std::string(option) + "' needs a value");
+			scene.render_arguments.push_back(std::string(value));
+		}
+		return true;
+	}
+	if (keyword == "camera")
+	{
+		std::string_view key;
+		while (word(key))
+		{
+			bool ok = key == "lookfrom" ? vector(scene.lookfrom)
+				: key == "lookat" ? vector(scene.lookat)
+				: key == "up" ? vector(scene.vup)
+				: key == "vfov" ? number(scene.vfov)
+				: key == "aspect" ? number(scene.aspect_ratio)
+				: key == "aperture" ? number(scene.aperture)
+				: key == "focus" ? number(scene.focus_dist)
+				: key == "time" ? number(scene.time0) && number(scene.time1)
+				: fail("unknown camera setting '" + std::string(key) + "'");
+			if (!ok) return false;
+		}
+		if (scene.aspect_ratio <= 0) return fail("the aspect ratio must be positive");
+		return true;
+	}
+	if (keyword == "background")
+		return vector(scene.background);
+
+	if (keyword == "texture")
+	{
+		std::string_view type;
+		if (!word(name) || !word(type)) return fail("expected texture <name> <type>");
+		shared_ptr<texture> tex;
+		if (type == "solid")
+		{
+			vec3 c;
+			if (!vector(c)) return false;
+			tex = make_shared<solid_color>(c);
+		}
+		else if (type == "checker")
+		{
+			shared_ptr<texture> even, odd;
+			if (!lookup(textures, "texture", even) || !lookup(textures, "texture", odd)) return false;
+			tex = make_shared<checker_texture>(even, odd);
+		}
+		else if (type == "noise")
+		{
+			double scale;
+			if (!number(scale)) return false;
+			tex = make_shared<noise_texture>(scale);
+		}
+		else if (type == "image")
+		{
+			std::string_view file;
+			if (!word(file)) return fail("expected an image file");
+			tex = make_shared<image_texture>((directory + std::string(file)).c_str());
+		}
+		else return fail("unknown texture type '" + std::string(type) + "'");
+		textures[std::string(name)] = tex;
+		return true;
+	}
+
+	if (keyword == "material")
+	{
+		std::string_view type;
+		if (!word(name) || !word(type)) return fail("expected material <name> <type>");
+		shared_ptr<material> mat;
+		shared_ptr<texture> tex;
+		if (type == "lambertian")
+		{
+			if (!color_or_texture(tex)) return false;
+			mat = make_shared<lambertian>(tex);
+		}
+		else if (type == "metal")
+		{
+			vec3 albedo;
+			double fuzz;
+			if (!vector(albedo) || !number(fuzz)) return false;
+			mat = make_shared<metal>(albedo, fuzz);
+		}
+		else if (type == "dielectric")
+		{
+			double ior;
+			if (!number(ior)) return false;
+			mat = make_shared<dielectric>(ior);
+		}
+		else if (type == "light")
+		{
+			if (!color_or_texture(tex)) return false;
+			mat = make_shared<diffuse_light>(tex);
+		}
+		else if (type == "isotropic")
+		{
+			if (!color_or_texture(tex)) return false;
+			mat = make_shared<isotropic>(tex);
+		}
+		else return fail("unknown material type '" + std::string(type) + "'");
+		materials[std::string(name)] = mat;
+		return true;
+	}
+
+	if (keyword == "sphere" || keyword == "moving_sphere" || keyword == "box")
+	{
+		shared_ptr<material> mat;
+		if (!lookup(materials, "material", mat)) return false;
+		if (keyword == "sphere")
+		{
+			vec3 center;
+			double radius;
+			if (!vector(center) || !number(radius)) return false;
+			return add_geometry(make_shared<sphere>(center, radius, mat), scene);
+		}
+		if (keyword == "moving_sphere")
+		{
+			vec3 center0, center1;
+			double t0, t1, radius;
+			if (!vector(center0) || !vector(center1) || !number(t0) || !number(t1) || !number(radius)) return false;
+			return add_geometry(make_shared<moving_sphere>(center0, center1, t0, t1, radius, mat), scene);
+		}
+		vec3 box_min, box_max;
+		if (!vector(box_min) || !vector(box_max)) return false;
+		return add_geometry(make_shared<box>(box_min, box_max, mat), scene);
+	}
+
+	if (keyword == "rect")
+	{
+		std::string_view plane;
+		shared_ptr<material> mat;
+		double a0, a1, b0, b1, k;
+		if (!word(plane)) return fail("expected xy, xz or yz");
+		if (!lookup(materials, "material", mat) || !number(a0) || !number(a1) || !number(b0) || !number(b1) || !number(k))
+			return false;
+
+		shared_ptr<hittable> rect;
+		if (plane == "xy") rect = make_shared<xy_rect>(a0, a1, b0, b1, k, mat);
+		else if (plane == "xz") rect = make_shared<xz_rect>(a0, a1, b0, b1, k, mat);
+		else if (plane == "yz") rect = make_shared<yz_rect>(a0, a1, b0, b1, k, mat);
+		else return fail("unknown rect plane '" + std::string(plane) + "'");
+
+		auto q = p;
+		std::string_view flip;
+		if (word(flip) && flip == "flip") rect = make_shared<flip_face>(rect);
+		else p = q;
+		return add_geometry(rect, scene);
+	}
+
+	if (keyword == "mesh")
+	{
+		shared_ptr<material> mat;
+		std::string_view file;
+		if (!lookup(materials, "material", mat)) return false;
+		if (!word(file)) return fail("expected a mesh file");
+
+		// A file named twice is loaded once and its buffers shared.
+		auto& mesh = meshes[std::string(file)];
+		if (!mesh)
+		{
+			mesh = make_shared<mesh_data>();
+			if (!load_mesh(directory + std::string(file), *mesh, threads)) return fail("could not load the mesh");
+		}
+		return add_geometry(make_shared<triangle_mesh>(mesh, mat), scene);
+	}
+
+	if (keyword == "object")
+	{
+		if (in_object) return fail("objects cannot be nested");
+		if (!word(name)) return fail("expected an object name");
+		object_name = std::string(name);
+		object_members.clear();
+		in_object = true;
+		return true;
+	}
+	if (keyword == "end")
+	{
+		if (!in_object) return fail("end without object");
+		if (object_members.empty()) return fail("object '" + object_name + "' is empty");
+		in_object = false;
+		objects[object_name] = make_shared<linear_bvh>(object_members, scene.time0, scene.time1);
+		return true;
+	}
+
+	if (keyword == "instance")
+	{
+		shared_ptr<hittable> object;
+		if (!lookup(objects, "object", object)) return false;
+
+		affine_transform transform;
+		std::string_view op;
+		while (word(op))
+		{
+			affine_transform step;
+			vec3 v;
+			if (op == "translate")
+			{
+				if (!vector(v)) return false;
+				step = affine_transform::translation(v);
+			}
+			else if (op == "rotate")
+			{
+				double angle;
+				if (!number(angle) || !vector(v)) return false;
+				step = affine_transform::rotation(v, angle);
+			}
+			else if (op == "scale")
+			{
+				double s;
+				if (!number(s)) return false;
+				if (!next_is_number()) v = vec3(s, s, s);
+				else
+				{
+					double sy, sz;
+					if (!number(sy) || !number(sz)) return false;
+					v = vec3(s, sy, sz);
+				}
+				step = affine_transform::scaling(v);
+			}
+			else if (op == "matrix")
+			{
+				for (int i = 0; i < 3; i++)
+					for (int j = 0; j < 4; j++)
+						if (!number(step.m[i][j])) return false;
+			}
+			else return fail("unknown transform '" + std::string(op) + "'");
+			transform = step * transform;
+		}
+
+		affine_transform inverse;
+		if (!transform.inverse(inverse)) return fail("the transform is singular");
+		return add_geometry(make_shared<instance>(object, transform), scene);
+	}
+
+	if (keyword == "medium")
+	{
+		shared_ptr<hittable> boundary;
+		shared_ptr<texture> tex;
+		double density;
+		if (!lookup(objects, "object", boundary) || !number(density) || !color_or_texture(tex)) return false;
+		if (density <= 0) return fail("the density must be positive");
+		return add_geometry(make_shared<constant_medium>(boundary, density, tex), scene);
+	}
+
+	return fail("unknown statement '" + std::string(keyword) + "'");
+}
+
+// Loads a scene file into scene, reading meshes with up to threads threads.
+inline bool load_scene(const std::string& path, scene_description& scene, int threads)
+{
+	mapped_file file;
+	if (!file.open(path, true))
+	{
+		std::cerr << "Could not open '" << path << "'.\n";
+		return false;
+	}
+	return scene_parser(path, threads).parse(reinterpret_cast<const char*>(file.data()), file.size(), scene);
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct tile
+{
+	int x0, y0;
+	int x1, y1;
+
+	int width() const { return x1 - x0; }
+	int height() const { return y1 - y0; }
+};
+
+inline unsigned int morton_decode_x(unsigned int code)
+{
+	code &= 0x55555555;
+	code = (code ^ (code >> 1)) & 0x33333333;
+	code = (code ^ (code >> 2)) & 0x0f0f0f0f;
+	code = (code ^ (code >> 4)) & 0x00ff00ff;
+	code = (code ^ (code >> 8)) & 0x0000ffff;
+	return code;
+}
+
+// Cuts the image into square tiles and hands them out to worker threads.
+// Each worker owns a deque of tiles, pops from its front and steals from the
+// back of other workers' deques once its own is empty.
+class tile_scheduler
+{
+public:
+	tile_scheduler(int image_width, int image_height, int _tile_size = 16);
+
+	int tile_size() const { return tile_edge; }
+	const std::vector<tile>& tiles() const { return all_tiles; }
+
+	// Visits every pixel of the tile in Morton order, so neighbouring samples stay close in memory.
+	template <typename F>
+	void for_each_pixel(const tile& t, F&& f) const
+	{
+		for (auto code : morton_table)
+		{
+			int i = t.x0 + static_cast<int>(morton_decode_x(code));
+			int j = t.y0 + static_cast<int>(morton_decode_x(code >> 1));
+			if (i < t.x1 && j < t.y1)
+				f(i, j);
+		}
+	}
+
+	void run(int thread_count, const std::function<void(const tile&, int)>& render_tile);
+
+	void run(int thread_count, const std::vector<tile>& work, const std::function<void(const tile&, int)>& render_tile);
+
+private:
+	struct worker_queue
+	{
+		std::mutex lock;
+		std::deque<int> tiles;
+	};
+
+	bool next_tile(std::vector<worker_queue>& queues, int worker, int& tile_index) const;
+
+	int tile_edge;
+	std::vector<tile> all_tiles;
+	std::vector<unsigned int> morton_table;
+};
+
+inline tile_scheduler::tile_scheduler(int image_width, int image_height, int _tile_size)
+	: tile_edge(_tile_size)
+{
+	for (int y = 0; y < image_height; y += tile_edge)
+		for (int x = 0; x < image_width; x += tile_edge)
+			all_tiles.push_back({ x, y, std::min(x + tile_edge, image_width), std::min(y + tile_edge, image_height) });
+
+	int pow2 = 1;
+	while (pow2 < tile_edge) pow2 *= 2;
+
+	for (unsigned int code = 0; code < static_cast<unsigned int>(pow2 * pow2); code++)
+	{
+		auto x = static_cast<int>(morton_decode_x(code));
+		auto y = static_cast<int>(morton_decode_x(code >> 1));
+		if (x < tile_edge && y < tile_edge)
+			morton_table.push_back(code);
+	}
+}
+
+inline bool tile_scheduler::next_tile(std::vector<worker_queue>& queues, int worker, int& tile_index) const
+{
+	{
+		std::lock_guard<std::mutex> guard(queues[worker].lock);
+		if (!queues[worker].tiles.empty())
+		{
+			tile_index = queues[worker].tiles.front();
+			queues[worker].tiles.pop_front();
+			return true;
+		}
+	}
+
+	auto count = static_cast<int>(queues.size());
+	for (int offset = 1; offset < count; offset++)
+	{
+		auto& victim = queues[(worker + offset) % count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tiles.empty())
+		{
+			tile_index = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void tile_scheduler::run(int thread_count, const std::function<void(const tile&, int)>& render_tile)
+{
+	run(thread_count, all_tiles, render_tile);
+}
+
+inline void tile_scheduler::run(int thread_count, const std::vector<tile>& work, const std::function<void(const tile&, int)>& render_tile)
+{
+	if (thread_count < 1) thread_count = 1;
+	auto tile_count = static_cast<int>(work.size());
+
+	// Contiguous runs of tiles per worker keep each thread on a compact region of the image.
+	std::vector<worker_queue> queues(thread_count);
+	for (int t = 0; t < tile_count; t++)
+		queues[static_cast<size_t>(t) * thread_count / tile_count].tiles.push_back(t);
+
+	std::atomic<int> tiles_done = 0;
+	std::mutex progress_lock;
+
+	auto worker_main = [&](int worker) {
+		int tile_index;
+		while (next_tile(queues, worker, tile_index))
+		{
+			render_tile(work[tile_index], worker);
+
+			auto done = ++tiles_done;
+			std::lock_guard<std::mutex> guard(progress_lock);
+			std::cerr << "\rTiles remaining: " << tile_count - done << ' ' << std::flush;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int w = 1; w < thread_count; w++)
+		workers.emplace_back(worker_main, w);
+	worker_main(0);
+
+	for (auto& w : workers)
+		w.join();
+}
+
+// Runs body(begin, end) over [0, count) in chunks handed out to thread_count threads.
+inline void parallel_for(size_t count, int thread_count, const std::function<void(size_t, size_t)>& body, size_t chunk = 1024)
+{
+	if (thread_count < 1) thread_count = 1;
+	auto chunk_count = (count + chunk - 1) / chunk;
+	if (thread_count == 1 || chunk_count <= 1)
+	{
+		if (count > 0) body(0, count);
+		return;
+	}
+
+	std::atomic<size_t> next_chunk = 0;
+	auto worker_main = [&]() {
+		size_t c;
+		while ((c = next_chunk++) < chunk_count)
+			body(c * chunk, std::min(count, (c + 1) * chunk));
+	};
+
+	std::vector<std::thread> workers;
+	for (int w = 1; w < thread_count && static_cast<size_t>(w) < chunk_count; w++)
+		workers.emplace_back(worker_main);
+	worker_main();
+
+	for (auto& w : workers)
+		w.join();
+}
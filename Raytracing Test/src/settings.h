@@ -0,0 +1,193 @@
+#pragma once
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "stats.h"
+
+struct render_settings
+{
+	int image_width = 500;
+	int samples_per_pixel = 1000;
+	int max_depth = 50;
+	int rr_depth = 5;
+	int threads = static_cast<int>(std::thread::hardware_concurrency());
+	std::string bvh = "binary";
+	int packet_size = 0;
+	std::string integrator = "megakernel";
+	size_t wave_size = 1 << 18;
+	std::string output;
+	int pass_samples = 0;
+	std::string checkpoint;
+	bool resume = false;
+	double adaptive_threshold = 0;
+	int min_samples = 16;
+	bool denoise = false;
+	std::string reference;
+	std::string mesh;
+	std::string scene;
+	std::string save_snapshot;
+	size_t texture_cache_mb = 256;
+	std::string texture_dir;
+	std::string bench;
+	size_t bench_spheres = 1000000;
+	std::string stats;
+	std::string cost_map;
+	std::string cost_metric = "time";
+};
+
+inline void print_usage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [options] [> image.ppm]\n"
+		<< "  --width <n>      image width in pixels (default 500)\n"
+		<< "  --spp <n>        samples per pixel (default 1000)\n"
+		<< "  --depth <n>      maximum path depth (default 50)\n"
+		<< "  --rr-depth <n>   bounces before Russian roulette may end a path (default 5)\n"
+		<< "  --threads <n>    worker threads (default: all cores)\n"
+		<< "  --bvh <mode>     binary, wide4 or wide8 (default binary)\n"
+		<< "  --packet <n>     trace camera rays in packets of 4, 8 or 16 (default 0: single rays)\n"
+		<< "  --integrator <m> megakernel or wavefront (default megakernel)\n"
+		<< "  --wave-size <n>  paths in flight per wavefront wave (default 262144)\n"
+		<< "  --output <file>  write .ppm, .pfm, .png or .exr (default: binary PPM on stdout)\n"
+		<< "  --pass-spp <n>   render progressively in passes of n samples per pixel (default 0: one pass)\n"
+		<< "  --checkpoint <f> keep the accumulated passes in file f\n"
+		<< "  --resume         continue from the last completed pass in the checkpoint\n"
+		<< "  --adaptive <e>   sample tiles in rounds until their relative error is below e (default 0: off)\n"
+		<< "  --min-spp <n>    samples per pixel in each adaptive round (default 16); --spp is the maximum\n"
+		<< "  --denoise        filter the final image guided by first hit albedo, normal and depth\n"
+		<< "  --reference <f>  report render time and relative MSE against the .pfm reference f\n"
+		<< "  --mesh <file>    put the .obj or .ply mesh in place of the glass sphere\n"
+		<< "  --scene <file>   render the scene file or snapshot instead of the built in Cornell box\n"
+		<< "  --save-snapshot <f> save the compiled scene and its BVH to f for --scene, then exit\n"
+		<< "  --texture-cache <mb> memory for image texture tiles, shared by all threads (default 256)\n"
+		<< "  --texture-dir <d> keep images converted to tiled mip pyramids in d for later runs (default: temporary)\n"
+		<< "  --bench <file>   run the microbenchmarks and write their results to file as JSON (- for stdout), then exit; builds with\n"
+		<< "                   RT_COUNT_ALLOCATIONS first check that shading paths makes no heap allocations\n"
+		<< "  --bench-spheres <n> largest sphere cloud the BVH benchmarks build, 1000 to 10000000 (default 1000000)\n"
+		<< "  --stats <file>   write ray, BVH, primitive, material and path depth counts to file as JSON (needs RT_STATS)\n"
+		<< "  --cost-map <f>   write the render cost of every pixel per sample to f as a heat map\n"
+		<< "  --cost-metric <m> time in nanoseconds or BVH nodes visited (needs RT_STATS) for --cost-map (default time)\n";
+}
+
+// Reads options into settings without checking them, so options from a scene file's render
+// statements can be merged in before validate_settings sees the result.
+inline bool parse_arguments(int argc, char** argv, render_settings& settings)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+		const char* value = nullptr;
+
+		if (arg == "--width" && (value = next())) settings.image_width = std::atoi(value);
+		else if (arg == "--spp" && (value = next())) settings.samples_per_pixel = std::atoi(value);
+		else if (arg == "--depth" && (value = next())) settings.max_depth = std::atoi(value);
+		else if (arg == "--rr-depth" && (value = next())) settings.rr_depth = std::atoi(value);
+		else if (arg == "--threads" && (value = next())) settings.threads = std::atoi(value);
+		else if (arg == "--bvh" && (value = next())) settings.bvh = value;
+		else if (arg == "--packet" && (value = next())) settings.packet_size = std::atoi(value);
+		else if (arg == "--integrator" && (value = next())) settings.integrator = value;
+		else if (arg == "--wave-size" && (value = next())) settings.wave_size = std::strtoull(value, nullptr, 10);
+		else if (arg == "--output" && (value = next())) settings.output = value;
+		else if (arg == "--pass-spp" && (value = next())) settings.pass_samples = std::atoi(value);
+		else if (arg == "--checkpoint" && (value = next())) settings.checkpoint = value;
+		else if (arg == "--resume") settings.resume = true;
+		else if (arg == "--adaptive" && (value = next())) settings.adaptive_threshold = std::atof(value);
+		else if (arg == "--min-spp" && (value = next())) settings.min_samples = std::atoi(value);
+		else if (arg == "--denoise") settings.denoise = true;
+		else if (arg == "--reference" && (value = next())) settings.reference = value;
+		else if (arg == "--mesh" && (value = next())) settings.mesh = value;
+		else if (arg == "--scene" && (value = next())) settings.scene = value;
+		else if (arg == "--save-snapshot" && (value = next())) settings.save_snapshot = value;
+		else if (arg == "--texture-cache" && (value = next())) settings.texture_cache_mb = std::strtoull(value, nullptr, 10);
+		else if (arg == "--texture-dir" && (value = next())) settings.texture_dir = value;
+		else if (arg == "--bench" && (value = next())) settings.bench = value;
+		else if (arg == "--bench-spheres" && (value = next())) settings.bench_spheres = std::strtoull(value, nullptr, 10);
+		else if (arg == "--stats" && (value = next())) settings.stats = value;
+		else if (arg == "--cost-map" && (value = next())) settings.cost_map = value;
+		else if (arg == "--cost-metric" && (value = next())) settings.cost_metric = value;
+		else
+		{
+			print_usage(argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool validate_settings(const render_settings& settings, const char* program)
+{
+	if (settings.bvh != "binary" && settings.bvh != "wide4" && settings.bvh != "wide8")
+	{
+		std::cerr << "Unknown BVH mode '" << settings.bvh << "'.\n";
+		return false;
+	}
+	if (settings.integrator != "megakernel" && settings.integrator != "wavefront")
+	{
+		std::cerr << "Unknown integrator '" << settings.integrator << "'.\n";
+		return false;
+	}
+	if (settings.packet_size != 0 && settings.packet_size != 4 && settings.packet_size != 8 && settings.packet_size != 16)
+	{
+		std::cerr << "Packet size must be 0, 4, 8 or 16.\n";
+		return false;
+	}
+	if (!settings.mesh.empty() && !settings.scene.empty())
+	{
+		std::cerr << "--mesh only applies to the built in scene; scene files load meshes with a mesh statement.\n";
+		return false;
+	}
+	if (settings.resume && settings.checkpoint.empty())
+	{
+		std::cerr << "--resume needs --checkpoint.\n";
+		return false;
+	}
+	if (settings.pass_samples < 0 || settings.pass_samples > settings.samples_per_pixel)
+	{
+		std::cerr << "--pass-spp must be between 0 and --spp.\n";
+		return false;
+	}
+	if (settings.adaptive_threshold < 0)
+	{
+		std::cerr << "--adaptive must not be negative.\n";
+		return false;
+	}
+	// min_samples is only read by adaptive sampling, so other renders may use fewer samples than it.
+	if (settings.adaptive_threshold > 0 && (settings.min_samples < 2 || settings.min_samples > settings.samples_per_pixel))
+	{
+		std::cerr << "--min-spp must be between 2 and --spp with --adaptive.\n";
+		return false;
+	}
+	if (settings.cost_metric != "time" && settings.cost_metric != "nodes")
+	{
+		std::cerr << "Unknown cost metric '" << settings.cost_metric << "'.\n";
+		return false;
+	}
+	if (!stats_enabled && (!settings.stats.empty() || settings.cost_metric == "nodes"))
+	{
+		std::cerr << "--stats and --cost-metric nodes need a build with RT_STATS defined.\n";
+		return false;
+	}
+	if (!settings.cost_map.empty() && (settings.integrator != "megakernel" || settings.packet_size != 0))
+	{
+		std::cerr << "--cost-map times pixels one at a time, so it needs the megakernel integrator without --packet.\n";
+		return false;
+	}
+	if (settings.bench_spheres < 1000 || settings.bench_spheres > 10000000)
+	{
+		std::cerr << "--bench-spheres must be between 1000 and 10000000.\n";
+		return false;
+	}
+	if (settings.texture_cache_mb < 1)
+	{
+		std::cerr << "--texture-cache must be at least 1 MB.\n";
+		return false;
+	}
+	if (settings.image_width < 2 || settings.samples_per_pixel < 1 || settings.max_depth < 1 || settings.rr_depth < 0 || settings.wave_size < 1)
+	{
+		print_usage(program);
+		return false;
+	}
+	return true;
+}
@@ -4,6 +4,28 @@
 #include <memory>
 #include <cstdlib>
 
+#include "sampler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_SSE 1
+#include <immintrin.h>
+#else
+#define RT_SSE 0
+#endif
+
+#if defined(__AVX__)
+#define RT_AVX 1
+#else
+#define RT_AVX 0
+#endif
+
+// Scalar type of the geometry core. Define RT_USE_FLOAT to build the renderer in single precision.
+#if defined(RT_USE_FLOAT)
+using real = float;
+#else
+using real = double;
+#endif
+
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
@@ -12,7 +34,7 @@ const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
 
 inline double degrees_to_radians(double degrees) { return degrees * pi / 180.0; }
-inline double random_double() { return rand() / (RAND_MAX + 1.0); }
+inline double random_double() { return thread_sampler().next_double(); }
 inline double random_double(double min, double max) { return min + (max - min) * random_double(); }
 inline int random_int(int min, int max) { return static_cast<int>(random_double(min, max + 1)); }
 
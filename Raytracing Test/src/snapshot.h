@@ -0,0 +1,686 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shared.h"
+#include "aarect.h"
+#include "bvh.h"
+#include "compiled_scene.h"
+#include "flat_array.h"
+#include "hittable.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "scene_file.h"
+#include "sphere.h"
+#include "texture.h"
+
+// A compiled scene and its BVH saved as they sit in memory. The file is a header, then arrays of
+// plain data each starting on a 64 byte boundary, then a table giving every array's offset from
+// the start of the file, element count and element size. Nothing in the file is a pointer, so it
+// loads wherever it is mapped: the arrays of the compiled scene, its meshes and its BVH nodes
+// become views into one read only mapping, which processes on the same host share page for page.
+// Only materials, textures and the shapes of lights are built again, from small descriptions.
+//
+// A snapshot is a cache of a scene, not an interchange format. It is only read by a build with
+// the same version, byte order and precision of real, and only scenes whose every primitive has
+// a compiled form, or is a linear_bvh saved alongside, can be saved.
+struct snapshot_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t real_size;
+	uint32_t array_count;
+	uint64_t table_offset;
+	uint64_t file_size;
+};
+
+struct snapshot_array
+{
+	uint64_t offset;
+	uint64_t count;
+	uint32_t element_size;
+	uint32_t reserved;
+};
+
+// The camera, background and render options of a scene_description, and how many of each part follow.
+struct snapshot_view
+{
+	point3 lookfrom, lookat;
+	vec3 vup;
+	color background;
+	double vfov, aspect_ratio, aperture, focus_dist, time0, time1;
+	uint64_t statements;
+	uint32_t render_arguments, textures, materials, meshes, bvhs;
+};
+
+enum class snapshot_texture_kind : uint32_t { solid, checker, noise, image };
+
+// Solid colors keep their color in value, noise its scale in value[0], and checkers name their
+// two textures, which always come earlier. Noise is followed by its tables, an image by its filename.
+struct snapshot_texture
+{
+	snapshot_texture_kind kind;
+	uint32_t even, odd;
+	double value[3];
+};
+
+enum class snapshot_material_kind : uint32_t { lambertian, metal, dielectric, diffuse_light, isotropic };
+
+// The texture for materials that have one; metal keeps its albedo and fuzz in value, dielectric its index.
+struct snapshot_material
+{
+	snapshot_material_kind kind;
+	uint32_t texture;
+	double value[4];
+};
+
+// Each BVH is followed by its nodes, primitive indices and compiled scene arrays, and then the
+// meshes, BVHs and materials its scene refers to, as indices into the snapshot's own lists.
+struct snapshot_bvh
+{
+	aabb box;
+	bvh_build_stats stats;
+	int32_t packet_min_active;
+};
+
+constexpr char snapshot_magic[8] = "RTSNAPS";
+constexpr uint32_t snapshot_version = 1;
+constexpr uint32_t snapshot_byte_order = 0x01020304;
+constexpr uint64_t snapshot_alignment = 64;
+
+// Gathers what a scene refers to, children before parents, then writes it in the order the
+// reader expects. Every array goes through write(), which pads it to the alignment and lists it.
+class snapshot_writer
+{
+public:
+	bool save(const std::string& path, const linear_bvh& bvh, const scene_description& scene);
+
+private:
+	bool gather(const linear_bvh& bvh);
+	bool gather(const shared_ptr<material>& mat);
+	bool gather(const shared_ptr<texture>& tex);
+	bool unsupported(const std::string& what);
+
+	template <class T>
+	void write(const T* data, size_t count);
+	template <class T>
+	void write(const flat_array<T>& items) { write(items.data(), items.size()); }
+	template <class T>
+	void write(const std::vector<T>& items) { write(items.data(), items.size()); }
+
+	std::ofstream file;
+	uint64_t position = 0;
+	std::vector<snapshot_array> table;
+
+	std::vector<const linear_bvh*> bvhs;
+	std::vector<shared_ptr<material>> materials;
+	std::vector<shared_ptr<texture>> textures;
+	std::vector<shared_ptr<const mesh_data>> meshes;
+	std::unordered_map<const hittable*, uint32_t> bvh_ids;
+	std::unordered_map<const material*, uint32_t> material_ids;
+	std::unordered_map<const texture*, uint32_t> texture_ids;
+	std::unordered_map<const mesh_data*, uint32_t> mesh_ids;
+};
+
+inline bool snapshot_writer::unsupported(const std::string& what)
+{
+	std::cerr << "Cannot save a snapshot: " << what << " has no saved form.\n";
+	return false;
+}
+
+inline bool snapshot_writer::gather(const shared_ptr<texture>& tex)
+{
+	if (texture_ids.count(tex.get())) return true;
+
+	if (auto checker = dynamic_cast<const checker_texture*>(tex.get()))
+	{
+		if (!gather(checker->even) || !gather(checker->odd)) return false;
+	}
+	else if (!dynamic_cast<const solid_color*>(tex.get()) && !dynamic_cast<const noise_texture*>(tex.get())
+		&& !dynamic_cast<const image_texture*>(tex.get()))
+		return unsupported("a texture");
+
+	texture_ids[tex.get()] = static_cast<uint32_t>(textures.size());
+	textures.push_back(tex);
+	return true;
+}
+
+inline bool snapshot_writer::gather(const shared_ptr<material>& mat)
+{
+	if (material_ids.count(mat.get())) return true;
+
+	bool ok = true;
+	if (auto m = dynamic_cast<const lambertian*>(mat.get())) ok = gather(m->albedo);
+	else if (auto m = dynamic_cast<const diffuse_light*>(mat.get())) ok = gather(m->emit);
+	else if (auto m = dynamic_cast<const isotropic*>(mat.get())) ok = gather(m->albedo);
+	else if (!dynamic_cast<const metal*>(mat.get()) && !dynamic_cast<const dielectric*>(mat.get()))
+		return unsupported("a material");
+	if (!ok) return false;
+
+	material_ids[mat.get()] = static_cast<uint32_t>(materials.size());
+	materials.push_back(mat);
+	return true;
+}
+
+inline bool snapshot_writer::gather(const linear_bvh& bvh)
+{
+	if (bvh_ids.count(&bvh)) return true;
+
+	const auto& scene = *bvh.scene;
+	for (const auto& object : scene.generics)
+	{
+		auto child = dynamic_cast<const linear_bvh*>(object.get());
+		if (!child) return unsupported("a primitive without a compiled form");
+		if (!gather(*child)) return false;
+	}
+	for (const auto& mat : scene.materials)
+		if (!gather(mat)) return false;
+	for (const auto& mesh : scene.meshes)
+		if (!mesh_ids.count(mesh.get()))
+		{
+			mesh_ids[mesh.get()] = static_cast<uint32_t>(meshes.size());
+			meshes.push_back(mesh);
+		}
+
+	bvh_ids[&bvh] = static_cast<uint32_t>(bvhs.size());
+	bvhs.push_back(&bvh);
+	return true;
+}
+
+template <class T>
+void snapshot_writer::write(const T* data, size_t count)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "only plain data is saved byte for byte");
+
+	static const char zeros[snapshot_alignment] = {};
+	auto padding = (snapshot_alignment - position % snapshot_alignment) % snapshot_alignment;
+	file.write(zeros, padding);
+	position += padding;
+
+	table.push_back({ position, count, static_cast<uint32_t>(sizeof(T)), 0 });
+	file.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+	position += count * sizeof(T);
+}
+
+inline bool snapshot_writer::save(const std::string& path, const linear_bvh& bvh, const scene_description& scene)
+{
+	if (!bvh.scene || !gather(bvh)) return false;
+
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cerr << "Could not create snapshot '" << path << "'.\n";
+		return false;
+	}
+
+	snapshot_header header = {};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	position = sizeof(header);
+
+	snapshot_view view = {};
+	view.lookfrom = scene.lookfrom;
+	view.lookat = scene.lookat;
+	view.vup = scene.vup;
+	view.background = scene.background;
+	view.vfov = scene.vfov;
+	view.aspect_ratio = scene.aspect_ratio;
+	view.aperture = scene.aperture;
+	view.focus_dist = scene.focus_dist;
+	view.time0 = scene.time0;
+	view.time1 = scene.time1;
+	view.statements = scene.statements;
+	view.render_arguments = static_cast<uint32_t>(scene.render_arguments.size());
+	view.textures = static_cast<uint32_t>(textures.size());
+	view.materials = static_cast<uint32_t>(materials.size());
+	view.meshes = static_cast<uint32_t>(meshes.size());
+	view.bvhs = static_cast<uint32_t>(bvhs.size());
+	write(&view, 1);
+	for (const auto& argument : scene.render_arguments)
+		write(argument.c_str(), argument.size() + 1);
+
+	for (const auto& tex : textures)
+	{
+		snapshot_texture record = {};
+		if (auto solid = dynamic_cast<const solid_color*>(tex.get()))
+		{
+			record.kind = snapshot_texture_kind::solid;
+			for (int i = 0; i < 3; i++) record.value[i] = solid->color_value[i];
+			write(&record, 1);
+		}
+		else if (auto checker = dynamic_cast<const checker_texture*>(tex.get()))
+		{
+			record.kind = snapshot_texture_kind::checker;
+			record.even = texture_ids[checker->even.get()];
+			record.odd = texture_ids[checker->odd.get()];
+			write(&record, 1);
+		}
+		else if (auto noise = dynamic_cast<const noise_texture*>(tex.get()))
+		{
+			record.kind = snapshot_texture_kind::noise;
+			record.value[0] = noise->scale;
+			write(&record, 1);
+			write(noise->noise.vectors(), perlin::point_count);
+			for (int axis = 0; axis < 3; axis++)
+				write(noise->noise.permutation(axis), perlin::point_count);
+		}
+		else
+		{
+			auto image = dynamic_cast<const image_texture*>(tex.get());
+			record.kind = snapshot_texture_kind::image;
+			write(&record, 1);
+			write(image->filename.c_str(), image->filename.size() + 1);
+		}
+	}
+
+	for (const auto& mat : materials)
+	{
+		snapshot_material record = {};
+		if (auto m = dynamic_cast<const lambertian*>(mat.get()))
+		{
+			record.kind = snapshot_material_kind::lambertian;
+			record.texture = texture_ids[m->albedo.get()];
+		}
+		else if (auto m = dynamic_cast<const metal*>(mat.get()))
+		{
+			record.kind = snapshot_material_kind::metal;
+			for (int i = 0; i < 3; i++) record.value[i] = m->albedo[i];
+			record.value[3] = m->fuzz;
+		}
+		else if (auto m = dynamic_cast<const dielectric*>(mat.get()))
+		{
+			record.kind = snapshot_material_kind::dielectric;
+			record.value[0] = m->ior;
+		}
+		else if (auto m = dynamic_cast<const diffuse_light*>(mat.get()))
+		{
+			record.kind = snapshot_material_kind::diffuse_light;
+			record.texture = texture_ids[m->emit.get()];
+		}
+		else
+		{
+			record.kind = snapshot_material_kind::isotropic;
+			record.texture = texture_ids[dynamic_cast<const isotropic*>(mat.get())->albedo.get()];
+		}
+		write(&record, 1);
+	}
+
+	for (const auto& mesh : meshes)
+	{
+		write(mesh->positions);
+		write(mesh->normals);
+		write(mesh->uvs);
+		write(mesh->indices);
+		write(mesh->normal_indices);
+		write(mesh->uv_indices);
+	}
+
+	for (auto b : bvhs)
+	{
+		const auto& s = *b->scene;
+		snapshot_bvh record = {};
+		record.box = b->box;
+		record.stats = b->stats;
+		record.packet_min_active = b->packet_min_active;
+		write(&record, 1);
+
+		write(b->nodes);
+		write(b->prim_indices);
+		write(s.prims);
+		write(s.spheres);
+		write(s.moving_spheres);
+		for (int axis = 0; axis < 3; axis++)
+			write(s.rects[axis]);
+		write(s.boxes);
+		write(s.media);
+		write(s.translates);
+		write(s.rotations);
+		write(s.triangles);
+		write(s.instances);
+		write(s.emitter_prims);
+
+		std::vector<uint32_t> ids;
+		for (const auto& mesh : s.meshes) ids.push_back(mesh_ids[mesh.get()]);
+		write(ids);
+		ids.clear();
+		for (const auto& object : s.generics) ids.push_back(bvh_ids[object.get()]);
+		write(ids);
+		ids.clear();
+		for (const auto& mat : s.materials) ids.push_back(material_ids[mat.get()]);
+		write(ids);
+	}
+
+	// The table goes last, once every array's place is known, and the header is filled in to point at it.
+	auto entries = table;
+	write(entries.data(), entries.size());
+	std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+	header.version = snapshot_version;
+	header.byte_order = snapshot_byte_order;
+	header.real_size = sizeof(real);
+	header.array_count = static_cast<uint32_t>(entries.size());
+	header.table_offset = table.back().offset;
+	header.file_size = position;
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Could not write snapshot '" << path << "'.\n";
+		return false;
+	}
+	return true;
+}
+
+// Saves a scene, compiled into bvh, so that load_snapshot can render it without building it again.
+inline bool save_snapshot(const std::string& path, const linear_bvh& bvh, const scene_description& scene)
+{
+	return snapshot_writer().save(path, bvh, scene);
+}
+
+// Hands out the arrays of a mapped snapshot in the order they were written, checking each one's
+// element size and extent against the file.
+class snapshot_reader
+{
+public:
+	bool open(const std::string& path, scene_description& scene, shared_ptr<linear_bvh>& bvh);
+
+private:
+	template <class T>
+	bool next(const T*& data, size_t& count);
+	template <class T>
+	bool next(flat_array<T>& items);
+	template <class T>
+	bool next_one(T& item);
+	bool corrupt();
+
+	std::string path;
+	shared_ptr<mapped_file> file;
+	const snapshot_array* table = nullptr;
+	size_t array_count = 0;
+	size_t next_array = 0;
+};
+
+inline bool snapshot_reader::corrupt()
+{
+	std::cerr << "Snapshot '" << path << "' is damaged.\n";
+	return false;
+}
+
+template <class T>
+bool snapshot_reader::next(const T*& data, size_t& count)
+{
+	if (next_array >= array_count) return corrupt();
+	const auto& entry = table[next_array++];
+	if (entry.element_size != sizeof(T) || entry.offset % snapshot_alignment != 0 || entry.offset > file->size()
+		|| entry.count > (file->size() - entry.offset) / sizeof(T))
+		return corrupt();
+
+	data = reinterpret_cast<const T*>(file->data() + entry.offset);
+	count = static_cast<size_t>(entry.count);
+	return true;
+}
+
+template <class T>
+bool snapshot_reader::next(flat_array<T>& items)
+{
+	const T* data;
+	size_t count;
+	if (!next(data, count)) return false;
+	items.view(data, count);
+	return true;
+}
+
+template <class T>
+bool snapshot_reader::next_one(T& item)
+{
+	const T* data;
+	size_t count;
+	if (!next(data, count) || count != 1) return corrupt();
+	item = *data;
+	return true;
+}
+
+// Builds the authoring shape of a light again, so light_set can sample it; lights of other shapes
+// were skipped when the scene was built, and are skipped again here.
+inline shared_ptr<hittable> snapshot_light_shape(const compiled_scene& scene, prim_ref ref)
+{
+	shared_ptr<hittable> shape;
+	switch (ref.type)
+	{
+	case prim_type::sphere:
+	{
+		const auto& s = scene.spheres[ref.index];
+		shape = make_shared<sphere>(s.center, s.radius, scene.materials[s.material]);
+		break;
+	}
+	case prim_type::yz_rect:
+	{
+		const auto& r = scene.rects[0][ref.index];
+		shape = make_shared<yz_rect>(r.a0, r.a1, r.b0, r.b1, r.k, scene.materials[r.material]);
+		break;
+	}
+	case prim_type::xz_rect:
+	{
+		const auto& r = scene.rects[1][ref.index];
+		shape = make_shared<xz_rect>(r.a0, r.a1, r.b0, r.b1, r.k, scene.materials[r.material]);
+		break;
+	}
+	case prim_type::xy_rect:
+	{
+		const auto& r = scene.rects[2][ref.index];
+		shape = make_shared<xy_rect>(r.a0, r.a1, r.b0, r.b1, r.k, scene.materials[r.material]);
+		break;
+	}
+	case prim_type::translate:
+	{
+		const auto& t = scene.translates[ref.index];
+		if (auto child = snapshot_light_shape(scene, t.child))
+			shape = make_shared<translate>(child, t.offset);
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (shape && ref.flip) shape = make_shared<flip_face>(shape);
+	return shape;
+}
+
+inline bool snapshot_reader::open(const std::string& _path, scene_description& scene, shared_ptr<linear_bvh>& bvh)
+{
+	path = _path;
+	file = make_shared<mapped_file>();
+	if (!file->open(path, true))
+	{
+		std::cerr << "Could not open snapshot '" << path << "'.\n";
+		return false;
+	}
+
+	snapshot_header header;
+	if (file->size() < sizeof(header)) return corrupt();
+	std::memcpy(&header, file->data(), sizeof(header));
+	if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 || header.version != snapshot_version
+		|| header.byte_order != snapshot_byte_order || header.real_size != sizeof(real))
+	{
+		std::cerr << "'" << path << "' is not a snapshot written by this version and build.\n";
+		return false;
+	}
+	if (header.file_size != file->size() || header.table_offset % snapshot_alignment != 0 || header.table_offset > file->size()
+		|| header.array_count > (file->size() - header.table_offset) / sizeof(snapshot_array))
+		return corrupt();
+	table = reinterpret_cast<const snapshot_array*>(file->data() + header.table_offset);
+	array_count = header.array_count;
+
+	snapshot_view view;
+	if (!next_one(view)) return false;
+	scene.lookfrom = view.lookfrom;
+	scene.lookat = view.lookat;
+	scene.vup = view.vup;
+	scene.background = view.background;
+	scene.vfov = view.vfov;
+	scene.aspect_ratio = view.aspect_ratio;
+	scene.aperture = view.aperture;
+	scene.focus_dist = view.focus_dist;
+	scene.time0 = view.time0;
+	scene.time1 = view.time1;
+	scene.statements = static_cast<size_t>(view.statements);
+
+	for (uint32_t i = 0; i < view.render_arguments; i++)
+	{
+		const char* text;
+		size_t length;
+		if (!next(text, length) || length == 0 || text[length - 1] != 0) return corrupt();
+		scene.render_arguments.push_back(text);
+	}
+
+	std::vector<shared_ptr<texture>> textures;
+	for (uint32_t i = 0; i < view.textures; i++)
+	{
+		snapshot_texture record;
+		if (!next_one(record)) return false;
+		switch (record.kind)
+		{
+		case snapshot_texture_kind::solid:
+			textures.push_back(make_shared<solid_color>(record.value[0], record.value[1], record.value[2]));
+			break;
+		case snapshot_texture_kind::checker:
+			if (record.even >= i || record.odd >= i) return corrupt();
+			textures.push_back(make_shared<checker_texture>(textures[record.even], textures[record.odd]));
+			break;
+		case snapshot_texture_kind::noise:
+		{
+			const vec3* vectors;
+			const int* perms[3];
+			size_t count[4];
+			if (!next(vectors, count[3])) return false;
+			for (int axis = 0; axis < 3; axis++)
+				if (!next(perms[axis], count[axis])) return false;
+			for (auto c : count)
+				if (c != perlin::point_count) return corrupt();
+
+			auto noise = make_shared<noise_texture>(record.value[0]);
+			noise->noise.restore(vectors, perms[0], perms[1], perms[2]);
+			textures.push_back(noise);
+			break;
+		}
+		case snapshot_texture_kind::image:
+		{
+			const char* filename;
+			size_t length;
+			if (!next(filename, length) || length == 0 || filename[length - 1] != 0) return corrupt();
+			textures.push_back(make_shared<image_texture>(filename));
+			break;
+		}
+		default:
+			return corrupt();
+		}
+	}
+
+	std::vector<shared_ptr<material>> materials;
+	for (uint32_t i = 0; i < view.materials; i++)
+	{
+		snapshot_material record;
+		if (!next_one(record)) return false;
+		bool textured = record.kind == snapshot_material_kind::lambertian || record.kind == snapshot_material_kind::diffuse_light
+			|| record.kind == snapshot_material_kind::isotropic;
+		if (textured && record.texture >= textures.size()) return corrupt();
+
+		switch (record.kind)
+		{
+		case snapshot_material_kind::lambertian: materials.push_back(make_shared<lambertian>(textures[record.texture])); break;
+		case snapshot_material_kind::metal:
+			materials.push_back(make_shared<metal>(color(record.value[0], record.value[1], record.value[2]), record.value[3]));
+			break;
+		case snapshot_material_kind::dielectric: materials.push_back(make_shared<dielectric>(record.value[0])); break;
+		case snapshot_material_kind::diffuse_light: materials.push_back(make_shared<diffuse_light>(textures[record.texture])); break;
+		case snapshot_material_kind::isotropic: materials.push_back(make_shared<isotropic>(textures[record.texture])); break;
+		default: return corrupt();
+		}
+	}
+
+	std::vector<shared_ptr<const mesh_data>> meshes;
+	for (uint32_t i = 0; i < view.meshes; i++)
+	{
+		auto mesh = make_shared<mesh_data>();
+		mesh->storage = file;
+		if (!next(mesh->positions) || !next(mesh->normals) || !next(mesh->uvs) || !next(mesh->indices)
+			|| !next(mesh->normal_indices) || !next(mesh->uv_indices))
+			return false;
+		meshes.push_back(mesh);
+	}
+
+	std::vector<shared_ptr<linear_bvh>> bvhs;
+	for (uint32_t i = 0; i < view.bvhs; i++)
+	{
+		auto b = make_shared<linear_bvh>();
+		auto s = make_shared<compiled_scene>();
+		s->storage = file;
+		b->scene = s;
+
+		snapshot_bvh record;
+		if (!next_one(record)) return false;
+		b->box = record.box;
+		b->stats = record.stats;
+		b->packet_min_active = record.packet_min_active;
+
+		if (!next(b->nodes) || !next(b->prim_indices) || !next(s->prims) || !next(s->spheres) || !next(s->moving_spheres)
+			|| !next(s->rects[0]) || !next(s->rects[1]) || !next(s->rects[2]) || !next(s->boxes) || !next(s->media)
+			|| !next(s->translates) || !next(s->rotations) || !next(s->triangles) || !next(s->instances)
+			|| !next(s->emitter_prims))
+			return false;
+
+		const uint32_t* ids;
+		size_t count;
+		if (!next(ids, count)) return false;
+		for (size_t k = 0; k < count; k++)
+		{
+			if (ids[k] >= meshes.size()) return corrupt();
+			s->meshes.push_back(meshes[ids[k]]);
+		}
+		if (!next(ids, count)) return false;
+		for (size_t k = 0; k < count; k++)
+		{
+			if (ids[k] >= i) return corrupt();
+			s->generics.push_back(bvhs[ids[k]]);
+		}
+		if (!next(ids, count)) return false;
+		for (size_t k = 0; k < count; k++)
+		{
+			if (ids[k] >= materials.size()) return corrupt();
+			s->materials.push_back(materials[ids[k]]);
+		}
+
+		for (auto ref : s->emitter_prims)
+			if (auto shape = snapshot_light_shape(*s, ref))
+				s->emitters.push_back(shape);
+
+		bvhs.push_back(b);
+	}
+
+	if (bvhs.empty() || next_array != array_count) return corrupt();
+	bvh = bvhs.back();
+	return true;
+}
+
+// Maps a snapshot written by save_snapshot: fills in scene's camera, background and render
+// options, and sets bvh to the scene, ready to render. scene.objects is left empty.
+inline bool load_snapshot(const std::string& path, scene_description& scene, shared_ptr<linear_bvh>& bvh)
+{
+	return snapshot_reader().open(path, scene, bvh);
+}
+
+// Whether path starts like a snapshot, so --scene can take either a scene file or a snapshot.
+inline bool is_snapshot(const std::string& path)
+{
+	char magic[sizeof(snapshot_magic)] = {};
+	std::ifstream file(path, std::ios::binary);
+	file.read(magic, sizeof(magic));
+	return file && std::memcmp(magic, snapshot_magic, sizeof(magic)) == 0;
+}
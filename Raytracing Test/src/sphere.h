@@ -12,6 +12,7 @@ public:
 		: center(cen), radius(r), mat_ptr(m) {};
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 	virtual double pdf_value(const point3& o, const vec3& v) const override;
@@ -22,6 +23,8 @@ public:
 	shared_ptr<material> mat_ptr;
 
 private:
+	void set_hit_record(const ray& r, double t, hit_record& rec) const;
+
 	static void get_sphere_uv(const point3& p, double& u, double& v)
 	{
 		auto theta = acos(-p.y());
@@ -35,7 +38,7 @@ private:
 double sphere::pdf_value(const point3& o, const vec3& v) const
 {
 	hit_record rec;
-	if (!this->hit(ray(o, v), 0.001, infinity, rec)) return 0;
+	if (!this->hit(ray(o, v), 0, infinity, rec)) return 0;
 
 	auto cos_theta_max = sqrt(1 - radius * radius / (center - o).length_squared());
 	auto solid_angle = 2 * pi * (1 - cos_theta_max);
@@ -76,12 +79,52 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 			return false;
 	}
 
-	rec.t = root;
-	rec.p = r.at(rec.t);
-	vec3 outward_normal = (rec.p - center) / radius;
+	set_hit_record(r, root, rec);
+	return true;
+}
+
+void sphere::set_hit_record(const ray& r, double t, hit_record& rec) const
+{
+	rec.t = t;
+	// Project the hit point back onto the sphere, so its error is a few ulps of the surface, not of the ray.
+	vec3 outward_normal = unit_vector(r.at(rec.t) - center);
+	rec.p = center + radius * outward_normal;
 	rec.set_face_normal(r, outward_normal);
 	get_sphere_uv(outward_normal, rec.u, rec.v);
-	rec.mat_ptr = mat_ptr;
+	rec.uv_scale = 2 * sqrt(pi) * radius;
+	rec.mat_ptr = mat_ptr.get();
+}
 
-	return true;
+void sphere::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	double root[max_packet_size];
+	bool found[max_packet_size];
+
+	for (int k = 0; k < max_packet_size; k++)
+	{
+		auto ocx = rays.org[0][k] - center.e[0];
+		auto ocy = rays.org[1][k] - center.e[1];
+		auto ocz = rays.org[2][k] - center.e[2];
+		auto a = rays.dir[0][k] * rays.dir[0][k] + rays.dir[1][k] * rays.dir[1][k] + rays.dir[2][k] * rays.dir[2][k];
+		auto half_b = ocx * rays.dir[0][k] + ocy * rays.dir[1][k] + ocz * rays.dir[2][k];
+		auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+
+		auto discriminant = half_b * half_b - a * c;
+		auto sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+		auto near_root = (-half_b - sqrtd) / a;
+		auto far_root = (-half_b + sqrtd) / a;
+
+		bool near_ok = discriminant >= 0 && near_root >= t_min && near_root <= rays.t_max[k];
+		bool far_ok = discriminant >= 0 && far_root >= t_min && far_root <= rays.t_max[k];
+		root[k] = near_ok ? near_root : far_root;
+		found[k] = near_ok || far_ok;
+	}
+
+	for (auto lanes = active & lanes_from_flags(found, max_packet_size); lanes; lanes &= lanes - 1)
+	{
+		auto lane = lowest_lane(lanes);
+		set_hit_record(rays.get(lane), root[lane], hits.rec[lane]);
+		rays.t_max[lane] = root[lane];
+		hits.mask |= 1u << lane;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Render statistics are only counted in builds with RT_STATS defined. Without it every count_*
+// call below is an empty inline function, so the renderer pays nothing for them.
+#if defined(RT_STATS)
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+
+enum class ray_kind { camera, bounce, shadow };
+
+// Why a path stopped: it left the scene, a material absorbed it, it reached max_depth bounces, or
+// it lost the Russian roulette.
+enum class path_end { escaped, absorbed, max_depth, roulette };
+
+// Slots for primitive types and material kinds, which are counted by their enum values.
+const int stats_slots = 16;
+
+// Paths ending after this many bounces or more share the last bucket of the depth histogram.
+const int stats_depth_buckets = 64;
+
+// Counts of one thread, or of all of them once merged. Aligned to a cache line so threads never
+// write to the same line.
+struct alignas(64) render_stats
+{
+	uint64_t rays[3] = {};
+	uint64_t nodes_visited = 0;
+	uint64_t prim_tests[stats_slots] = {};
+	uint64_t material_hits[stats_slots] = {};
+	uint64_t path_ends[4] = {};
+	uint64_t path_depths[stats_depth_buckets] = {};
+
+	void add(const render_stats& other)
+	{
+		for (int i = 0; i < 3; i++) rays[i] += other.rays[i];
+		nodes_visited += other.nodes_visited;
+		for (int i = 0; i < stats_slots; i++) prim_tests[i] += other.prim_tests[i];
+		for (int i = 0; i < stats_slots; i++) material_hits[i] += other.material_hits[i];
+		for (int i = 0; i < 4; i++) path_ends[i] += other.path_ends[i];
+		for (int i = 0; i < stats_depth_buckets; i++) path_depths[i] += other.path_depths[i];
+	}
+};
+
+// Owns every thread's counts, so they outlive worker threads that have finished, and sums them
+// when the render is done.
+class stats_registry
+{
+public:
+	render_stats* create()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.push_back(std::make_unique<render_stats>());
+		return threads.back().get();
+	}
+
+	render_stats merged()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		render_stats total;
+		for (const auto& t : threads)
+			total.add(*t);
+		return total;
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<std::unique_ptr<render_stats>> threads;
+};
+
+inline stats_registry& shared_stats()
+{
+	static stats_registry registry;
+	return registry;
+}
+
+inline render_stats& thread_stats()
+{
+	thread_local render_stats* stats = shared_stats().create();
+	return *stats;
+}
+
+inline void count_ray(ray_kind kind, uint64_t n = 1)
+{
+	if constexpr (stats_enabled) thread_stats().rays[static_cast<int>(kind)] += n;
+}
+
+inline void count_node_visit()
+{
+	if constexpr (stats_enabled) thread_stats().nodes_visited++;
+}
+
+inline void count_prim_tests(int type, uint64_t n = 1)
+{
+	if constexpr (stats_enabled) thread_stats().prim_tests[type] += n;
+}
+
+inline void count_material_hit(int kind)
+{
+	if constexpr (stats_enabled) thread_stats().material_hits[kind]++;
+}
+
+inline void count_path_end(path_end reason, int depth)
+{
+	if constexpr (stats_enabled)
+	{
+		auto& stats = thread_stats();
+		stats.path_ends[static_cast<int>(reason)]++;
+		stats.path_depths[depth < stats_depth_buckets - 1 ? depth : stats_depth_buckets - 1]++;
+	}
+}
+
+// BVH nodes this thread has visited so far; differences between two calls give the cost of the
+// work in between. Always zero without RT_STATS.
+inline uint64_t thread_nodes_visited()
+{
+	if constexpr (stats_enabled) return thread_stats().nodes_visited;
+	else return 0;
+}
+
+// Writes merged counts as JSON. The slots of primitive types and material kinds are named by
+// prim_names and material_names; slots that were never counted are left out.
+inline bool write_stats(const std::string& path, const render_stats& stats, const std::vector<std::string>& prim_names,
+	const std::vector<std::string>& material_names, int max_depth)
+{
+	std::ofstream out(path);
+	if (!out)
+	{
+		std::cerr << "Could not write '" << path << "'.\n";
+		return false;
+	}
+
+	auto named_counts = [&](const uint64_t* counts, const std::vector<std::string>& names) {
+		out << '{';
+		const char* separator = " ";
+		for (size_t i = 0; i < names.size() && i < static_cast<size_t>(stats_slots); i++)
+		{
+			if (counts[i] == 0) continue;
+			out << separator << '"' << names[i] << "\": " << counts[i];
+			separator = ", ";
+		}
+		out << " }";
+	};
+
+	auto total_rays = stats.rays[0] + stats.rays[1] + stats.rays[2];
+	out << "{\n  \"rays\": { \"camera\": " << stats.rays[0] << ", \"bounce\": " << stats.rays[1] << ", \"shadow\": " << stats.rays[2]
+		<< ", \"total\": " << total_rays << " },\n";
+	out << "  \"bvh_nodes_visited\": " << stats.nodes_visited << ",\n";
+	out << "  \"bvh_nodes_per_ray\": " << (total_rays > 0 ? static_cast<double>(stats.nodes_visited) / total_rays : 0) << ",\n";
+	out << "  \"primitive_tests\": ";
+	named_counts(stats.prim_tests, prim_names);
+	out << ",\n  \"material_hits\": ";
+	named_counts(stats.material_hits, material_names);
+	out << ",\n  \"path_ends\": { \"escaped\": " << stats.path_ends[0] << ", \"absorbed\": " << stats.path_ends[1]
+		<< ", \"max_depth\": " << stats.path_ends[2] << ", \"roulette\": " << stats.path_ends[3] << " },\n";
+	out << "  \"max_depth\": " << max_depth << ",\n";
+
+	// Paths by the number of bounces they made; the last bucket also holds every deeper path.
+	int used = stats_depth_buckets;
+	while (used > 1 && stats.path_depths[used - 1] == 0) used--;
+	out << "  \"path_depths\": [";
+	for (int i = 0; i < used; i++)
+		out << (i ? ", " : " ") << stats.path_depths[i];
+	out << " ]\n}\n";
+	return static_cast<bool>(out);
+}
@@ -1,16 +1,39 @@
 #pragma once
-#define STB_IMAGE_IMPLEMENTATION
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include "shared.h"
 #include "color.h"
 #include "perlin.h"
-#include "stb_image/stb_image.h"
+#include "texture_cache.h"
+
+// One lookup in a batch: the arguments of texture::filtered_value.
+struct texture_lookup
+{
+	double u;
+	double v;
+	double width;
+	point3 p;
+};
 
 class texture
 {
 public:
 	virtual color value(double u, double v, const point3& p) const = 0;
+
+	// The texture averaged over a footprint about width wide in uv around (u, v). Only textures
+	// with prefiltered levels look at the width.
+	virtual color filtered_value(double u, double v, double /*width*/, const point3& p) const { return value(u, v, p); }
+
+	// filtered_value for count lookups at once. Textures that evaluate several points faster
+	// together than one at a time override it.
+	virtual void filtered_values(const texture_lookup* lookups, size_t count, color* out) const
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = filtered_value(lookups[i].u, lookups[i].v, lookups[i].width, lookups[i].p);
+	}
 };
 
 class solid_color : public texture
@@ -24,7 +47,6 @@ public:
 
 	virtual color value(double u, double v, const vec3& p) const override { return color_value; }
 
-private:
 	color color_value;
 };
 
@@ -46,6 +68,13 @@ public:
 		else return even->value(u, v, p);
 	}
 
+	virtual color filtered_value(double u, double v, double width, const point3& p) const override
+	{
+		auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+		if (sines < 0) return odd->filtered_value(u, v, width, p);
+		else return even->filtered_value(u, v, width, p);
+	}
+
 	shared_ptr<texture> odd;
 	shared_ptr<texture> even;
 };
@@ -61,53 +90,56 @@ public:
 		return color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p)));
 	}
 
+	// Turbulence for the whole batch in one call, so every lane of the noise kernel has a point.
+	virtual void filtered_values(const texture_lookup* lookups, size_t count, color* out) const override
+	{
+		const size_t group = 64;
+		point3 points[group];
+		double turbs[group];
+
+		for (size_t first = 0; first < count; first += group)
+		{
+			auto n = std::min(group, count - first);
+			for (size_t i = 0; i < n; i++)
+				points[i] = lookups[first + i].p;
+			noise.turb(points, n, turbs);
+			for (size_t i = 0; i < n; i++)
+				out[first + i] = color(1, 1, 1) * 0.5 * (1 + sin(scale * points[i].z() + 10 * turbs[i]));
+		}
+	}
+
 	perlin noise;
 	double scale;
 };
 
+// An image read through the shared texture cache, as a tiled mip pyramid it is converted to
+// when loaded, so only the tiles rays land on are in memory, at the level their footprint needs.
 class image_texture : public texture
 {
 public:
-	const static int bytes_per_pixel = 3;
+	image_texture() {}
 
-	image_texture()
-		: data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
-
-	image_texture(const char* filename)
+	image_texture(const char* _filename) : filename(_filename), image(std::make_unique<tiled_image>())
 	{
-		auto components_per_pixel = bytes_per_pixel;
-		data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
-		if (!data) {
-			std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
-			width = height = 0;
-		}
-		bytes_per_scanline = bytes_per_pixel * width;
+		if (!image->open(filename))
+			image.reset();
 	}
 
-	~image_texture() { delete data; }
-
 	virtual color value(double u, double v, const vec3& p) const override
 	{
-		if (data == nullptr)
-			return color(0, 1, 1);
-		
-		u = clamp(u, 0.0, 1.0);
-		v = 1.0 - clamp(v, 0.0, 1.0);
-
-		auto i = static_cast<int>(u * width);
-		auto j = static_cast<int>(v * height);
-
-		if (i >= width)  i = width - 1;
-		if (j >= height) j = height - 1;
-
-		const auto color_scale = 1.0 / 255.0;
-		auto pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
+		return filtered_value(u, v, 0, p);
+	}
 
-		return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+	virtual color filtered_value(double u, double v, double width, const point3& p) const override
+	{
+		if (!image)
+			return color(0, 1, 1);
+		return image->sample(u, v, width);
 	}
 
+	// Where the image came from, so a snapshot can name it rather than copy it.
+	std::string filename;
+
 private:
-	unsigned char* data;
-	int width, height;
-	int bytes_per_scanline;
-};
\ No newline at end of file
+	std::unique_ptr<tiled_image> image;
+};
@@ -0,0 +1,567 @@
+#pragma once
+#define STB_IMAGE_IMPLEMENTATION
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shared.h"
+#include "color.h"
+#include "stb_image/stb_image.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Texels per side of a tile. A tile of 8 bit RGBA texels is 16 KB, a few pages of the converted
+// file and a size the cache can hold thousands of.
+constexpr int texture_tile_size = 64;
+constexpr size_t texture_tile_bytes = texture_tile_size * texture_tile_size * 4;
+
+// A fixed budget of texture tiles shared by every image and every thread. Tiles are kept in
+// shards, each with its own lock and an equal share of the budget, so threads reading different
+// tiles rarely wait on each other. A full shard evicts by the clock algorithm: the hand sweeps
+// the slots, sparing once each tile read since the hand last passed, which approximates LRU
+// without moving anything on a hit.
+class texture_cache
+{
+public:
+	// Sets the budget and the directory converted images are kept in between runs; an empty
+	// directory converts them to temporary files instead. Call before any image is loaded.
+	void configure(size_t budget_bytes, const std::string& directory);
+
+	const std::string& directory() const { return cache_directory; }
+	uint32_t register_image() { return next_image++; }
+
+	// Calls use with the texels of tile number tile of image. Unless the tile is already cached,
+	// load first fills a buffer of texture_tile_bytes with them; it runs without any lock held, so
+	// a slow read stalls no other thread. use runs under the shard's lock and must be short.
+	template <class Load, class Use>
+	void read(uint32_t image, uint64_t tile, Load&& load, Use&& use);
+
+	size_t hits() const;
+	size_t misses() const;
+
+private:
+	static constexpr int shard_count = 16;
+
+	struct slot
+	{
+		uint64_t key;
+		bool referenced;
+		std::unique_ptr<uint8_t[]> texels;
+	};
+
+	struct shard
+	{
+		std::mutex lock;
+		std::unordered_map<uint64_t, uint32_t> index;
+		std::vector<slot> slots;
+		size_t hand = 0;
+		size_t hits = 0, misses = 0;
+	};
+
+	shard shards[shard_count];
+	size_t shard_capacity = (size_t(256) << 20) / texture_tile_bytes / shard_count;
+	std::string cache_directory;
+	std::atomic<uint32_t> next_image{ 0 };
+};
+
+inline texture_cache& shared_texture_cache()
+{
+	static texture_cache cache;
+	return cache;
+}
+
+inline void texture_cache::configure(size_t budget_bytes, const std::string& directory)
+{
+	shard_capacity = std::max<size_t>(1, budget_bytes / texture_tile_bytes / shard_count);
+	cache_directory = directory;
+	for (auto& s : shards)
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		s.index.clear();
+		s.slots.clear();
+		s.hand = 0;
+	}
+}
+
+template <class Load, class Use>
+void texture_cache::read(uint32_t image, uint64_t tile, Load&& load, Use&& use)
+{
+	auto key = (static_cast<uint64_t>(image) << 40) | tile;
+	auto& s = shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+	auto use_cached = [&]() {
+		auto found = s.index.find(key);
+		if (found == s.index.end()) return false;
+		auto& hit = s.slots[found->second];
+		hit.referenced = true;
+		use(hit.texels.get());
+		return true;
+	};
+
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		if (use_cached())
+		{
+			s.hits++;
+			return;
+		}
+	}
+
+	thread_local std::unique_ptr<uint8_t[]> loaded = std::make_unique<uint8_t[]>(texture_tile_bytes);
+	load(loaded.get());
+
+	// Another thread may have loaded the same tile meanwhile.
+	std::lock_guard<std::mutex> guard(s.lock);
+	if (use_cached())
+	{
+		s.hits++;
+		return;
+	}
+
+	s.misses++;
+	uint32_t victim;
+	if (s.slots.size() < shard_capacity)
+	{
+		victim = static_cast<uint32_t>(s.slots.size());
+		s.slots.push_back({ key, true, std::make_unique<uint8_t[]>(texture_tile_bytes) });
+	}
+	else
+	{
+		while (s.slots[s.hand].referenced)
+		{
+			s.slots[s.hand].referenced = false;
+			s.hand = (s.hand + 1) % s.slots.size();
+		}
+		victim = static_cast<uint32_t>(s.hand);
+		s.hand = (s.hand + 1) % s.slots.size();
+		s.index.erase(s.slots[victim].key);
+		s.slots[victim].key = key;
+		s.slots[victim].referenced = true;
+	}
+
+	std::memcpy(s.slots[victim].texels.get(), loaded.get(), texture_tile_bytes);
+	s.index[key] = victim;
+	use(s.slots[victim].texels.get());
+}
+
+inline size_t texture_cache::hits() const
+{
+	size_t total = 0;
+	for (const auto& s : shards) total += s.hits;
+	return total;
+}
+
+inline size_t texture_cache::misses() const
+{
+	size_t total = 0;
+	for (const auto& s : shards) total += s.misses;
+	return total;
+}
+
+// A file opened for reading at given offsets, which threads may do at once on the one handle.
+class tile_file
+{
+public:
+	tile_file() {}
+	~tile_file() { close(); }
+
+	tile_file(const tile_file&) = delete;
+	tile_file& operator=(const tile_file&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	uint64_t size() const { return length; }
+
+	// Reads bytes bytes at offset into buffer; false unless every one was read.
+	bool read(uint64_t offset, void* buffer, size_t bytes) const;
+
+private:
+	uint64_t length = 0;
+
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+#else
+	int fd = -1;
+#endif
+};
+
+#if defined(_WIN32)
+
+inline bool tile_file::open(const std::string& path)
+{
+	close();
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) { close(); return false; }
+	length = static_cast<uint64_t>(file_size.QuadPart);
+	return true;
+}
+
+inline void tile_file::close()
+{
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	length = 0;
+}
+
+inline bool tile_file::read(uint64_t offset, void* buffer, size_t bytes) const
+{
+	// The offset of an OVERLAPPED read applies to that read alone, even on a synchronous handle.
+	OVERLAPPED at = {};
+	at.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+	at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	DWORD done = 0;
+	return ReadFile(file, buffer, static_cast<DWORD>(bytes), &done, &at) && done == bytes;
+}
+
+#else
+
+inline bool tile_file::open(const std::string& path)
+{
+	close();
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) { close(); return false; }
+	length = static_cast<uint64_t>(st.st_size);
+	return true;
+}
+
+inline void tile_file::close()
+{
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+	length = 0;
+}
+
+inline bool tile_file::read(uint64_t offset, void* buffer, size_t bytes) const
+{
+	auto* out = static_cast<uint8_t*>(buffer);
+	while (bytes > 0)
+	{
+		auto n = pread(fd, out, bytes, static_cast<off_t>(offset));
+		if (n <= 0) return false;
+		out += n;
+		offset += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+#endif
+
+struct tiled_image_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t level_count;
+	uint64_t source_size;
+	int64_t source_time;
+};
+
+struct tiled_image_level
+{
+	uint32_t width, height;
+	uint32_t tiles_x, tiles_y;
+	uint64_t first_tile;
+};
+
+// An image converted to a mip pyramid of 8 bit RGBA tiles in a file of its own, which is read a
+// tile at a time into the shared texture_cache; tiles outside it are not held in memory at all. The file is a header, the table of
+// levels, and from data_offset on every tile of every level, finest first, row by row; tiles past
+// an edge of the image repeat its last texels. A converted file is kept in the cache directory,
+// named after the source and checked against its size and time, so later runs skip converting.
+class tiled_image
+{
+public:
+	static constexpr uint32_t current_version = 1;
+	static constexpr uint64_t data_offset = 4096;
+
+	tiled_image() {}
+	~tiled_image();
+
+	tiled_image(const tiled_image&) = delete;
+	tiled_image& operator=(const tiled_image&) = delete;
+
+	bool open(const std::string& source);
+
+	int width() const { return static_cast<int>(levels[0].width); }
+	int height() const { return static_cast<int>(levels[0].height); }
+
+	// Filters over a square footprint width wide in uv, blending the two levels whose texels
+	// are nearest that size; a width of zero reads the full resolution image bilinearly.
+	color sample(double u, double v, double width) const;
+
+private:
+	bool convert(const std::string& source, const std::string& target, const tiled_image_header& header);
+	bool load(const std::string& target, const tiled_image_header& expected);
+	color bilinear(size_t level, double u, double v) const;
+
+	tile_file file;
+	std::vector<tiled_image_level> levels;
+	std::string temporary;
+	uint32_t id = 0;
+};
+
+inline tiled_image::~tiled_image()
+{
+	file.close();
+	if (!temporary.empty())
+	{
+		std::error_code ignored;
+		std::filesystem::remove(temporary, ignored);
+	}
+}
+
+inline bool tiled_image::open(const std::string& source)
+{
+	namespace fs = std::filesystem;
+	auto& cache = shared_texture_cache();
+	id = cache.register_image();
+
+	std::error_code error;
+	tiled_image_header header = {};
+	std::memcpy(header.magic, "RTTILES", 8);
+	header.version = current_version;
+	header.source_size = fs::file_size(source, error);
+	header.source_time = error ? 0 : static_cast<int64_t>(fs::last_write_time(source, error).time_since_epoch().count());
+	if (error)
+	{
+		std::cerr << "ERROR: Could not load texture image file '" << source << "'.\n";
+		return false;
+	}
+
+	std::string target;
+	if (!cache.directory().empty())
+	{
+		auto name = fs::path(source).stem().string() + '-'
+			+ std::to_string(std::hash<std::string>()(fs::absolute(source, error).string())) + ".tiles";
+		target = (fs::path(cache.directory()) / name).string();
+		if (load(target, header)) return true;
+	}
+	else
+	{
+		// Unique across the images of this process and, by the clock, across processes.
+		auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+		target = (fs::temp_directory_path(error) / ("rt-" + std::to_string(stamp) + '-' + std::to_string(id) + ".tiles")).string();
+		temporary = target;
+	}
+
+	return convert(source, target, header) && load(target, header);
+}
+
+// Opens a converted file and reads its table of levels, failing if it does not belong to expected's source.
+inline bool tiled_image::load(const std::string& target, const tiled_image_header& expected)
+{
+	if (!file.open(target)) return false;
+
+	tiled_image_header header;
+	if (file.size() < data_offset || !file.read(0, &header, sizeof(header))) { file.close(); return false; }
+	if (std::memcmp(header.magic, expected.magic, 8) != 0 || header.version != expected.version
+		|| header.source_size != expected.source_size || header.source_time != expected.source_time
+		|| header.level_count == 0 || sizeof(header) + header.level_count * sizeof(tiled_image_level) > data_offset)
+	{
+		file.close();
+		return false;
+	}
+
+	levels.resize(header.level_count);
+	const auto& last = levels.back();
+	if (!file.read(sizeof(header), levels.data(), header.level_count * sizeof(tiled_image_level))
+		|| file.size() < data_offset + (last.first_tile + last.tiles_x * last.tiles_y) * texture_tile_bytes)
+	{
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+inline bool tiled_image::convert(const std::string& source, const std::string& target, const tiled_image_header& expected)
+{
+	int w, h, components;
+	auto pixels = stbi_load(source.c_str(), &w, &h, &components, 4);
+	if (!pixels)
+	{
+		std::cerr << "ERROR: Could not load texture image file '" << source << "'.\n";
+		return false;
+	}
+	std::vector<uint8_t> level(pixels, pixels + static_cast<size_t>(w) * h * 4);
+	stbi_image_free(pixels);
+
+	auto header = expected;
+	header.width = w;
+	header.height = h;
+	std::vector<tiled_image_level> table;
+	uint64_t tile_count = 0;
+	for (uint32_t lw = w, lh = h; ; lw = std::max(1u, lw / 2), lh = std::max(1u, lh / 2))
+	{
+		tiled_image_level l = { lw, lh, (lw + texture_tile_size - 1) / texture_tile_size, (lh + texture_tile_size - 1) / texture_tile_size, tile_count };
+		table.push_back(l);
+		tile_count += static_cast<uint64_t>(l.tiles_x) * l.tiles_y;
+		if (lw == 1 && lh == 1) break;
+	}
+	header.level_count = static_cast<uint32_t>(table.size());
+
+	// Written under another name and renamed into place, so another process never reads half a file.
+	auto partial = target + ".part" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+	std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "Could not create converted texture '" << target << "'.\n";
+		return false;
+	}
+	std::vector<char> start(data_offset, 0);
+	std::memcpy(start.data(), &header, sizeof(header));
+	std::memcpy(start.data() + sizeof(header), table.data(), table.size() * sizeof(tiled_image_level));
+	out.write(start.data(), start.size());
+
+	std::vector<uint8_t> tile(texture_tile_bytes);
+	for (size_t n = 0; n < table.size(); n++)
+	{
+		const auto& l = table[n];
+		if (n > 0)
+		{
+			// Each texel averages the 2x2 block below it; an odd last row or column folds into its neighbour.
+			const auto& finer = table[n - 1];
+			std::vector<uint8_t> next(static_cast<size_t>(l.width) * l.height * 4);
+			for (uint32_t y = 0; y < l.height; y++)
+				for (uint32_t x = 0; x < l.width; x++)
+					for (int c = 0; c < 4; c++)
+					{
+						uint32_t sum = 0;
+						for (uint32_t dy = 0; dy < 2; dy++)
+							for (uint32_t dx = 0; dx < 2; dx++)
+							{
+								auto fx = std::min(2 * x + dx, finer.width - 1);
+								auto fy = std::min(2 * y + dy, finer.height - 1);
+								sum += level[(static_cast<size_t>(fy) * finer.width + fx) * 4 + c];
+							}
+						next[(static_cast<size_t>(y) * l.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+			level.swap(next);
+		}
+
+		for (uint32_t ty = 0; ty < l.tiles_y; ty++)
+			for (uint32_t tx = 0; tx < l.tiles_x; tx++)
+			{
+				for (int y = 0; y < texture_tile_size; y++)
+					for (int x = 0; x < texture_tile_size; x++)
+					{
+						auto sx = std::min(tx * texture_tile_size + x, l.width - 1);
+						auto sy = std::min(ty * texture_tile_size + y, l.height - 1);
+						std::memcpy(&tile[(y * texture_tile_size + x) * 4], &level[(static_cast<size_t>(sy) * l.width + sx) * 4], 4);
+					}
+				out.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+			}
+	}
+
+	out.close();
+	std::error_code error;
+	if (out)
+		std::filesystem::rename(partial, target, error);
+	if (!out || error)
+	{
+		std::cerr << "Could not write converted texture '" << target << "'.\n";
+		std::filesystem::remove(partial, error);
+		return false;
+	}
+	return true;
+}
+
+inline color tiled_image::bilinear(size_t level, double u, double v) const
+{
+	const auto& l = levels[level];
+	auto x = u * l.width - 0.5;
+	auto y = v * l.height - 0.5;
+	auto fx = x - floor(x);
+	auto fy = y - floor(y);
+	int xs[2] = { static_cast<int>(floor(x)), static_cast<int>(floor(x)) + 1 };
+	int ys[2] = { static_cast<int>(floor(y)), static_cast<int>(floor(y)) + 1 };
+	for (int k = 0; k < 2; k++)
+	{
+		xs[k] = std::clamp(xs[k], 0, static_cast<int>(l.width) - 1);
+		ys[k] = std::clamp(ys[k], 0, static_cast<int>(l.height) - 1);
+	}
+
+	// Each tile the four texels fall in is read once, under one lock, for all of the texels in it;
+	// away from tile edges that is a single read.
+	uint8_t texels[2][2][4];
+	uint64_t tiles[2][2];
+	bool done[2][2] = {};
+	for (int j = 0; j < 2; j++)
+		for (int i = 0; i < 2; i++)
+			tiles[j][i] = l.first_tile + static_cast<uint64_t>(ys[j] / texture_tile_size) * l.tiles_x + xs[i] / texture_tile_size;
+	auto offset = [](int x, int y) { return ((y % texture_tile_size) * texture_tile_size + x % texture_tile_size) * 4; };
+
+	auto& cache = shared_texture_cache();
+	for (int j = 0; j < 2; j++)
+		for (int i = 0; i < 2; i++)
+		{
+			if (done[j][i]) continue;
+			auto tile = tiles[j][i];
+			// The size of the file was checked on opening, so a read only fails on an I/O error;
+			// the tile then shows black rather than stopping the render.
+			auto load = [&](uint8_t* t) {
+				if (!file.read(data_offset + tile * texture_tile_bytes, t, texture_tile_bytes))
+					std::memset(t, 0, texture_tile_bytes);
+			};
+			cache.read(id, tile, load, [&](const uint8_t* t) {
+				for (int jj = 0; jj < 2; jj++)
+					for (int ii = 0; ii < 2; ii++)
+						if (!done[jj][ii] && tiles[jj][ii] == tile)
+						{
+							std::memcpy(texels[jj][ii], t + offset(xs[ii], ys[jj]), 4);
+							done[jj][ii] = true;
+						}
+				});
+		}
+
+	color result(0, 0, 0);
+	const double weights[2][2] = { { (1 - fx) * (1 - fy), fx * (1 - fy) }, { (1 - fx) * fy, fx * fy } };
+	for (int j = 0; j < 2; j++)
+		for (int i = 0; i < 2; i++)
+			result += weights[j][i] * color(texels[j][i][0], texels[j][i][1], texels[j][i][2]);
+	return result / 255.0;
+}
+
+inline color tiled_image::sample(double u, double v, double width) const
+{
+	u = clamp(u, 0.0, 1.0);
+	v = 1.0 - clamp(v, 0.0, 1.0);
+
+	// A footprint n texels wide at full resolution is one texel wide log2(n) levels up.
+	auto texels = width * std::max(levels[0].width, levels[0].height);
+	auto lod = texels > 1 ? fmin(log2(texels), static_cast<double>(levels.size() - 1)) : 0.0;
+	auto level = static_cast<size_t>(lod);
+	auto blend = lod - level;
+
+	auto result = bilinear(level, u, v);
+	if (blend > 0)
+		result = (1 - blend) * result + blend * bilinear(level + 1, u, v);
+	return result;
+}
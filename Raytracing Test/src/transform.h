@@ -0,0 +1,146 @@
+#pragma once
+#include <cmath>
+
+#include "shared.h"
+#include "aabb.h"
+#include "ray.h"
+
+// A 3x4 affine matrix: a linear 3x3 part in the first three columns and a translation in the
+// last. Points get the translation, directions do not; normals go through the inverse transpose.
+struct affine_transform
+{
+	double m[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+
+	static affine_transform translation(const vec3& offset)
+	{
+		affine_transform t;
+		for (int i = 0; i < 3; i++) t.m[i][3] = offset[i];
+		return t;
+	}
+
+	static affine_transform scaling(const vec3& scale)
+	{
+		affine_transform t;
+		for (int i = 0; i < 3; i++) t.m[i][i] = scale[i];
+		return t;
+	}
+
+	// Rotates by angle degrees about axis through the origin, by the right hand rule.
+	static affine_transform rotation(const vec3& axis, double angle);
+
+	// Applies other first, then this.
+	affine_transform operator*(const affine_transform& other) const;
+
+	double determinant() const
+	{
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+
+	// Returns false, leaving out untouched, when the linear part is singular.
+	bool inverse(affine_transform& out) const;
+
+	point3 point(const point3& p) const
+	{
+		return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+			m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+			m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+	}
+
+	vec3 vector(const vec3& v) const
+	{
+		return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+			m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+			m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+	}
+
+	// Multiplies by the transpose of the linear part. Called on the inverse, this carries a
+	// normal across the transform the inverse undoes.
+	vec3 transposed_vector(const vec3& v) const
+	{
+		return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+			m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+			m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+	}
+
+	// The ray's parameter t is unchanged, since the direction is transformed without normalizing.
+	ray apply(const ray& r) const { return ray(point(r.origin()), vector(r.direction()), r.time()); }
+
+	// The exact bounds of the transformed box (Arvo 1990): each output extent sums, over the
+	// input axes, whichever of the axis's min and max the matrix entry makes smaller or larger.
+	aabb box(const aabb& b) const
+	{
+		point3 lo, hi;
+		for (int i = 0; i < 3; i++)
+		{
+			lo[i] = hi[i] = m[i][3];
+			for (int j = 0; j < 3; j++)
+			{
+				auto a = m[i][j] * b.min()[j];
+				auto c = m[i][j] * b.max()[j];
+				lo[i] += fmin(a, c);
+				hi[i] += fmax(a, c);
+			}
+		}
+		return aabb(lo, hi);
+	}
+};
+
+inline affine_transform affine_transform::rotation(const vec3& axis, double angle)
+{
+	auto a = unit_vector(axis);
+	auto radians = degrees_to_radians(angle);
+	auto s = sin(radians), c = cos(radians), k = 1 - c;
+
+	// Rodrigues' rotation formula.
+	affine_transform t;
+	t.m[0][0] = c + a[0] * a[0] * k;
+	t.m[0][1] = a[0] * a[1] * k - a[2] * s;
+	t.m[0][2] = a[0] * a[2] * k + a[1] * s;
+	t.m[1][0] = a[1] * a[0] * k + a[2] * s;
+	t.m[1][1] = c + a[1] * a[1] * k;
+	t.m[1][2] = a[1] * a[2] * k - a[0] * s;
+	t.m[2][0] = a[2] * a[0] * k - a[1] * s;
+	t.m[2][1] = a[2] * a[1] * k + a[0] * s;
+	t.m[2][2] = c + a[2] * a[2] * k;
+	return t;
+}
+
+inline affine_transform affine_transform::operator*(const affine_transform& other) const
+{
+	affine_transform t;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 4; j++)
+		{
+			t.m[i][j] = j == 3 ? m[i][3] : 0;
+			for (int k = 0; k < 3; k++)
+				t.m[i][j] += m[i][k] * other.m[k][j];
+		}
+	return t;
+}
+
+inline bool affine_transform::inverse(affine_transform& out) const
+{
+	// Cofactors of the linear part; the adjugate over the determinant is its inverse.
+	double c[3][3];
+	c[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	c[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+	c[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+	c[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	c[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+	c[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+	c[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+	c[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+	c[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+	auto det = m[0][0] * c[0][0] + m[0][1] * c[1][0] + m[0][2] * c[2][0];
+	if (det == 0 || !std::isfinite(det)) return false;
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			out.m[i][j] = c[i][j] / det;
+		out.m[i][3] = -(out.m[i][0] * m[0][3] + out.m[i][1] * m[1][3] + out.m[i][2] * m[2][3]);
+	}
+	return true;
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "shared.h"
+#include "aabb.h"
+#include "flat_array.h"
+#include "hittable.h"
+
+// Indexed triangle geometry. Every triangle names three entries of the shared position buffer.
+// Normals and UVs are optional per-vertex buffers; OBJ files index them separately from the
+// positions, so each has its own index stream, and an empty stream reuses the position indices.
+struct mesh_data
+{
+	flat_array<point3> positions;
+	flat_array<vec3> normals;
+	flat_array<float> uvs;
+	flat_array<uint32_t> indices;
+	flat_array<uint32_t> normal_indices;
+	flat_array<uint32_t> uv_indices;
+
+	// Keeps alive the memory the buffers view, when they were loaded from a snapshot.
+	shared_ptr<const void> storage;
+
+	size_t triangle_count() const { return indices.size() / 3; }
+
+	const point3& vertex(size_t triangle, int corner) const { return positions[indices[triangle * 3 + corner]]; }
+
+	aabb triangle_box(size_t triangle) const;
+	aabb bounds() const;
+
+	// Scales every position about the origin, then moves it by offset.
+	void transform(double scale, const vec3& offset);
+
+	// Fills rec for a hit at distance t and barycentrics (b1, b2) of the second and third corner.
+	void set_hit_record(size_t triangle, const ray& r, double t, double b1, double b2, const material* mat,
+		hit_record& rec) const;
+};
+
+// Moller-Trumbore ray/triangle test against the triangle p0, p0 + e1, p0 + e2.
+inline bool intersect_triangle(const point3& p0, const vec3& e1, const vec3& e2, const ray& r, double t_min, double t_max,
+	double& t, double& b1, double& b2)
+{
+	vec3 pvec = cross(r.direction(), e2);
+	auto det = dot(e1, pvec);
+	if (det == 0) return false;
+	auto inv_det = 1.0 / det;
+
+	vec3 tvec = r.origin() - p0;
+	b1 = dot(tvec, pvec) * inv_det;
+	if (b1 < 0 || b1 > 1) return false;
+
+	vec3 qvec = cross(tvec, e1);
+	b2 = dot(r.direction(), qvec) * inv_det;
+	if (b2 < 0 || b1 + b2 > 1) return false;
+
+	t = dot(e2, qvec) * inv_det;
+	return t >= t_min && t <= t_max;
+}
+
+// The same test for every lane of a packet, written without branches so the loop vectorizes.
+inline void intersect_triangle_packet(const point3& p0, const vec3& e1, const vec3& e2, const ray_packet& rays, double t_min,
+	double* t, double* b1, double* b2, bool* found)
+{
+	for (int k = 0; k < max_packet_size; k++)
+	{
+		auto dx = rays.dir[0][k], dy = rays.dir[1][k], dz = rays.dir[2][k];
+		auto px = dy * e2.e[2] - dz * e2.e[1];
+		auto py = dz * e2.e[0] - dx * e2.e[2];
+		auto pz = dx * e2.e[1] - dy * e2.e[0];
+		auto det = e1.e[0] * px + e1.e[1] * py + e1.e[2] * pz;
+		auto inv_det = 1.0 / (det != 0 ? det : 1.0);
+
+		auto tx = rays.org[0][k] - p0.e[0], ty = rays.org[1][k] - p0.e[1], tz = rays.org[2][k] - p0.e[2];
+		auto u = (tx * px + ty * py + tz * pz) * inv_det;
+
+		auto qx = ty * e1.e[2] - tz * e1.e[1];
+		auto qy = tz * e1.e[0] - tx * e1.e[2];
+		auto qz = tx * e1.e[1] - ty * e1.e[0];
+		auto v = (dx * qx + dy * qy + dz * qz) * inv_det;
+		auto dist = (e2.e[0] * qx + e2.e[1] * qy + e2.e[2] * qz) * inv_det;
+
+		t[k] = dist;
+		b1[k] = u;
+		b2[k] = v;
+		found[k] = det != 0 && u >= 0 && v >= 0 && u + v <= 1 && dist >= t_min && dist <= rays.t_max[k];
+	}
+}
+
+inline aabb mesh_data::triangle_box(size_t triangle) const
+{
+	const auto& a = vertex(triangle, 0);
+	const auto& b = vertex(triangle, 1);
+	const auto& c = vertex(triangle, 2);
+
+	// Padded like the rects, so triangles lying in an axis plane still have a volume.
+	point3 lo, hi;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		lo[axis] = fmin(a[axis], fmin(b[axis], c[axis])) - 0.0001;
+		hi[axis] = fmax(a[axis], fmax(b[axis], c[axis])) + 0.0001;
+	}
+	return aabb(lo, hi);
+}
+
+inline aabb mesh_data::bounds() const
+{
+	if (positions.empty()) return aabb();
+
+	point3 lo = positions[0], hi = positions[0];
+	for (const auto& p : positions)
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = fmin(lo[axis], p[axis]);
+			hi[axis] = fmax(hi[axis], p[axis]);
+		}
+	return aabb(lo, hi);
+}
+
+inline void mesh_data::transform(double scale, const vec3& offset)
+{
+	for (auto& p : positions)
+		p = scale * p + offset;
+}
+
+inline void mesh_data::set_hit_record(size_t triangle, const ray& r, double t, double b1, double b2, const material* mat,
+	hit_record& rec) const
+{
+	const auto& p0 = vertex(triangle, 0);
+	const auto& p1 = vertex(triangle, 1);
+	const auto& p2 = vertex(triangle, 2);
+	auto b0 = 1 - b1 - b2;
+
+	// Interpolating the corners keeps the hit point on the triangle, rather than wherever r.at(t) rounds to.
+	rec.t = t;
+	rec.p = b0 * p0 + b1 * p1 + b2 * p2;
+	rec.mat_ptr = mat;
+
+	// Vertex normals, when there are any, say which side is outside, whatever the winding; the
+	// shading normal is then turned to the side of the geometric one the ray arrived on. Only the
+	// shading normal replaces rec.normal; rays leave along the geometric one.
+	vec3 area_normal = cross(p1 - p0, p2 - p0);
+	vec3 outward_normal = unit_vector(area_normal);
+	vec3 n(0, 0, 0);
+	if (!normals.empty())
+	{
+		const auto& corners = normal_indices.empty() ? indices : normal_indices;
+		n = b0 * normals[corners[triangle * 3]] + b1 * normals[corners[triangle * 3 + 1]]
+			+ b2 * normals[corners[triangle * 3 + 2]];
+		if (dot(n, outward_normal) < 0)
+			outward_normal = -outward_normal;
+	}
+	rec.set_face_normal(r, outward_normal);
+	if (!n.near_zero())
+	{
+		n = unit_vector(n);
+		rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+	}
+
+	if (!uvs.empty())
+	{
+		const auto& corners = uv_indices.empty() ? indices : uv_indices;
+		auto i0 = corners[triangle * 3], i1 = corners[triangle * 3 + 1], i2 = corners[triangle * 3 + 2];
+		rec.u = b0 * uvs[i0 * 2] + b1 * uvs[i1 * 2] + b2 * uvs[i2 * 2];
+		rec.v = b0 * uvs[i0 * 2 + 1] + b1 * uvs[i1 * 2 + 1] + b2 * uvs[i2 * 2 + 1];
+
+		// Both areas are doubled, which cancels.
+		double uv_area = fabs((uvs[i1 * 2] - uvs[i0 * 2]) * (uvs[i2 * 2 + 1] - uvs[i0 * 2 + 1])
+			- (uvs[i2 * 2] - uvs[i0 * 2]) * (uvs[i1 * 2 + 1] - uvs[i0 * 2 + 1]));
+		rec.uv_scale = uv_area > 0 ? sqrt(area_normal.length() / uv_area) : 0;
+	}
+	else
+	{
+		rec.u = b1;
+		rec.v = b2;
+		rec.uv_scale = sqrt(area_normal.length());
+	}
+}
+
+// A mesh with one material. The compiled scene splits it into single triangles, so the BVH is
+// built over triangles; hitting the mesh as a whole, as below, tests every triangle in turn.
+class triangle_mesh : public hittable
+{
+public:
+	triangle_mesh(shared_ptr<const mesh_data> _mesh, shared_ptr<material> m) : mesh(_mesh), mp(m) {}
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const override;
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+	shared_ptr<const mesh_data> mesh;
+	shared_ptr<material> mp;
+};
+
+bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	bool hit_anything = false;
+	for (size_t tri = 0; tri < mesh->triangle_count(); tri++)
+	{
+		const auto& p0 = mesh->vertex(tri, 0);
+		double t, b1, b2;
+		if (intersect_triangle(p0, mesh->vertex(tri, 1) - p0, mesh->vertex(tri, 2) - p0, r, t_min, t_max, t, b1, b2))
+		{
+			mesh->set_hit_record(tri, r, t, b1, b2, mp.get(), rec);
+			t_max = t;
+			hit_anything = true;
+		}
+	}
+	return hit_anything;
+}
+
+void triangle_mesh::hit_packet(ray_packet& rays, uint32_t active, double t_min, packet_hits& hits) const
+{
+	double t[max_packet_size], b1[max_packet_size], b2[max_packet_size];
+	bool found[max_packet_size];
+
+	for (size_t tri = 0; tri < mesh->triangle_count(); tri++)
+	{
+		const auto& p0 = mesh->vertex(tri, 0);
+		intersect_triangle_packet(p0, mesh->vertex(tri, 1) - p0, mesh->vertex(tri, 2) - p0, rays, t_min, t, b1, b2, found);
+
+		for (auto lanes = active & lanes_from_flags(found, max_packet_size); lanes; lanes &= lanes - 1)
+		{
+			auto lane = lowest_lane(lanes);
+			mesh->set_hit_record(tri, rays.get(lane), t[lane], b1[lane], b2[lane], mp.get(), hits.rec[lane]);
+			rays.t_max[lane] = t[lane];
+			hits.mask |= 1u << lane;
+		}
+	}
+}
+
+bool triangle_mesh::bounding_box(double time0, double time1, aabb& output_box) const
+{
+	if (mesh->positions.empty()) return false;
+	output_box = mesh->bounds();
+	output_box = aabb(output_box.min() - vec3(0.0001, 0.0001, 0.0001), output_box.max() + vec3(0.0001, 0.0001, 0.0001));
+	return true;
+}
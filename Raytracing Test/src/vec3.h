@@ -1,23 +1,30 @@
 #pragma once
 #include <cmath>
 #include <iostream>
+#include <type_traits>
 
 #include "shared.h"
 
-class vec3 {
+// Three component vector over scalar type T. The float version is padded to four
+// lanes and 16 byte aligned, so its arithmetic maps onto single SSE instructions.
+template <typename T>
+class vec3_t {
 public:
-	vec3() : e{ 0,0,0 } {}
-	vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+	static constexpr bool simd = std::is_same_v<T, float> && RT_SSE;
+	static constexpr int lanes = std::is_same_v<T, float> ? 4 : 3;
 
-	double x() const { return e[0]; }
-	double y() const { return e[1]; }
-	double z() const { return e[2]; }
+	vec3_t() : e{ 0,0,0 } {}
+	vec3_t(T e0, T e1, T e2) : e{ e0, e1, e2 } {}
 
-	vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-	double operator[](int i) const { return e[i]; }
-	double& operator[](int i) { return e[i]; }
+	T x() const { return e[0]; }
+	T y() const { return e[1]; }
+	T z() const { return e[2]; }
 
-	vec3& operator+=(const vec3& v)
+	vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+	T operator[](int i) const { return e[i]; }
+	T& operator[](int i) { return e[i]; }
+
+	vec3_t& operator+=(const vec3_t& v)
 	{
 		e[0] += v.e[0];
 		e[1] += v.e[1];
@@ -25,7 +32,7 @@ public:
 		return *this;
 	}
 
-	vec3& operator*=(const double t)
+	vec3_t& operator*=(const T t)
 	{
 		e[0] *= t;
 		e[1] *= t;
@@ -33,31 +40,32 @@ public:
 		return *this;
 	}
 
-	vec3& operator/=(const double t)
+	vec3_t& operator/=(const T t)
 	{
 		return *this *= 1 / t;
 	}
 
-	double length() const
+	T length() const
 	{
 		return sqrt(length_squared());
 	}
 
-	double length_squared() const
+	T length_squared() const
 	{
 		return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
 	}
 
 public:
-	double e[3];
-	inline static vec3 random()
+	alignas(lanes * sizeof(T) == 16 ? 16 : alignof(T)) T e[lanes];
+
+	inline static vec3_t random()
 	{
-		return vec3(random_double(), random_double(), random_double());
+		return vec3_t(random_double(), random_double(), random_double());
 	}
 
-	inline static vec3 random(double min, double max)
+	inline static vec3_t random(double min, double max)
 	{
-		return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+		return vec3_t(random_double(min, max), random_double(min, max), random_double(min, max));
 	}
 
 	bool near_zero() const
@@ -68,59 +76,94 @@ public:
 
 };
 
+using vec3 = vec3_t<real>;
+
 using point3 = vec3;
 using color = vec3;
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v)
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const vec3_t<T>& v)
 {
 	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& u, const vec3& v)
+#if RT_SSE
+inline __m128 simd_load(const vec3_t<float>& v) { return _mm_load_ps(v.e); }
+
+inline vec3_t<float> simd_store(__m128 m)
+{
+	vec3_t<float> v;
+	_mm_store_ps(v.e, m);
+	return v;
+}
+#endif
+
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+#if RT_SSE
+	if constexpr (vec3_t<T>::simd) return simd_store(_mm_add_ps(simd_load(u), simd_load(v)));
+#endif
+	return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+#if RT_SSE
+	if constexpr (vec3_t<T>::simd) return simd_store(_mm_sub_ps(simd_load(u), simd_load(v)));
+#endif
+	return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+#if RT_SSE
+	if constexpr (vec3_t<T>::simd) return simd_store(_mm_mul_ps(simd_load(u), simd_load(v)));
+#endif
+	return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator*(std::type_identity_t<T> t, const vec3_t<T>& v)
 {
-	return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+#if RT_SSE
+	if constexpr (vec3_t<T>::simd) return simd_store(_mm_mul_ps(_mm_set1_ps(t), simd_load(v)));
+#endif
+	return vec3_t<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3& v, double t)
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, std::type_identity_t<T> t)
 {
 	return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t)
+template <typename T>
+inline vec3_t<T> operator/(vec3_t<T> v, std::type_identity_t<T> t)
 {
 	return (1 / t) * v;
 }
 
-inline double dot(const vec3& u, const vec3& v)
+template <typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v)
 {
 	return u.e[0] * v.e[0]
 		+ u.e[1] * v.e[1]
 		+ u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+	return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
 		u.e[2] * v.e[0] - u.e[0] * v.e[2],
 		u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(vec3 v)
+template <typename T>
+inline vec3_t<T> unit_vector(vec3_t<T> v)
 {
 	return v / v.length();
 }
@@ -0,0 +1,463 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "shared.h"
+#include "camera.h"
+#include "feature_buffer.h"
+#include "framebuffer.h"
+#include "integrator.h"
+#include "sampler.h"
+#include "scheduler.h"
+
+// Path tracer that advances a whole wave of paths one bounce at a time instead of
+// recursing per pixel. Every bounce runs as separate passes over the wave:
+// intersect, sort by material kind and Morton code, shade per kind, compact.
+// Path state lives in structure of arrays queues so each pass streams through memory.
+// Shadow rays for next-event estimation are traced inline by the shading pass.
+class wavefront_integrator
+{
+public:
+	wavefront_integrator(const hittable& _world, const light_set& _lights, const color& _background, int _max_depth);
+
+	// Adds samples first_sample .. first_sample + sample_count - 1 of every pixel in work to film,
+	// and their first hit features to features when that is given.
+	void render(const camera& cam, const std::vector<tile>& work, int first_sample, int sample_count, uint32_t frame,
+		framebuffer& film, feature_buffer* features = nullptr);
+
+	int threads = 1;
+	int packet_size = 0;
+	int rr_depth = 5;
+	size_t wave_size = 1 << 18;
+
+private:
+	struct path_queue
+	{
+		std::vector<double> org[3], dir[3], time;
+		std::vector<color> throughput;
+		std::vector<uint32_t> slot;
+		std::vector<int> depth;
+		std::vector<double> bsdf_pdf;
+		std::vector<uint8_t> specular;
+		std::vector<double> cone_width, cone_spread;
+		std::vector<sampler> rng;
+		size_t size = 0;
+
+		void resize(size_t n);
+		ray get_ray(size_t i) const;
+		void set_ray(size_t i, const ray& r);
+		void copy(size_t dst, const path_queue& src, size_t src_index);
+	};
+
+	void generate(const camera& cam, int image_width, int image_height, int first_sample, int sample_count, uint32_t frame,
+		size_t first_path, size_t count);
+	void intersect();
+	void sort();
+	void shade();
+	void look_up_albedos(size_t first, size_t last);
+	void compact();
+
+	static void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& order, size_t count, int key_bits,
+		std::vector<uint64_t>& key_tmp, std::vector<uint32_t>& order_tmp);
+
+	static constexpr int kind_shift = 45;
+
+	const hittable& world;
+	const light_set& lights;
+	color background;
+	int max_depth;
+	aabb scene_box;
+
+	std::vector<uint32_t> pixel_order;
+	path_queue current, next;
+	std::vector<color> radiance;
+	std::vector<path_features> first_hits;
+	std::vector<hit_record> hits;
+	std::vector<texture_lookup> lookups;
+	std::vector<color> albedos;
+	std::vector<uint8_t> hit_flag, alive;
+	std::vector<uint64_t> keys, key_tmp;
+	std::vector<uint32_t> order, order_tmp;
+};
+
+inline uint32_t morton_expand3(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xff0000ffu;
+	v = (v * 0x00000101u) & 0x0f00f00fu;
+	v = (v * 0x00000011u) & 0xc30c30c3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+void wavefront_integrator::path_queue::resize(size_t n)
+{
+	size = n;
+	if (time.size() >= n) return;
+
+	for (int a = 0; a < 3; a++)
+	{
+		org[a].resize(n);
+		dir[a].resize(n);
+	}
+	time.resize(n);
+	throughput.resize(n);
+	slot.resize(n);
+	depth.resize(n);
+	bsdf_pdf.resize(n);
+	specular.resize(n);
+	cone_width.resize(n);
+	cone_spread.resize(n);
+	rng.resize(n);
+}
+
+inline ray wavefront_integrator::path_queue::get_ray(size_t i) const
+{
+	return ray(point3(org[0][i], org[1][i], org[2][i]), vec3(dir[0][i], dir[1][i], dir[2][i]), time[i]);
+}
+
+inline void wavefront_integrator::path_queue::set_ray(size_t i, const ray& r)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		org[a][i] = r.orig.e[a];
+		dir[a][i] = r.dir.e[a];
+	}
+	time[i] = r.tm;
+}
+
+inline void wavefront_integrator::path_queue::copy(size_t dst, const path_queue& src, size_t src_index)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		org[a][dst] = src.org[a][src_index];
+		dir[a][dst] = src.dir[a][src_index];
+	}
+	time[dst] = src.time[src_index];
+	throughput[dst] = src.throughput[src_index];
+	slot[dst] = src.slot[src_index];
+	depth[dst] = src.depth[src_index];
+	bsdf_pdf[dst] = src.bsdf_pdf[src_index];
+	specular[dst] = src.specular[src_index];
+	cone_width[dst] = src.cone_width[src_index];
+	cone_spread[dst] = src.cone_spread[src_index];
+	rng[dst] = src.rng[src_index];
+}
+
+wavefront_integrator::wavefront_integrator(const hittable& _world, const light_set& _lights, const color& _background, int _max_depth)
+	: world(_world), lights(_lights), background(_background), max_depth(_max_depth)
+{
+	if (!world.bounding_box(0, 1, scene_box))
+		scene_box = aabb(point3(-1, -1, -1), point3(1, 1, 1));
+}
+
+void wavefront_integrator::render(const camera& cam, const std::vector<tile>& work, int first_sample, int sample_count, uint32_t frame,
+	framebuffer& film, feature_buffer* features)
+{
+	const int image_width = film.width();
+	const int image_height = film.height();
+
+	// Pixels in tile-by-tile Morton order, so consecutive paths start out coherent.
+	tile_scheduler tiles(image_width, image_height);
+	pixel_order.clear();
+	for (const auto& t : work)
+		tiles.for_each_pixel(t, [&](int i, int j) { pixel_order.push_back(static_cast<uint32_t>(j * image_width + i)); });
+
+	auto total_paths = pixel_order.size() * sample_count;
+	auto wave_count = (total_paths + wave_size - 1) / wave_size;
+
+	for (size_t wave = 0; wave < wave_count; wave++)
+	{
+		auto first_path = wave * wave_size;
+		auto count = std::min(wave_size, total_paths - first_path);
+
+		generate(cam, image_width, image_height, first_sample, sample_count, frame, first_path, count);
+		while (current.size > 0)
+		{
+			intersect();
+			sort();
+			shade();
+			compact();
+		}
+
+		// Paths of one pixel are adjacent, so sum them before touching the framebuffer.
+		for (size_t s = 0; s < count; )
+		{
+			auto pixel_slot = (first_path + s) / sample_count;
+			color sum(0, 0, 0);
+			double squares = 0;
+			uint32_t samples = 0;
+			for (; s < count && (first_path + s) / sample_count == pixel_slot; s++, samples++)
+			{
+				sum += radiance[s];
+				squares += luminance(radiance[s]) * luminance(radiance[s]);
+				if (features) features->add(pixel_order[pixel_slot], first_hits[s]);
+			}
+			film.add(pixel_order[pixel_slot], sum, squares, samples);
+		}
+
+		std::cerr << "\rWaves remaining: " << wave_count - wave - 1 << ' ' << std::flush;
+	}
+}
+
+void wavefront_integrator::generate(const camera& cam, int image_width, int image_height, int first_sample, int sample_count, uint32_t frame,
+	size_t first_path, size_t count)
+{
+	current.resize(count);
+	next.resize(count);
+	radiance.assign(count, color(0, 0, 0));
+	first_hits.assign(count, path_features());
+	hits.resize(count);
+	lookups.resize(count);
+	albedos.resize(count);
+	hit_flag.resize(count);
+	alive.resize(count);
+	keys.resize(count);
+	order.resize(count);
+	const auto pixel_spread = cam.pixel_spread(image_height);
+
+	parallel_for(count, threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++)
+		{
+			auto path = first_path + k;
+			auto pixel = pixel_order[path / sample_count];
+			auto i = static_cast<int>(pixel % image_width);
+			auto j = static_cast<int>(pixel / image_width);
+
+			thread_sampler().start_sample(pixel, static_cast<uint32_t>(first_sample + path % sample_count), frame);
+			auto u = (i + random_double()) / (image_width - 1);
+			auto v = (j + random_double()) / (image_height - 1);
+
+			current.set_ray(k, cam.get_ray(u, v));
+			current.throughput[k] = color(1, 1, 1);
+			current.slot[k] = static_cast<uint32_t>(k);
+			current.depth[k] = 0;
+			current.bsdf_pdf[k] = 0;
+			current.specular[k] = true;
+			current.cone_width[k] = 0;
+			current.cone_spread[k] = pixel_spread;
+			current.rng[k] = thread_sampler();
+		}
+		});
+}
+
+void wavefront_integrator::intersect()
+{
+	if (packet_size == 0)
+	{
+		parallel_for(current.size, threads, [&](size_t begin, size_t end) {
+			for (size_t k = begin; k < end; k++)
+			{
+				count_ray(current.depth[k] == 0 ? ray_kind::camera : ray_kind::bounce);
+				hit_flag[k] = world.hit(current.get_ray(k), 0, infinity, hits[k]);
+			}
+			});
+		return;
+	}
+
+	// The queue is ordered by the previous sort, so neighbouring rays leave nearby points and trace well as packets.
+	auto packet_count = (current.size + packet_size - 1) / packet_size;
+	parallel_for(packet_count, threads, [&](size_t begin, size_t end) {
+		ray_packet rays;
+		packet_hits packet;
+		for (size_t p = begin; p < end; p++)
+		{
+			auto first = p * packet_size;
+			rays.resize(static_cast<int>(std::min(current.size - first, static_cast<size_t>(packet_size))));
+			for (int lane = 0; lane < rays.size; lane++)
+			{
+				count_ray(current.depth[first + lane] == 0 ? ray_kind::camera : ray_kind::bounce);
+				rays.set(lane, current.get_ray(first + lane));
+			}
+
+			packet.mask = 0;
+			world.hit_packet(rays, rays.all_lanes(), 0, packet);
+
+			for (int lane = 0; lane < rays.size; lane++)
+			{
+				hit_flag[first + lane] = (packet.mask >> lane) & 1u;
+				if (hit_flag[first + lane])
+					hits[first + lane] = packet.rec[lane];
+			}
+		}
+		}, 64);
+}
+
+void wavefront_integrator::sort()
+{
+	auto extent = scene_box.max() - scene_box.min();
+
+	// Key layout, high to low: material kind (0 for misses), 30 bit Morton code of the hit
+	// point in the scene box, 15 bit Morton code of the incoming direction.
+	parallel_for(current.size, threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++)
+		{
+			order[k] = static_cast<uint32_t>(k);
+			if (!hit_flag[k])
+			{
+				keys[k] = 0;
+				continue;
+			}
+
+			const auto& rec = hits[k];
+			auto inv_length = 1.0 / current.get_ray(k).direction().length();
+			uint32_t cell[3], octant[3];
+			for (int a = 0; a < 3; a++)
+			{
+				auto p = extent[a] > 0 ? (rec.p[a] - scene_box.min()[a]) / extent[a] : 0.0;
+				cell[a] = static_cast<uint32_t>(clamp(p, 0.0, 1.0) * 1023.0);
+				auto d = current.dir[a][k] * inv_length;
+				octant[a] = static_cast<uint32_t>(clamp(d * 0.5 + 0.5, 0.0, 1.0) * 31.0);
+			}
+
+			uint64_t kind = static_cast<uint64_t>(rec.mat_ptr->kind()) + 1;
+			uint64_t position = morton_expand3(cell[0]) | (morton_expand3(cell[1]) << 1) | (morton_expand3(cell[2]) << 2);
+			uint64_t direction = morton_expand3(octant[0]) | (morton_expand3(octant[1]) << 1) | (morton_expand3(octant[2]) << 2);
+			keys[k] = (kind << kind_shift) | (position << 15) | direction;
+		}
+		});
+
+	radix_sort(keys, order, current.size, kind_shift + 3, key_tmp, order_tmp);
+}
+
+void wavefront_integrator::shade()
+{
+	// Shade one material kind at a time so every pass runs the same scatter code.
+	size_t begin = 0;
+	while (begin < current.size)
+	{
+		auto kind = keys[begin] >> kind_shift;
+		auto end = static_cast<size_t>(std::upper_bound(keys.begin() + begin, keys.begin() + current.size,
+			((kind + 1) << kind_shift) - 1) - keys.begin());
+
+		parallel_for(end - begin, threads, [&](size_t first, size_t last) {
+			if (kind != 0)
+				look_up_albedos(begin + first, begin + last);
+
+			for (size_t k = begin + first; k < begin + last; k++)
+			{
+				auto src = order[k];
+				auto slot = current.slot[src];
+				path_state path = { current.get_ray(src), current.throughput[src], radiance[slot], current.depth[src],
+					current.bsdf_pdf[src], current.specular[src] != 0, current.cone_width[src], current.cone_spread[src], {} };
+
+				bool keep = false;
+				if (kind == 0)
+				{
+					count_path_end(path_end::escaped, path.depth);
+					path.radiance += path.throughput * background;
+					path.first_hit.albedo = background;
+				}
+				else
+				{
+					thread_sampler() = current.rng[src];
+					keep = shade_path(path, hits[src], world, lights, max_depth, rr_depth);
+					current.rng[src] = thread_sampler();
+				}
+
+				if (current.depth[src] == 0)
+					first_hits[slot] = path.first_hit;
+
+				radiance[slot] = path.radiance;
+				alive[k] = keep;
+				if (keep)
+				{
+					next.copy(k, current, src);
+					next.set_ray(k, path.r);
+					next.throughput[k] = path.throughput;
+					next.depth[k] = path.depth;
+					next.bsdf_pdf[k] = path.bsdf_pdf;
+					next.specular[k] = path.specular;
+					next.cone_width[k] = path.cone_width;
+					next.cone_spread[k] = path.cone_spread;
+				}
+			}
+			}, 256);
+
+		begin = end;
+	}
+}
+
+// Looks up the albedo textures of sorted hits first .. last - 1 ahead of shading, one batch per
+// run of hits that share a texture, and points their hit records at the results. Sorting put hits
+// of one material next to each other, so the runs are long.
+void wavefront_integrator::look_up_albedos(size_t first, size_t last)
+{
+	size_t k = first;
+	while (k < last)
+	{
+		const texture* albedo = hits[order[k]].mat_ptr->albedo_texture();
+		size_t run = k;
+		for (; run < last; run++)
+		{
+			auto src = order[run];
+			auto& rec = hits[src];
+			if (rec.mat_ptr->albedo_texture() != albedo)
+				break;
+
+			rec.albedo = albedo ? &albedos[run] : nullptr;
+			auto r = current.get_ray(src);
+			auto width = cone_width_at(r, rec, current.cone_width[src], current.cone_spread[src]);
+			lookups[run] = { rec.u, rec.v, cone_footprint(r, rec, width), rec.p };
+		}
+
+		if (albedo)
+			albedo->filtered_values(&lookups[k], run - k, &albedos[k]);
+		k = run;
+	}
+}
+
+void wavefront_integrator::compact()
+{
+	// Exclusive prefix sum of the survivors gives every live path its slot in the packed queue.
+	size_t live = 0;
+	for (size_t k = 0; k < current.size; k++)
+	{
+		order[k] = static_cast<uint32_t>(live);
+		live += alive[k];
+	}
+
+	auto count = current.size;
+	current.size = live;
+	parallel_for(count, threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++)
+			if (alive[k])
+				current.copy(order[k], next, k);
+		});
+}
+
+void wavefront_integrator::radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& order, size_t count, int key_bits,
+	std::vector<uint64_t>& key_tmp, std::vector<uint32_t>& order_tmp)
+{
+	const int digit_bits = 12;
+	const size_t bucket_count = size_t(1) << digit_bits;
+
+	key_tmp.resize(keys.size());
+	order_tmp.resize(order.size());
+	std::vector<size_t> offsets(bucket_count);
+
+	for (int shift = 0; shift < key_bits; shift += digit_bits)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (size_t k = 0; k < count; k++)
+			offsets[(keys[k] >> shift) & (bucket_count - 1)]++;
+
+		size_t sum = 0;
+		for (auto& offset : offsets)
+		{
+			auto bucket_size = offset;
+			offset = sum;
+			sum += bucket_size;
+		}
+
+		for (size_t k = 0; k < count; k++)
+		{
+			auto dst = offsets[(keys[k] >> shift) & (bucket_count - 1)]++;
+			key_tmp[dst] = keys[k];
+			order_tmp[dst] = order[k];
+		}
+		std::swap(keys, key_tmp);
+		std::swap(order, order_tmp);
+	}
+}
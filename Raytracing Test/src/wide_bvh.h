@@ -0,0 +1,271 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "shared.h"
+#include "bvh.h"
+
+// Node of an N-wide BVH. Child boxes are stored as structure of arrays so one SIMD slab
+// test covers every child. A child with prim_count > 0 is a leaf range in prim_indices,
+// otherwise offset is the index of the child node. Unused slots have empty bounds.
+template <int N>
+struct alignas(32) wide_bvh_node
+{
+	float min_x[N], min_y[N], min_z[N];
+	float max_x[N], max_y[N], max_z[N];
+	uint32_t offset[N];
+	uint16_t prim_count[N];
+};
+
+template <int N>
+class wide_bvh : public hittable
+{
+public:
+	static_assert(N == 4 || N == 8, "wide_bvh supports 4 or 8 children per node");
+
+	wide_bvh(const linear_bvh& binary);
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+	{
+		output_box = box;
+		return true;
+	}
+
+	std::vector<wide_bvh_node<N>> nodes;
+	std::vector<uint32_t> prim_indices;
+	shared_ptr<compiled_scene> scene;
+	aabb box;
+
+private:
+	uint32_t collapse(const linear_bvh& binary, uint32_t binary_index);
+
+	// Writes the entry distance of every child into t_near and returns a bit mask of the children hit.
+	static int intersect_children(const wide_bvh_node<N>& node, const float origin[3], const float inv_dir[3],
+		float t_min, float t_max, float t_near[N]);
+};
+
+template <int N>
+wide_bvh<N>::wide_bvh(const linear_bvh& binary)
+	: prim_indices(binary.prim_indices.begin(), binary.prim_indices.end()), scene(binary.scene), box(binary.box)
+{
+	if (binary.nodes.empty()) return;
+
+	nodes.reserve(binary.nodes.size() / (N / 2) + 1);
+	collapse(binary, 0);
+}
+
+template <int N>
+uint32_t wide_bvh<N>::collapse(const linear_bvh& binary, uint32_t binary_index)
+{
+	auto node_index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	auto area = [&](uint32_t i) {
+		const auto& n = binary.nodes[i];
+		auto dx = n.bounds_max[0] - n.bounds_min[0];
+		auto dy = n.bounds_max[1] - n.bounds_min[1];
+		auto dz = n.bounds_max[2] - n.bounds_min[2];
+		return dx * dy + dy * dz + dz * dx;
+	};
+
+	// Open up the interior child with the largest surface area until the node is full.
+	uint32_t children[N];
+	int child_count = 0;
+	const auto& root = binary.nodes[binary_index];
+	if (root.prim_count > 0)
+		children[child_count++] = binary_index;
+	else
+	{
+		children[child_count++] = binary_index + 1;
+		children[child_count++] = root.offset;
+	}
+
+	while (child_count < N)
+	{
+		int best = -1;
+		float best_area = -1;
+		for (int c = 0; c < child_count; c++)
+		{
+			if (binary.nodes[children[c]].prim_count == 0 && area(children[c]) > best_area)
+			{
+				best = c;
+				best_area = area(children[c]);
+			}
+		}
+		if (best < 0) break;
+
+		auto expanded = children[best];
+		children[best] = expanded + 1;
+		children[child_count++] = binary.nodes[expanded].offset;
+	}
+
+	wide_bvh_node<N> node;
+	for (int c = 0; c < N; c++)
+	{
+		node.min_x[c] = node.min_y[c] = node.min_z[c] = std::numeric_limits<float>::infinity();
+		node.max_x[c] = node.max_y[c] = node.max_z[c] = -std::numeric_limits<float>::infinity();
+		node.offset[c] = 0;
+		node.prim_count[c] = 0;
+	}
+
+	for (int c = 0; c < child_count; c++)
+	{
+		const auto& child = binary.nodes[children[c]];
+		node.min_x[c] = child.bounds_min[0];
+		node.min_y[c] = child.bounds_min[1];
+		node.min_z[c] = child.bounds_min[2];
+		node.max_x[c] = child.bounds_max[0];
+		node.max_y[c] = child.bounds_max[1];
+		node.max_z[c] = child.bounds_max[2];
+
+		if (child.prim_count > 0)
+		{
+			node.offset[c] = child.offset;
+			node.prim_count[c] = child.prim_count;
+		}
+		else
+			node.offset[c] = collapse(binary, children[c]);
+	}
+
+	nodes[node_index] = node;
+	return node_index;
+}
+
+template <int N>
+inline int wide_bvh<N>::intersect_children(const wide_bvh_node<N>& node, const float origin[3], const float inv_dir[3],
+	float t_min, float t_max, float t_near[N])
+{
+	// Picking the near and far plane by direction sign avoids min/max per axis and makes
+	// the empty slots (min = +inf, max = -inf) miss for every ray.
+	const float* near_x = inv_dir[0] >= 0 ? node.min_x : node.max_x;
+	const float* far_x = inv_dir[0] >= 0 ? node.max_x : node.min_x;
+	const float* near_y = inv_dir[1] >= 0 ? node.min_y : node.max_y;
+	const float* far_y = inv_dir[1] >= 0 ? node.max_y : node.min_y;
+	const float* near_z = inv_dir[2] >= 0 ? node.min_z : node.max_z;
+	const float* far_z = inv_dir[2] >= 0 ? node.max_z : node.min_z;
+
+	int mask = 0;
+	int c = 0;
+
+#if RT_AVX
+	if constexpr (N == 8)
+	{
+		auto ox = _mm256_set1_ps(origin[0]), oy = _mm256_set1_ps(origin[1]), oz = _mm256_set1_ps(origin[2]);
+		auto ix = _mm256_set1_ps(inv_dir[0]), iy = _mm256_set1_ps(inv_dir[1]), iz = _mm256_set1_ps(inv_dir[2]);
+
+		auto t_enter = _mm256_max_ps(
+			_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_x), ox), ix),
+				_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_y), oy), iy)),
+			_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_z), oz), iz), _mm256_set1_ps(t_min)));
+		auto t_exit = _mm256_min_ps(
+			_mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_x), ox), ix),
+				_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_y), oy), iy)),
+			_mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_z), oz), iz), _mm256_set1_ps(t_max)));
+
+		_mm256_storeu_ps(t_near, t_enter);
+		return _mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ));
+	}
+#endif
+
+#if RT_SSE
+	auto ox = _mm_set1_ps(origin[0]), oy = _mm_set1_ps(origin[1]), oz = _mm_set1_ps(origin[2]);
+	auto ix = _mm_set1_ps(inv_dir[0]), iy = _mm_set1_ps(inv_dir[1]), iz = _mm_set1_ps(inv_dir[2]);
+
+	for (; c < N; c += 4)
+	{
+		auto t_enter = _mm_max_ps(
+			_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_x + c), ox), ix),
+				_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y + c), oy), iy)),
+			_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_z + c), oz), iz), _mm_set1_ps(t_min)));
+		auto t_exit = _mm_min_ps(
+			_mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_x + c), ox), ix),
+				_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y + c), oy), iy)),
+			_mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_z + c), oz), iz), _mm_set1_ps(t_max)));
+
+		_mm_storeu_ps(t_near + c, t_enter);
+		mask |= _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)) << c;
+	}
+#endif
+
+	for (; c < N; c++)
+	{
+		auto t_enter = fmaxf(fmaxf((near_x[c] - origin[0]) * inv_dir[0], (near_y[c] - origin[1]) * inv_dir[1]),
+			fmaxf((near_z[c] - origin[2]) * inv_dir[2], t_min));
+		auto t_exit = fminf(fminf((far_x[c] - origin[0]) * inv_dir[0], (far_y[c] - origin[1]) * inv_dir[1]),
+			fminf((far_z[c] - origin[2]) * inv_dir[2], t_max));
+		t_near[c] = t_enter;
+		if (t_enter <= t_exit) mask |= 1 << c;
+	}
+	return mask;
+}
+
+template <int N>
+bool wide_bvh<N>::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	if (nodes.empty()) return false;
+
+	struct stack_entry
+	{
+		uint32_t offset;
+		uint16_t prim_count;
+		float t_near;
+	};
+
+	const float origin[3] = { static_cast<float>(r.origin().x()), static_cast<float>(r.origin().y()), static_cast<float>(r.origin().z()) };
+	const float inv_dir[3] = { 1.0f / static_cast<float>(r.direction().x()), 1.0f / static_cast<float>(r.direction().y()),
+		1.0f / static_cast<float>(r.direction().z()) };
+
+	// Widen the float interval slightly so rounding of the ray can never cull a box the double precision test would hit.
+	const float box_t_min = static_cast<float>(t_min) * (1.0f - 1e-5f) - 1e-5f;
+
+	stack_entry stack[64 * N];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, box_t_min };
+	bool hit_anything = false;
+
+	while (stack_size > 0)
+	{
+		auto entry = stack[--stack_size];
+		auto box_t_max = static_cast<float>(t_max) * (1.0f + 1e-5f) + 1e-5f;
+		if (entry.t_near > box_t_max) continue;
+
+		if (entry.prim_count > 0)
+		{
+			for (uint32_t i = 0; i < entry.prim_count; i++)
+			{
+				if (scene->hit(prim_indices[entry.offset + i], r, t_min, t_max, rec))
+				{
+					hit_anything = true;
+					t_max = rec.t;
+				}
+			}
+			continue;
+		}
+
+		count_node_visit();
+		const auto& node = nodes[entry.offset];
+		float t_near[N];
+		int mask = intersect_children(node, origin, inv_dir, box_t_min, box_t_max, t_near);
+
+		// Push hit children far to near so the nearest is popped first.
+		int first = stack_size;
+		while (mask)
+		{
+			int c = 0;
+			while (!(mask & (1 << c))) c++;
+			mask &= mask - 1;
+
+			stack_entry child = { node.offset[c], node.prim_count[c], t_near[c] };
+			int k = stack_size++;
+			while (k > first && stack[k - 1].t_near < child.t_near)
+			{
+				stack[k] = stack[k - 1];
+				k--;
+			}
+			stack[k] = child;
+		}
+	}
+	return hit_anything;
+}